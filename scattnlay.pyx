@@ -24,7 +24,7 @@
 #    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 # distutils: language = c++
-# distutils: sources = nmie.cc
+# distutils: sources = nmie.cc nmie-field-avx2.cc nmie-field-avx512.cc nmie-threads.cc
 
 from __future__ import division
 import numpy as np
@@ -54,7 +54,7 @@ O. Pena, U. Pal, Comput. Phys. Commun. 180 (2009) 2348-2354.""",
       license = 'GPL',
       platforms = 'any',
       ext_modules = [Extension("scattnlay",
-                               ["src/nmie.cc", "src/py_nmie.cc", "src/scattnlay.cpp"],
+                               ["src/nmie.cc", "src/nmie-field-avx2.cc", "src/nmie-field-avx512.cc", "src/nmie-threads.cc", "src/py_nmie.cc", "src/scattnlay.cpp"],
                                language = "c++",
                                include_dirs = [np.get_include()])], 
       extra_compile_args=['-std=c++11']
@@ -55,7 +55,7 @@ O. Pena, U. Pal, Comput. Phys. Commun. 180 (2009) 2348-2354.""",
       license = 'GPL',
       platforms = 'any',
       ext_modules = cythonize("scattnlay.pyx",                                                    # our Cython source
-                              sources = ["src/nmie.cc", "src/py_nmie.cc", "src/scattnlay.cpp"],   # additional source file(s)
+                              sources = ["src/nmie.cc", "src/nmie-field-avx2.cc", "src/nmie-field-avx512.cc", "src/nmie-threads.cc", "src/py_nmie.cc", "src/scattnlay.cpp"],   # additional source file(s)
                               language = "c++",                                                   # generate C++ code
                               extra_compile_args = ['-std=c++11'],
                               include_dirs = [np.get_include()]
@@ -30,14 +30,34 @@
 /// @brief  Wrapper class around nMie function for ease of use
 ///
 #include "nmie-applied.h"
+#include "nmie-batch.h"
 #include <array>
 #include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <limits>
 #include <stdexcept>
 #include <vector>
 
 namespace nmie {  
+  namespace {
+    // Calculate the particles in x and m (L layers each) with batch, false
+    // if the calculation failed
+    bool CalcBatch(unsigned int L, int pl, const std::vector<double>& x,
+                   const std::vector< std::complex<double> >& m, MieBatch& batch) {
+      try {
+        batch.SetParticles(L, x, m);
+        batch.SetPECLayer(pl);
+        batch.RunMieCalculation();
+      } catch(const std::invalid_argument& ia) {
+        return false;
+      }
+      return true;
+    }
+  }
+
+
   //**********************************************************************************//
   // This function emulates a C call to calculate the actual scattering parameters    //
   // and amplitudes.                                                                  //
@@ -75,8 +95,8 @@ namespace nmie {
         throw std::invalid_argument("Declared number of sample for Theta is not correct!");
     try {
       MultiLayerMieApplied ml_mie;
-      ml_mie.SetAllLayersSize(x);
-      ml_mie.SetAllLayersIndex(m);
+      ml_mie.SetLayersSize(x);
+      ml_mie.SetLayersIndex(m);
       ml_mie.SetAngles(Theta);
       ml_mie.SetPECLayer(pl);
       ml_mie.SetMaxTerms(nmax);
@@ -132,7 +152,6 @@ namespace nmie {
     }
     printf("Faild D1[0] from continued fraction (z = %16.14f): %g\n", faild_x,
            calcD1confra(0,z).real());
-    //D1[nmax_] = calcD1confra(nmax_, z);
   
     
   }
@@ -144,14 +163,26 @@ namespace nmie {
     if (width <= 0)
       throw std::invalid_argument("Layer width should be positive!");
     target_width_.push_back(width);
-    target_index_.push_back(layer_index);
+    target_material_.push_back(Material(layer_index));
+    WLs_.clear();
+  }  // end of void  MultiLayerMieApplied::AddTargetLayer(...)  
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  void MultiLayerMieApplied::AddTargetLayer(double width, const Material& layer_material) {
+    MarkUncalculated();
+    if (width <= 0)
+      throw std::invalid_argument("Layer width should be positive!");
+    target_width_.push_back(width);
+    target_material_.push_back(layer_material);
+    WLs_.clear();
   }  // end of void  MultiLayerMieApplied::AddTargetLayer(...)  
   // ********************************************************************** //
   // ********************************************************************** //
   // ********************************************************************** //
   void MultiLayerMieApplied::SetTargetPEC(double radius) {
     MarkUncalculated();
-    if (target_width_.size() != 0 || target_index_.size() != 0)
+    if (target_width_.size() != 0 || target_material_.size() != 0)
       throw std::invalid_argument("Error! Define PEC target radius before any other layers!");
     // Add layer of any index...
     AddTargetLayer(radius, std::complex<double>(0.0, 0.0));
@@ -163,12 +194,21 @@ namespace nmie {
   // ********************************************************************** //
   void MultiLayerMieApplied::SetCoatingIndex(std::vector<std::complex<double> > index) {
     MarkUncalculated();
-    coating_index_.clear();
-    for (auto value : index) coating_index_.push_back(value);
+    coating_material_.clear();
+    for (auto value : index) coating_material_.push_back(Material(value));
+    WLs_.clear();
   }  // end of void MultiLayerMieApplied::SetCoatingIndex(std::vector<complex> index);  
   // ********************************************************************** //
   // ********************************************************************** //
   // ********************************************************************** //
+  void MultiLayerMieApplied::SetCoatingMaterial(const std::vector<Material>& material) {
+    MarkUncalculated();
+    coating_material_ = material;
+    WLs_.clear();
+  }  // end of void MultiLayerMieApplied::SetCoatingMaterial(...);  
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
   void MultiLayerMieApplied::SetCoatingWidth(std::vector<double> width) {
     MarkUncalculated();
     coating_width_.clear();
@@ -241,8 +281,10 @@ namespace nmie {
   void MultiLayerMieApplied::GenerateIndex() {
     MarkUncalculated();
     refractive_index_.clear();
-    for (auto index : target_index_) refractive_index_.push_back(index);
-    for (auto index : coating_index_) refractive_index_.push_back(index);
+    for (const auto& material : target_material_)
+      refractive_index_.push_back(material.GetIndex(wavelength_));
+    for (const auto& material : coating_material_)
+      refractive_index_.push_back(material.GetIndex(wavelength_));
   }  // end of void MultiLayerMieApplied::GenerateIndex();
   // ********************************************************************** //
   // ********************************************************************** //
@@ -256,35 +298,576 @@ namespace nmie {
   // ********************************************************************** //
   std::vector< std::vector<double> >
   MultiLayerMieApplied::GetSpectra(double from_WL, double to_WL, int samples) {
-    if (!isMieCalculated())
-      throw std::invalid_argument("You should run calculations before result request!");
+    std::vector<double> rows;
+    GetSpectra(from_WL, to_WL, samples, rows);
     std::vector< std::vector<double> > spectra;
-    double step_WL = (to_WL - from_WL)/static_cast<double>(samples);
-    double wavelength_backup = wavelength_;
     long fails = 0;
-    for (double WL = from_WL; WL < to_WL; WL += step_WL) {
-      wavelength_ = WL;
-      try {
-        RunMieCalculation();
-      } catch(const std::invalid_argument& ia) {
+    for (int i = 0; i < samples; i++) {
+      const double* row = &rows[5*i];
+      if (!std::isfinite(row[1])) {
         fails++;
         continue;
       }
-      //printf("%3.1f ",WL);
-      spectra.push_back(std::vector<double>({wavelength_, GetQext(),
-	      GetQsca(), GetQabs(), GetQbk()}));
+      spectra.push_back(std::vector<double>(row, row + 5));
     }  // end of for each WL in spectra
     printf("Spectrum has %li fails\n",fails);
-    wavelength_ = wavelength_backup;
     return spectra;
   }
   // ********************************************************************** //
+  // Spectrum calculated in parallel. Row i of spectra is                   //
+  // {WL, Qext, Qsca, Qabs, Qbk} for                                        //
+  // WL = from_WL + i*(to_WL - from_WL)/samples, with NaN efficiencies if   //
+  // the calculation failed.                                                //
+  // ********************************************************************** //
+  void MultiLayerMieApplied::GetSpectra(double from_WL, double to_WL, int samples,
+                                        std::vector<double>& spectra, ThreadPool& pool) {
+    if (!isMieCalculated())
+      throw std::invalid_argument("You should run calculations before result request!");
+    if (samples < 1)
+      throw std::invalid_argument("Number of samples should be positive!");
+    const double step_WL = (to_WL - from_WL)/static_cast<double>(samples);
+    spectra.assign(5*samples, std::numeric_limits<double>::quiet_NaN());
+    for (int i = 0; i < samples; i++) spectra[5*i] = from_WL + i*step_WL;
+    CalcSpectrumRows(spectra, 0, pool);
+  }
+  // ********************************************************************** //
+  // Adaptive spectrum. The interval [from_WL, to_WL] is split in 'samples' //
+  // equal intervals, then the intervals next to a sample where Qext, Qsca  //
+  // or Qabs differ from the linear interpolation of the two neighbouring   //
+  // samples by more than tolerance*(largest efficiency in the spectrum)    //
+  // are bisected, until the curvature is small everywhere or max_samples   //
+  // wavelengths were calculated. All the midpoints of a round are          //
+  // calculated together; if they do not fit in the budget, the intervals   //
+  // with the largest error go first. Features much narrower than the       //
+  // initial intervals can be missed. Rows are sorted by wavelength and     //
+  // have the same format as GetSpectra.                                    //
+  // ********************************************************************** //
+  void MultiLayerMieApplied::GetSpectraAdaptive(double from_WL, double to_WL, int samples,
+                                                double tolerance, int max_samples,
+                                                std::vector<double>& spectra, ThreadPool& pool) {
+    if (!isMieCalculated())
+      throw std::invalid_argument("You should run calculations before result request!");
+    if (samples < 1)
+      throw std::invalid_argument("Number of samples should be positive!");
+    if (!(tolerance > 0.0))
+      throw std::invalid_argument("Tolerance should be positive!");
+    const double step_WL = (to_WL - from_WL)/static_cast<double>(samples);
+    // Initial samples include both ends of the interval
+    spectra.assign(5*(samples + 1), std::numeric_limits<double>::quiet_NaN());
+    for (int i = 0; i <= samples; i++) spectra[5*i] = from_WL + i*step_WL;
+    CalcSpectrumRows(spectra, 0, pool);
+
+    // Rows in order of wavelength; new rows are appended to spectra
+    std::vector<unsigned long> order(samples + 1);
+    for (unsigned long i = 0; i < order.size(); i++) order[i] = i;
+    auto by_WL = [&](unsigned long i, unsigned long j) {return spectra[5*i] < spectra[5*j];};
+    std::sort(order.begin(), order.end(), by_WL);
+    // Intervals are not bisected below this width
+    const double min_width = 1e-9*std::abs(to_WL - from_WL);
+
+    struct Interval {
+      double error;
+      unsigned long a, b;
+    };
+    std::vector<Interval> intervals;
+    std::vector<double> error;
+    while (true) {
+      double scale = 0.0;  // Largest absolute value of Qext, Qsca and Qabs
+      for (unsigned long i = 0; i < spectra.size()/5; i++)
+        for (int j = 1; j < 4; j++)
+          if (std::isfinite(spectra[5*i + j])) scale = std::max(scale, std::abs(spectra[5*i + j]));
+      if (scale == 0.0) break;
+      // Scaled difference between each sample and the linear interpolation of
+      // its neighbours (NaN if any of them failed)
+      error.assign(order.size(), 0.0);
+      for (unsigned long k = 1; k + 1 < order.size(); k++) {
+        const double* prev = &spectra[5*order[k - 1]];
+        const double* cur = &spectra[5*order[k]];
+        const double* next = &spectra[5*order[k + 1]];
+        const double t = (cur[0] - prev[0])/(next[0] - prev[0]);
+        for (int j = 1; j < 4; j++)
+          error[k] = std::max(error[k], std::abs(cur[j] - ((1.0 - t)*prev[j] + t*next[j]))/scale);
+      }
+      intervals.clear();
+      for (unsigned long k = 0; k + 1 < order.size(); k++) {
+        const double err = std::max(error[k], error[k + 1]);
+        if (err > tolerance && spectra[5*order[k + 1]] - spectra[5*order[k]] > min_width)
+          intervals.push_back({err, order[k], order[k + 1]});
+      }
+      const long budget = static_cast<long>(max_samples) - static_cast<long>(order.size());
+      if (intervals.empty() || budget <= 0) break;
+      if (intervals.size() > static_cast<unsigned long>(budget)) {
+        std::stable_sort(intervals.begin(), intervals.end(), [](const Interval& i, const Interval& j) {
+            return i.error > j.error;
+          });
+        intervals.resize(budget);
+      }
+
+      const unsigned long first = order.size();
+      spectra.resize(5*(first + intervals.size()), std::numeric_limits<double>::quiet_NaN());
+      for (unsigned long i = 0; i < intervals.size(); i++) {
+        spectra[5*(first + i)] = 0.5*(spectra[5*intervals[i].a] + spectra[5*intervals[i].b]);
+        order.push_back(first + i);
+      }
+      CalcSpectrumRows(spectra, first, pool);
+      std::sort(order.begin(), order.end(), by_WL);
+    }
+
+    std::vector<double> sorted(spectra.size());
+    for (unsigned long k = 0; k < order.size(); k++)
+      std::copy(&spectra[5*order[k]], &spectra[5*order[k]] + 5, &sorted[5*k]);
+    spectra.swap(sorted);
+  }
+  // ********************************************************************** //
+  // Fit a rational surrogate to a uniform spectrum. The midpoints of the   //
+  // samples are calculated too, so that the error estimate of the          //
+  // surrogate also covers wavelengths that were not used for the fit.      //
+  // ********************************************************************** //
+  void MultiLayerMieApplied::GetSpectrumSurrogate(double from_WL, double to_WL, int samples,
+                                                  double tolerance, SpectrumSurrogate& surrogate,
+                                                  ThreadPool& pool) {
+    if (!isMieCalculated())
+      throw std::invalid_argument("You should run calculations before result request!");
+    if (samples < 1)
+      throw std::invalid_argument("Number of samples should be positive!");
+    const double step_WL = (to_WL - from_WL)/static_cast<double>(samples);
+    // Rows [0, samples] are the fitted samples, the rest their midpoints
+    std::vector<double> spectra(5*(2*samples + 1), std::numeric_limits<double>::quiet_NaN());
+    for (int i = 0; i <= samples; i++) spectra[5*i] = from_WL + i*step_WL;
+    for (int i = 0; i < samples; i++) spectra[5*(samples + 1 + i)] = from_WL + (i + 0.5)*step_WL;
+    CalcSpectrumRows(spectra, 0, pool);
+    surrogate.Fit(std::vector<double>(spectra.begin(), spectra.begin() + 5*(samples + 1)), tolerance);
+    surrogate.Validate(std::vector<double>(spectra.begin() + 5*(samples + 1), spectra.end()));
+  }
+  // ********************************************************************** //
+  // Calculate the efficiencies of rows [first, end) of spectra, for the    //
+  // wavelengths already stored in their first column. Each thread of the   //
+  // pool takes chunks of consecutive rows and calculates them with its own //
+  // batched engine. If a chunk fails, its rows are calculated one at a     //
+  // time, so that only the failing wavelengths are left as NaN.            //
+  // ********************************************************************** //
+  void MultiLayerMieApplied::CalcSpectrumRows(std::vector<double>& spectra, unsigned long first,
+                                              ThreadPool& pool) {
+    const unsigned long samples = spectra.size()/5 - first;
+    if (samples == 0) return;
+    const bool is_SP = target_width_.size() + coating_width_.size() == 0;
+    const unsigned int L = is_SP ? size_param_.size()
+      : target_material_.size() + coating_material_.size();
+    if (L == 0 || (is_SP && refractive_index_.size() != L)
+        || (!is_SP && target_width_.size() + coating_width_.size() != L))
+      throw std::invalid_argument("Each layer should have only one index!");
+    // Indexes of all layers at each wavelength, [i*L + l]
+    const std::complex<double>* index = nullptr;
+    if (!is_SP) {
+      std::vector<double> WLs(samples);
+      for (unsigned long i = 0; i < samples; i++) WLs[i] = spectra[5*(first + i)];
+      index = GetSpectrumIndex(WLs).data();
+    }
+
+    std::vector<MieBatch> batches(pool.GetThreadCount());
+    const unsigned long chunk = std::max(16ul, samples/(2ul*pool.GetThreadCount()));
+    pool.ParallelFor(samples, chunk, [&](unsigned long begin, unsigned long count, unsigned int thread) {
+        std::vector<double> x;
+        std::vector< std::complex<double> > m;
+        for (unsigned long i = begin; i < begin + count; i++)
+          GenerateSpectrumLayers(spectra[5*(first + i)], is_SP ? nullptr : index + i*L, x, m);
+        MieBatch& batch = batches[thread];
+        auto store = [&](unsigned long i, unsigned long particle) {
+          double* row = &spectra[5*(first + i)];
+          row[1] = batch.GetQext()[particle];
+          row[2] = batch.GetQsca()[particle];
+          row[3] = batch.GetQabs()[particle];
+          row[4] = batch.GetQbk()[particle];
+        };
+        if (CalcBatch(L, GetPECLayer(), x, m, batch)) {
+          for (unsigned long i = 0; i < count; i++) store(begin + i, i);
+          return;
+        }
+        // Some particle failed, calculate them one at a time
+        std::vector<double> x1;
+        std::vector< std::complex<double> > m1;
+        for (unsigned long i = 0; i < count; i++) {
+          x1.assign(x.begin() + i*L, x.begin() + (i + 1)*L);
+          m1.assign(m.begin() + i*L, m.begin() + (i + 1)*L);
+          if (CalcBatch(L, GetPECLayer(), x1, m1, batch)) store(begin + i, 0);
+        }
+      });
+  }
+  // ********************************************************************** //
+  // Indexes of all the layers at each wavelength of WLs, [i*L + l]. They   //
+  // are cached until the grid or the materials change, so that repeated    //
+  // spectra on the same grid (e.g. while sweeping the layer widths)        //
+  // evaluate the materials once.                                           //
+  // ********************************************************************** //
+  const std::vector< std::complex<double> >&
+  MultiLayerMieApplied::GetSpectrumIndex(const std::vector<double>& WLs) {
+    if (WLs != WLs_) {
+      const unsigned int L = target_material_.size() + coating_material_.size();
+      WLs_.clear();  // Invalid until all the indexes are calculated
+      WLs_index_.resize(L*WLs.size());
+      unsigned int l = 0;
+      for (const auto* materials : {&target_material_, &coating_material_}) {
+        for (const auto& material : *materials) {
+          const std::vector< std::complex<double> > values = material.GetIndex(WLs);
+          for (unsigned long i = 0; i < WLs.size(); i++) WLs_index_[i*L + l] = values[i];
+          l++;
+        }
+      }
+      WLs_ = WLs;
+    }
+    return WLs_index_;
+  }
+  // ********************************************************************** //
+  // Parameter sweep. Points are scheduled in tiles: axes are reordered so  //
+  // that the ones touching only outer layers change fastest, and a tile    //
+  // is (a piece of) one combination of the slower axes, e.g. all the       //
+  // coating widths at one wavelength. All the particles of a tile have the //
+  // same inner layers, which the batched engine calculates only once.      //
+  // Each thread of the pool takes whole tiles. If a tile fails, its points //
+  // are calculated one at a time, so that only the failing ones are NaN.   //
+  // ********************************************************************** //
+  void MultiLayerMieApplied::GetSweep(const std::vector<SweepAxis>& axes, std::vector<double>& Q,
+                                      ThreadPool& pool) {
+    if (!isMieCalculated())
+      throw std::invalid_argument("You should run calculations before result request!");
+    const unsigned int L = target_width_.size() + coating_width_.size();
+    if (L == 0)
+      throw std::invalid_argument("Sweeps need a design in applied units!");
+    if (target_material_.size() + coating_material_.size() != L)
+      throw std::invalid_argument("Each layer should have only one index!");
+    const unsigned int D = axes.size();
+    int WL_axis = -1;
+    unsigned long total = 1;
+    // Innermost layer changed by each axis
+    std::vector<unsigned int> first_layer(D);
+    for (unsigned int d = 0; d < D; d++) {
+      if (axes[d].parameter == SweepAxis::kWavelength) {
+        if (WL_axis >= 0)
+          throw std::invalid_argument("Only one axis can sweep the wavelength!");
+        WL_axis = d;
+        first_layer[d] = 0;
+      } else {
+        if (axes[d].layer >= L)
+          throw std::invalid_argument("Swept layer does not exist!");
+        first_layer[d] = axes[d].layer;
+      }
+      if (axes[d].size() == 0)
+        throw std::invalid_argument("Sweep axes should not be empty!");
+      total *= axes[d].size();
+    }
+    Q.assign(4*total, std::numeric_limits<double>::quiet_NaN());
+
+    // Indexes of the layers at each wavelength, [i*L + l]
+    const std::vector<double> WLs = WL_axis >= 0 ? axes[WL_axis].values
+      : std::vector<double>(1, wavelength_);
+    const std::vector< std::complex<double> >& index = GetSpectrumIndex(WLs);
+    std::vector<double> widths(target_width_);
+    widths.insert(widths.end(), coating_width_.begin(), coating_width_.end());
+
+    // Scheduling order of the axes and strides of the output
+    std::vector<unsigned int> order(D);
+    for (unsigned int d = 0; d < D; d++) order[d] = d;
+    std::stable_sort(order.begin(), order.end(),
+                     [&](unsigned int a, unsigned int b) {return first_layer[a] < first_layer[b];});
+    std::vector<unsigned long> stride(D, 1);
+    for (int d = static_cast<int>(D) - 2; d >= 0; d--) stride[d] = stride[d + 1]*axes[d + 1].size();
+    // Points that share their inner layers: all the values of the trailing
+    // axes that do not touch the core
+    unsigned long shared = 1;
+    for (int d = static_cast<int>(D) - 1; d >= 0 && first_layer[order[d]] > 0; d--)
+      shared *= axes[order[d]].size();
+    // Tiles are split to keep all the threads busy, or merged when they are
+    // too small to fill the vector lanes (then only the outer size parameter
+    // can be shared, e.g. in maps of the index)
+    const unsigned long kMinTile = 16, kMaxTile = 1024;
+    if (shared < kMinTile)
+      shared = std::min(total, std::max(64ul, std::min(kMaxTile, total/(2ul*pool.GetThreadCount()))));
+    const unsigned long groups = (total + shared - 1)/shared;
+    unsigned long pieces = std::max((shared + kMaxTile - 1)/kMaxTile,
+                                    (2ul*pool.GetThreadCount() + groups - 1)/groups);
+    pieces = std::max(1ul, std::min(pieces, shared/kMinTile));
+    const unsigned long tile = (shared + pieces - 1)/pieces;
+
+    std::vector<MieBatch> batches(pool.GetThreadCount());
+    pool.ParallelFor(groups*pieces, 1, [&](unsigned long first, unsigned long count, unsigned int thread) {
+        std::vector<double> x, w, x1;
+        std::vector< std::complex<double> > m, m1;
+        std::vector<unsigned long> out;
+        std::vector< std::pair<unsigned int, std::complex<double> > > set_index;
+        for (unsigned long t = first; t < first + count; t++) {
+          const unsigned long begin = (t/pieces)*shared + (t%pieces)*tile;
+          const unsigned long end = std::min(std::min(begin + tile, (t/pieces + 1)*shared), total);
+          if (begin >= end) continue;
+          x.clear();
+          m.clear();
+          out.clear();
+          for (unsigned long j = begin; j < end; j++) {
+            // Values of the axes for point j in scheduling order
+            unsigned long rest = j, i_out = 0, i_WL = 0;
+            w = widths;
+            set_index.clear();
+            for (int d = static_cast<int>(D) - 1; d >= 0; d--) {
+              const SweepAxis& axis = axes[order[d]];
+              const unsigned long i = rest%axis.size();
+              rest /= axis.size();
+              i_out += i*stride[order[d]];
+              if (axis.parameter == SweepAxis::kWavelength) i_WL = i;
+              else if (axis.parameter == SweepAxis::kWidth) w[axis.layer] = axis.values[i];
+              else set_index.push_back(std::make_pair(axis.layer, axis.indexes[i]));
+            }
+            double radius = 0.0;
+            for (unsigned int l = 0; l < L; l++) {
+              radius += w[l];
+              x.push_back(2*PI_*radius/WLs[i_WL]);
+            }
+            m.insert(m.end(), &index[i_WL*L], &index[i_WL*L] + L);
+            for (const auto& value : set_index) m[m.size() - L + value.first] = value.second;
+            out.push_back(i_out);
+          }
+          MieBatch& batch = batches[thread];
+          auto store = [&](unsigned long k, unsigned long particle) {
+            double* point = &Q[4*out[k]];
+            point[0] = batch.GetQext()[particle];
+            point[1] = batch.GetQsca()[particle];
+            point[2] = batch.GetQabs()[particle];
+            point[3] = batch.GetQbk()[particle];
+          };
+          if (CalcBatch(L, GetPECLayer(), x, m, batch)) {
+            for (unsigned long k = 0; k < out.size(); k++) store(k, k);
+            continue;
+          }
+          // Some particle failed, calculate them one at a time
+          for (unsigned long k = 0; k < out.size(); k++) {
+            x1.assign(x.begin() + k*L, x.begin() + (k + 1)*L);
+            m1.assign(m.begin() + k*L, m.begin() + (k + 1)*L);
+            if (CalcBatch(L, GetPECLayer(), x1, m1, batch)) store(k, 0);
+          }
+        }
+      });
+  }
+  // ********************************************************************** //
+  // Map of the efficiencies over a grid of refractive indexes n + ik of    //
+  // one layer, as a sweep with a single index axis: with a fixed geometry  //
+  // and wavelength the Riccati-Bessel functions of the outer size          //
+  // parameter are calculated once per tile, and so are the layers below.   //
+  // ********************************************************************** //
+  void MultiLayerMieApplied::GetIndexMap(unsigned int layer, const std::vector<double>& n,
+                                         const std::vector<double>& k, std::vector<double>& Q,
+                                         ThreadPool& pool) {
+    std::vector< std::complex<double> > indexes;
+    indexes.reserve(n.size()*k.size());
+    for (auto n_value : n)
+      for (auto k_value : k) indexes.push_back(std::complex<double>(n_value, k_value));
+    GetSweep({SweepAxis::Index(layer, indexes)}, Q, pool);
+  }
+  // ********************************************************************** //
+  // Resonances of the multipoles. Near a resonance 1/an = 1 - Yi + i*Yr,   //
+  // so Yr = Im(1/an) changes sign at it and |an|^2 falls to half of its    //
+  // peak at Yr = +-Re(1/an), which gives the width from the slope of Yr.   //
+  // The scan brackets the sign changes of Yr for each multipole; the ones  //
+  // that jump against the trend of the neighbouring samples are poles of   //
+  // 1/an (zeros of an) and are skipped. Each bracket is refined by Brent's //
+  // method in parallel. Roots where Yr is still large at both sides of     //
+  // the final bracket (poles) or where Re(an) < 1e-3 (overdamped modes)    //
+  // are dropped.                                                           //
+  // ********************************************************************** //
+  void MultiLayerMieApplied::GetResonances(double from_WL, double to_WL, int samples,
+                                           std::vector<Resonance>& resonances, ThreadPool& pool) {
+    if (!isMieCalculated())
+      throw std::invalid_argument("You should run calculations before result request!");
+    if (target_width_.size() + coating_width_.size() == 0)
+      throw std::invalid_argument("Resonances need a design in applied units!");
+    if (samples < 1)
+      throw std::invalid_argument("Number of samples should be positive!");
+    const double step_WL = (to_WL - from_WL)/static_cast<double>(samples);
+    const int pl = GetPECLayer();
+    std::vector<MultiLayerMie> models(pool.GetThreadCount());
+
+    // 1/an and 1/bn at the samples, [c][i][n] with c = 0 (an) or 1 (bn)
+    std::vector< std::vector< std::complex<double> > > inverse[2];
+    inverse[0].resize(samples + 1);
+    inverse[1].resize(samples + 1);
+    pool.ParallelFor(samples + 1, 0, [&](unsigned long first, unsigned long count, unsigned int thread) {
+        MultiLayerMie& model = models[thread];
+        for (unsigned long i = first; i < first + count; i++) {
+          CalcCoefficients(from_WL + i*step_WL, pl, model);
+          for (int c = 0; c < 2; c++) {
+            const std::vector< std::complex<double> >& coefficients = c == 0 ? model.GetAn() : model.GetBn();
+            inverse[c][i].resize(coefficients.size());
+            for (unsigned long n = 0; n < coefficients.size(); n++)
+              inverse[c][i][n] = 1.0/coefficients[n];
+          }
+        }
+      });
+
+    // Sign changes of Im(1/an) and Im(1/bn) that are not poles
+    struct Bracket {
+      int c, n;
+      double from, to, Y_from, Y_to;
+    };
+    std::vector<Bracket> brackets;
+    for (int c = 0; c < 2; c++) {
+      const std::vector< std::vector< std::complex<double> > >& inv = inverse[c];
+      for (int i = 0; i < samples; i++) {
+        const unsigned long terms = std::min(inv[i].size(), inv[i + 1].size());
+        for (unsigned long n = 0; n < terms; n++) {
+          const double Y0 = inv[i][n].imag(), Y1 = inv[i + 1][n].imag();
+          if ((Y0 > 0.0) == (Y1 > 0.0)) continue;
+          bool checked = false, pole = true;
+          if (i > 0 && n < inv[i - 1].size()) {
+            checked = true;
+            if ((Y0 - inv[i - 1][n].imag())*(Y1 - Y0) > 0.0) pole = false;
+          }
+          if (i + 1 < samples && n < inv[i + 2].size()) {
+            checked = true;
+            if ((inv[i + 2][n].imag() - Y1)*(Y1 - Y0) > 0.0) pole = false;
+          }
+          if (checked && pole) continue;
+          brackets.push_back({c, static_cast<int>(n), from_WL + i*step_WL, from_WL + (i + 1)*step_WL, Y0, Y1});
+        }
+      }
+    }
+
+    // Refine each bracket
+    std::vector<Resonance> found(brackets.size());
+    std::vector<char> valid(brackets.size(), 0);
+    pool.ParallelFor(brackets.size(), 1, [&](unsigned long first, unsigned long count, unsigned int thread) {
+        MultiLayerMie& model = models[thread];
+        for (unsigned long k = first; k < first + count; k++) {
+          const Bracket& bracket = brackets[k];
+          // 1/an (or 1/bn) of the bracket multipole at WL, NaN if it has less terms
+          auto inverse_at = [&](double WL) {
+            CalcCoefficients(WL, pl, model);
+            const std::vector< std::complex<double> >& coefficients = bracket.c == 0 ? model.GetAn() : model.GetBn();
+            if (static_cast<unsigned long>(bracket.n) >= coefficients.size())
+              return std::complex<double>(std::numeric_limits<double>::quiet_NaN(), 0.0);
+            return 1.0/coefficients[bracket.n];
+          };
+          // Brent's method on Im(1/an)
+          double a = bracket.from, b = bracket.to, fa = bracket.Y_from, fb = bracket.Y_to;
+          double c = a, fc = fa, d = b - a, e = d;
+          for (int iteration = 0; iteration < 100; iteration++) {
+            if ((fb > 0.0) == (fc > 0.0)) {
+              c = a;
+              fc = fa;
+              d = e = b - a;
+            }
+            if (std::abs(fc) < std::abs(fb)) {
+              a = b; b = c; c = a;
+              fa = fb; fb = fc; fc = fa;
+            }
+            const double tol = (2.0*std::numeric_limits<double>::epsilon() + 0.5e-10)*std::abs(b);
+            const double xm = 0.5*(c - b);
+            if (std::abs(xm) <= tol || fb == 0.0) break;
+            if (std::abs(e) >= tol && std::abs(fa) > std::abs(fb)) {
+              // Inverse quadratic interpolation or secant
+              double p, q, r;
+              const double s = fb/fa;
+              if (a == c) {
+                p = 2.0*xm*s;
+                q = 1.0 - s;
+              } else {
+                q = fa/fc;
+                r = fb/fc;
+                p = s*(2.0*xm*q*(q - r) - (b - a)*(r - 1.0));
+                q = (q - 1.0)*(r - 1.0)*(s - 1.0);
+              }
+              if (p > 0.0) q = -q;
+              p = std::abs(p);
+              if (2.0*p < std::min(3.0*xm*q - std::abs(tol*q), std::abs(e*q))) {
+                e = d;
+                d = p/q;
+              } else {
+                d = xm;
+                e = d;
+              }
+            } else {  // Bisection
+              d = xm;
+              e = d;
+            }
+            a = b;
+            fa = fb;
+            b += std::abs(d) > tol ? d : (xm > 0.0 ? tol : -tol);
+            fb = inverse_at(b).imag();
+            if (std::isnan(fb)) break;
+          }
+          const std::complex<double> inv = inverse_at(b);
+          if (std::isnan(inv.real()) || std::abs(fc) > inv.real()) continue;  // Pole
+          const std::complex<double> coefficient = 1.0/inv;
+          if (coefficient.real() < 1e-3) continue;
+          const double x = model.GetLayersSize().back(), h = 1e-6*b;
+          double Qext = 0.0;
+          for (unsigned long n = 0; n < model.GetAn().size(); n++)
+            Qext += (2.0*n + 3.0)*(model.GetAn()[n].real() + model.GetBn()[n].real());
+          Qext *= 2.0/(x*x);
+          Resonance& resonance = found[k];
+          resonance.WL = b;
+          resonance.electric = bracket.c == 0;
+          resonance.order = bracket.n + 1;
+          resonance.Qext = 2.0/(x*x)*(2.0*bracket.n + 3.0)*coefficient.real();
+          resonance.fraction = resonance.Qext/Qext;
+          const double slope = (inverse_at(b + h).imag() - inverse_at(b - h).imag())/(2.0*h);
+          resonance.width = 2.0*inv.real()/std::abs(slope);
+          valid[k] = 1;
+        }
+      });
+    resonances.clear();
+    for (unsigned long k = 0; k < found.size(); k++)
+      if (valid[k]) resonances.push_back(found[k]);
+    std::sort(resonances.begin(), resonances.end(),
+              [](const Resonance& a, const Resonance& b) {return a.WL < b.WL;});
+  }
+  // ********************************************************************** //
+  // Define model as the layers of the design at wavelength WL and          //
+  // calculate its scattering coefficients                                  //
+  // ********************************************************************** //
+  void MultiLayerMieApplied::CalcCoefficients(double WL, int pl, MultiLayerMie& model) const {
+    std::vector< std::complex<double> > index;
+    for (const auto* materials : {&target_material_, &coating_material_})
+      for (const auto& material : *materials) index.push_back(material.GetIndex(WL));
+    std::vector<double> x;
+    std::vector< std::complex<double> > m;
+    GenerateSpectrumLayers(WL, index.data(), x, m);
+    model.SetLayersSize(x);
+    model.SetLayersIndex(m);
+    model.SetPECLayer(pl);
+    model.calcScattCoeffs();
+  }
+  // ********************************************************************** //
+  // Append the size parameters of all layers at wavelength WL to x and     //
+  // their indexes (L values, not used for designs in size parameter units) //
+  // to m, return the number of layers. If the design is given in size      //
+  // parameter units it does not depend on the wavelength.                  //
+  // ********************************************************************** //
+  unsigned int MultiLayerMieApplied::GenerateSpectrumLayers(double WL, const std::complex<double>* index,
+                                                            std::vector<double>& x,
+                                                            std::vector< std::complex<double> >& m) const {
+    if (target_width_.size() + coating_width_.size() == 0) {
+      x.insert(x.end(), size_param_.begin(), size_param_.end());
+      m.insert(m.end(), refractive_index_.begin(), refractive_index_.end());
+      return size_param_.size();
+    }
+    double radius = 0.0;
+    for (auto width : target_width_) {
+      radius += width;
+      x.push_back(2*PI_*radius/WL);
+    }
+    for (auto width : coating_width_) {
+      radius += width;
+      x.push_back(2*PI_*radius/WL);
+    }
+    const unsigned int L = target_width_.size() + coating_width_.size();
+    m.insert(m.end(), index, index + L);
+    return L;
+  }
+  // ********************************************************************** //
   // ********************************************************************** //
   // ********************************************************************** //
   void MultiLayerMieApplied::ClearTarget() {
     MarkUncalculated();
     target_width_.clear();
-    target_index_.clear();
+    target_material_.clear();
+    WLs_.clear();
   }
   // ********************************************************************** //
   // ********************************************************************** //
@@ -292,7 +875,8 @@ namespace nmie {
   void MultiLayerMieApplied::ClearCoating() {
     MarkUncalculated();
     coating_width_.clear();
-    coating_index_.clear();
+    coating_material_.clear();
+    WLs_.clear();
   }
   // ********************************************************************** //
   // ********************************************************************** //
@@ -318,110 +902,6 @@ namespace nmie {
   // ********************************************************************** //
   // ********************************************************************** //
   // ********************************************************************** //
-  //**********************************************************************************//
-  // Function CONFRA ported from MIEV0.f (Wiscombe,1979)
-  // Ref. to NCAR Technical Notes, Wiscombe, 1979
-  /*
-c         Compute Bessel function ratio A-sub-N from its
-c         continued fraction using Lentz method
-
-c         ZINV = Reciprocal of argument of A
-
-
-c    I N T E R N A L    V A R I A B L E S
-c    ------------------------------------
-
-c    CAK      Term in continued fraction expansion of A (Eq. R25)
-c     a_k
-
-c    CAPT     Factor used in Lentz iteration for A (Eq. R27)
-c     T_k
-
-c    CNUMER   Numerator   in capT  (Eq. R28A)
-c     N_k
-c    CDENOM   Denominator in capT  (Eq. R28B)
-c     D_k
-
-c    CDTD     Product of two successive denominators of capT factors
-c                 (Eq. R34C)
-c     xi_1
-
-c    CNTN     Product of two successive numerators of capT factors
-c                 (Eq. R34B)
-c     xi_2
-
-c    EPS1     Ill-conditioning criterion
-c    EPS2     Convergence criterion
-
-c    KK       Subscript k of cAk  (Eq. R25B)
-c     k
-
-c    KOUNT    Iteration counter (used to prevent infinite looping)
-
-c    MAXIT    Max. allowed no. of iterations
-
-c    MM + 1  and - 1, alternately
-*/
-  std::complex<double> MultiLayerMieApplied::calcD1confra(const int N, const std::complex<double> z) {
-  // NTMR -> nmax_ - 1  \\TODO nmax_ ?
-    //int N = nmax_ - 1;
-    int KK, KOUNT, MAXIT = 10000, MM;
-    //    double EPS1=1.0e-2;
-    double EPS2=1.0e-8;
-    std::complex<double> CAK, CAPT, CDENOM, CDTD, CNTN, CNUMER;
-    std::complex<double> one = std::complex<double>(1.0,0.0);
-    std::complex<double> ZINV = one/z;
-// c                                 ** Eq. R25a
-    std::complex<double> CONFRA = static_cast<std::complex<double> >(N + 1)*ZINV;   //debug ZINV
-    MM = - 1; 
-    KK = 2*N +3; //debug 3
-// c                                 ** Eq. R25b, k=2
-    CAK    = static_cast<std::complex<double> >(MM*KK)*ZINV; //debug -3 ZINV
-    CDENOM = CAK;
-    CNUMER = CDENOM + one/CONFRA; //-3zinv+z
-    KOUNT  = 1;
-    //10 CONTINUE
-    do {      ++KOUNT;
-      if (KOUNT > MAXIT) {
-        printf("re(%g):im(%g)\t\n", CONFRA.real(), CONFRA.imag());
-        throw std::invalid_argument("ConFra--Iteration failed to converge!\n");
-      }
-      MM *= - 1;      KK += 2;  //debug  mm=1 kk=5
-      CAK = static_cast<std::complex<double> >(MM*KK)*ZINV; //    ** Eq. R25b //debug 5zinv
-     //  //c ** Eq. R32    Ill-conditioned case -- stride two terms instead of one
-     //  if (std::abs(CNUMER/CAK) >= EPS1 ||  std::abs(CDENOM/CAK) >= EPS1) {
-     //         //c                       ** Eq. R34
-     //         CNTN   = CAK*CNUMER + 1.0;
-     //         CDTD   = CAK*CDENOM + 1.0;
-     //         CONFRA = (CNTN/CDTD)*CONFRA; // ** Eq. R33
-     //         MM  *= - 1;        KK  += 2;
-     //         CAK = static_cast<std::complex<double> >(MM*KK)*ZINV; // ** Eq. R25b
-     //         //c                        ** Eq. R35
-     //         CNUMER = CAK + CNUMER/CNTN;
-     //         CDENOM = CAK + CDENOM/CDTD;
-     //         ++KOUNT;
-     //         //GO TO  10
-     //         continue;
-     // } else { //c                           *** Well-conditioned case
-      {
-        CAPT   = CNUMER/CDENOM; // ** Eq. R27 //debug (-3zinv + z)/(-3zinv)
-        // printf("re(%g):im(%g)**\t", CAPT.real(), CAPT.imag());
-       CONFRA = CAPT*CONFRA; // ** Eq. R26
-       //if (N == 0) {output=true;printf(" re:");prn(CONFRA.real());printf(" im:"); prn(CONFRA.imag());output=false;};
-       //c                                  ** Check for convergence; Eq. R31
-       if (std::abs(CAPT.real() - 1.0) >= EPS2 ||  std::abs(CAPT.imag()) >= EPS2) {
-//c                                        ** Eq. R30
-         CNUMER = CAK + one/CNUMER;
-         CDENOM = CAK + one/CDENOM;
-         continue;
-         //GO TO  10
-       }  // end of if < eps2
-      }
-      break;
-    } while(1);    
-    //if (N == 0)  printf(" return confra for z=(%g,%g)\n", ZINV.real(), ZINV.imag());
-    return CONFRA;
-  }
   // ********************************************************************** //
   // ********************************************************************** //
   // ********************************************************************** //
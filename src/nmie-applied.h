@@ -33,6 +33,9 @@
 #include <iostream>
 #include <vector>
 #include "nmie.h"
+#include "nmie-material.h"
+#include "nmie-surrogate.h"
+#include "nmie-threads.h"
 
 
 namespace nmie {
@@ -44,6 +47,38 @@ namespace nmie {
 
 
 
+  // One axis of a parameter sweep (see MultiLayerMieApplied::GetSweep): the
+  // wavelength, or the width or index of a layer. Layers are counted from the
+  // core, target layers first and then coating layers.
+  struct SweepAxis {
+    enum Parameter {kWavelength, kWidth, kIndex};
+    Parameter parameter;
+    unsigned int layer;
+    std::vector<double> values;                    // Wavelengths or widths
+    std::vector< std::complex<double> > indexes;   // Indexes
+
+    static SweepAxis Wavelength(const std::vector<double>& WLs) {
+      return {kWavelength, 0, WLs, {}};
+    };
+    static SweepAxis Width(unsigned int layer, const std::vector<double>& widths) {
+      return {kWidth, layer, widths, {}};
+    };
+    static SweepAxis Index(unsigned int layer, const std::vector< std::complex<double> >& indexes) {
+      return {kIndex, layer, {}, indexes};
+    };
+    unsigned long size() const {return parameter == kIndex ? indexes.size() : values.size();};
+  };
+
+  // Resonance of one multipole (see MultiLayerMieApplied::GetResonances)
+  struct Resonance {
+    double WL;         // Wavelength where Im(1/an) (or 1/bn) crosses zero
+    double width;      // Full width at half maximum of |an|^2 (linearized)
+    bool electric;     // an (electric) or bn (magnetic) multipole
+    int order;         // Order n of the multipole (1 for dipoles)
+    double Qext;       // Extinction efficiency of the multipole at WL
+    double fraction;   // Its part of the total extinction at WL
+  };
+
   class MultiLayerMieApplied : public MultiLayerMie {
     // Will throw for any error!
    public:
@@ -64,6 +99,7 @@ namespace nmie {
     // For many runs it can be convenient to separate target and coating layers.
     // Per layer
     void AddTargetLayer(double layer_width, std::complex<double> layer_index);
+    void AddTargetLayer(double layer_width, const Material& layer_material);
     void AddCoatingLayer(double layer_width, std::complex<double> layer_index);
     // For all layers
     void SetTargetWidth(std::vector<double> width);
@@ -71,6 +107,7 @@ namespace nmie {
     void SetTargetPEC(double radius);
     void SetCoatingWidth(std::vector<double> width);
     void SetCoatingIndex(std::vector< std::complex<double> > index);
+    void SetCoatingMaterial(const std::vector<Material>& material);
     void SetFieldPoints(std::vector< std::array<double,3> > coords);
 
     //Set parameters in size parameter units
@@ -97,6 +134,40 @@ namespace nmie {
     std::vector< std::complex<double> >  GetCoatingLayersIndex();
     std::vector< std::vector<double> >   GetFieldPoints();
     std::vector< std::vector<double> > GetSpectra(double from_WL, double to_WL, int samples);  // ext, sca, abs, bk
+    // Same spectrum calculated in parallel, stored as rows of {WL, ext, sca, abs, bk}
+    // in a contiguous array of 5*samples values (NaN for failed wavelengths)
+    void GetSpectra(double from_WL, double to_WL, int samples, std::vector<double>& spectra,
+                    ThreadPool& pool = ThreadPool::Shared());
+    // Adaptive spectrum in the same format, sorted by wavelength: starts from 'samples'
+    // equal intervals and bisects the ones next to a sample where Qext, Qsca or Qabs
+    // deviate from the interpolation of its neighbours by more than 'tolerance' (relative
+    // to the largest efficiency of the spectrum), until none does or max_samples
+    // wavelengths were calculated
+    void GetSpectraAdaptive(double from_WL, double to_WL, int samples, double tolerance,
+                            int max_samples, std::vector<double>& spectra,
+                            ThreadPool& pool = ThreadPool::Shared());
+    // Rational surrogate of the spectrum fitted to samples + 1 equally spaced wavelengths
+    // (from_WL and to_WL included) and validated at their midpoints
+    void GetSpectrumSurrogate(double from_WL, double to_WL, int samples, double tolerance,
+                              SpectrumSurrogate& surrogate,
+                              ThreadPool& pool = ThreadPool::Shared());
+    // Efficiencies {ext, sca, abs, bk} for all the combinations of the values of
+    // the axes, stored in a contiguous array of 4*(product of the axis sizes)
+    // values, row-major with the last axis changing fastest (NaN if failed).
+    // Parameters without an axis keep the values of the design.
+    void GetSweep(const std::vector<SweepAxis>& axes, std::vector<double>& Q,
+                  ThreadPool& pool = ThreadPool::Shared());
+    // Efficiencies {ext, sca, abs, bk} at the current wavelength for all the indexes
+    // n[i] + i*k[j] of one layer, stored as Q[4*(i*k.size() + j) + q]
+    void GetIndexMap(unsigned int layer, const std::vector<double>& n, const std::vector<double>& k,
+                     std::vector<double>& Q, ThreadPool& pool = ThreadPool::Shared());
+    // Resonances of the multipoles between from_WL and to_WL, sorted by wavelength.
+    // They are bracketed by the sign changes of Im(1/an) and Im(1/bn) on 'samples'
+    // equally spaced wavelengths and refined by root finding; two resonances of the
+    // same multipole between consecutive samples are missed.
+    void GetResonances(double from_WL, double to_WL, int samples,
+                       std::vector<Resonance>& resonances,
+                       ThreadPool& pool = ThreadPool::Shared());
     double GetRCSext();
     double GetRCSsca();
     double GetRCSabs();
@@ -133,6 +204,12 @@ namespace nmie {
     void ConvertToSP();
     void GenerateSizeParameter();
     void GenerateIndex();
+    unsigned int GenerateSpectrumLayers(double WL, const std::complex<double>* index,
+                                        std::vector<double>& x,
+                                        std::vector< std::complex<double> >& m) const;
+    void CalcSpectrumRows(std::vector<double>& spectra, unsigned long first, ThreadPool& pool);
+    const std::vector< std::complex<double> >& GetSpectrumIndex(const std::vector<double>& WLs);
+    void CalcCoefficients(double WL, int pl, MultiLayerMie& model) const;
     void InitMieCalculations();
 
     void sbesjh(std::complex<double> z, std::vector<std::complex<double> >& jn,
@@ -140,13 +217,15 @@ namespace nmie {
 	            std::vector<std::complex<double> >& h1np);
     void sphericalBessel(std::complex<double> z, std::vector<std::complex<double> >& bj,
 			             std::vector<std::complex<double> >& by, std::vector<std::complex<double> >& bd);
-    std::complex<double> calcD1confra(int N, const std::complex<double> z);
     
     double wavelength_ = 1.0;
     double total_radius_ = 0.0;
-    /// Width and index for each layer of the structure
+    /// Width and material for each layer of the structure
     std::vector<double> target_width_, coating_width_;
-    std::vector< std::complex<double> > target_index_, coating_index_;
+    std::vector<Material> target_material_, coating_material_;
+    /// Indexes of the layers for the wavelengths WLs_ (see GetSpectrumIndex)
+    std::vector<double> WLs_;
+    std::vector< std::complex<double> > WLs_index_;
 
     std::vector< std::vector<double> > coords_sp_;
 
@@ -0,0 +1,450 @@
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+
+//**********************************************************************************//
+// Same algorithm as MultiLayerMie::calcScattCoeffs and RunMieCalculation (see      //
+// nmie.cc), written for blocks of particles. All equations numbers refer to:       //
+//    [2] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//**********************************************************************************//
+#include "nmie-batch.h"
+#include "nmie-simd.h"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+namespace nmie {
+  using simd::CPack;
+  using simd::GetLane;
+  using simd::SetLane;
+
+
+  // ********************************************************************** //
+  // Define the particles to be calculated                                  //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMieBatch<FloatType>::SetParticles(unsigned int L, const std::vector<FloatType>& x,
+                                              const std::vector<std::complex<FloatType> >& m) {
+    if (L == 0 || x.size() % L != 0)
+      throw std::invalid_argument("Declared number of layers do not fit x!");
+    if (m.size() != x.size())
+      throw std::invalid_argument("Each size parameter should have only one index!");
+    for (unsigned long i = 0; i < x.size(); i++) {
+      if (x[i] <= 0.0)
+        throw std::invalid_argument("Size parameter should be positive!");
+      if (i % L != 0 && x[i - 1] > x[i])
+        throw std::invalid_argument
+          ("Size parameter for next layer should be larger than the previous one!");
+    }
+    L_ = L;
+    x_ = x;
+    m_ = m;
+  }
+
+
+  //**********************************************************************************//
+  // This function calculates D1, D3 and, optionally, the ratios R[n] = Psi[n]/Zeta[n] //
+  // and T[n] = Zeta[n - 1]/Zeta[n] for the complex arguments z[0..kLanes-1], see     //
+  // MultiLayerMie::calcRiccatiBessel. Psi and Zeta themselves under- and overflow    //
+  // for large n (much earlier in single precision), their ratios do not. The        //
+  // starting values and the n = 1 step near the pole of D1[0] are obtained lane by   //
+  // lane, the recurrences for all the lanes at once.                                 //
+  //**********************************************************************************//
+  template <typename FloatType>
+  void BasicMieBatch<FloatType>::calcRiccatiBesselLanes(const int nmax, const std::complex<FloatType>* z,
+                                                        FloatType* D1, FloatType* D3,
+                                                        FloatType* R, FloatType* T) {
+    typedef simd::Pack<FloatType> V;
+    typedef CPack<FloatType> C;
+    const int K = V::kLanes;
+    const std::complex<FloatType> I(0.0, 1.0);
+    FloatType *PsiZeta = PsiZeta_.data();
+
+    FloatType zinv_lanes[2*K];
+    int pole = 0;
+    for (int k = 0; k < K; k++) {
+      SetLane(zinv_lanes, 0, k, std::complex<FloatType>(1.0, 0.0)/z[k]);
+      SetLane(D1, nmax, k, this->calcD1Start(nmax, z[k]));
+    }
+    const C zinv = C::Load(zinv_lanes);
+    const C one = C::Set1(std::complex<FloatType>(1.0, 0.0)), i = C::Set1(I);
+
+    // Downward recurrence for D1 - equations (16a) and (16b)
+    for (int n = nmax; n > 0; n--) {
+      const C nz = V::Set1(n)*zinv;
+      (nz - one/(C::Load(D1 + 2*n*K) + nz)).Store(D1 + 2*(n - 1)*K);
+    }
+
+    for (int k = 0; k < K; k++) {
+      SetLane(PsiZeta, 0, k, FloatType(0.5)*(FloatType(1.0) - std::complex<FloatType>(std::cos(FloatType(2.0)*z[k].real()),
+                                                                                       std::sin(FloatType(2.0)*z[k].real()))
+                                             *std::exp(FloatType(-2.0)*z[k].imag())));
+      SetLane(D3, 0, k, I);
+      if (R != nullptr) SetLane(R, 0, k, std::sin(z[k])/(std::sin(z[k]) - I*std::cos(z[k])));
+      if (std::abs(GetLane(D1, 0, k)) > 1.0e4) pole++;
+    }
+
+    // Upward recurrence for PsiZeta and D3 - equations (18a) - (18d), and for
+    // the ratios of Psi and Zeta - equations (20a) - (21b)
+    for (int n = 1; n <= nmax; n++) {
+      const C nz = V::Set1(n)*zinv;
+      const C D1nM1 = C::Load(D1 + 2*(n - 1)*K), D3nM1 = C::Load(D3 + 2*(n - 1)*K);
+      const C PZ = C::Load(PsiZeta + 2*(n - 1)*K)*(nz - D1nM1)*(nz - D3nM1);
+      PZ.Store(PsiZeta + 2*n*K);
+      if (R != nullptr) {
+        const C Tn = one/(nz - D3nM1);
+        Tn.Store(T + 2*n*K);
+        (C::Load(R + 2*(n - 1)*K)*(nz - D1nM1)*Tn).Store(R + 2*n*K);
+      }
+      (C::Load(D1 + 2*n*K) + i/PZ).Store(D3 + 2*n*K);
+
+      // Lanes close to the pole of D1[0] use the explicit expressions for n = 1
+      if (n == 1 && pole > 0) {
+        for (int k = 0; k < K; k++) {
+          if (std::abs(GetLane(D1, 0, k)) <= 1.0e4) continue;
+          const std::complex<FloatType> zi = GetLane(zinv_lanes, 0, k);
+          const std::complex<FloatType> Psi1 = std::sin(z[k])*zi - std::cos(z[k]);
+          const std::complex<FloatType> Zeta1 = (std::sin(z[k]) - I*std::cos(z[k]))*(zi - I);
+          SetLane(PsiZeta, 1, k, Psi1*Zeta1);
+          SetLane(D3, 1, k, GetLane(D1, 1, k) + I/(Psi1*Zeta1));
+          if (R != nullptr) SetLane(R, 1, k, Psi1/Zeta1);
+        }
+      }
+    }
+  }
+
+
+  //**********************************************************************************//
+  // This function calculates the scattering coefficients of a block of kLanes       //
+  // particles (see MultiLayerMie::calcScattCoeffs) and then their efficiencies.     //
+  // All the lanes use the largest number of terms of the block, each particle only  //
+  // sums its own terms. The first shared_L_ layers are taken from shared_Ha_ and     //
+  // shared_Hb_. If layers < L_, only Ha and Hb of the first 'layers' layers are      //
+  // calculated (for the first lane), and stored in shared_Ha_ and shared_Hb_.        //
+  //**********************************************************************************//
+  template <typename FloatType>
+  void BasicMieBatch<FloatType>::calcBlock(const std::vector<unsigned long>& particles, const int layers) {
+    typedef simd::Pack<FloatType> V;
+    typedef CPack<FloatType> C;
+    const int K = V::kLanes;
+    const int L = layers;
+    const bool shared_pass = layers < static_cast<int>(L_);
+    // Layers below sl are shared by all the particles
+    const int sl = shared_pass ? 0 : shared_L_;
+    const int pl = this->GetPECLayer();
+    const int fl = (pl > 0) ? pl : 0;
+
+    int nmax = 0;
+    for (auto p : particles) nmax = std::max(nmax, nmax_[p]);
+    const int stride = 2*K*(nmax + 1);
+
+    // Get memory for the arrays (allocated only for a new maximum of nmax and L)
+    if (D1XL_.size() < static_cast<unsigned long>(stride)) {
+      for (auto v : {&D1XL_, &D3XL_, &RXL_, &TXL_, &PsiZeta_, &an_, &bn_})
+        v->resize(stride);
+    }
+    if (D1_mlxl_.size() < static_cast<unsigned long>(L*stride)) {
+      for (auto v : {&D1_mlxl_, &D1_mlxlM1_, &D3_mlxl_, &D3_mlxlM1_})
+        v->resize(L*stride);
+    }
+    FloatType *D1_mlxl = D1_mlxl_.data(), *D1_mlxlM1 = D1_mlxlM1_.data();
+    FloatType *D3_mlxl = D3_mlxl_.data(), *D3_mlxlM1 = D3_mlxlM1_.data();
+
+    // Lane values of the size parameters and indexes of the block. Lanes
+    // without a particle repeat the last one.
+    std::vector<FloatType> xl(L*K);
+    std::vector<std::complex<FloatType> > ml(L*K);
+    for (int k = 0; k < K; k++) {
+      const unsigned long p = particles[std::min<int>(k, particles.size() - 1)];
+      for (int l = 0; l < L; l++) {
+        xl[l*K + k] = x_[p*L_ + l];
+        ml[l*K + k] = m_[p*L_ + l];
+      }
+    }
+
+    //*************************************************//
+    // Calculate D1 and D3 for z1 in the first layer   //
+    //*************************************************//
+    std::vector<std::complex<FloatType> > z1(K), z2(K);
+    if (sl > 0) {
+      // Already calculated
+    } else if (fl == pl) {  // PEC layer
+      const C D1pec = C::Set1(std::complex<FloatType>(0.0, -1.0)), D3pec = C::Set1(std::complex<FloatType>(0.0, 1.0));
+      for (int n = 0; n <= nmax; n++) {
+        D1pec.Store(D1_mlxl + fl*stride + 2*n*K);
+        D3pec.Store(D3_mlxl + fl*stride + 2*n*K);
+      }
+    } else {  // Regular layer
+      for (int k = 0; k < K; k++) z1[k] = xl[fl*K + k]*ml[fl*K + k];
+      calcRiccatiBesselLanes(nmax, z1.data(), D1_mlxl + fl*stride, D3_mlxl + fl*stride, nullptr, nullptr);
+    }
+
+    //************************************************************//
+    //Calculate D1 and D3 for z1 and z2 in the layers fl + 1..L   //
+    //************************************************************//
+    // Lane values of z1, z2, (x[l - 1]/x[l])^2, Q, Ha and Hb for each layer
+    std::vector<FloatType> z1_lanes(2*L*K), z2_lanes(2*L*K), ratio(L*K), m_lanes(2*L*K);
+    std::vector<FloatType> Q(2*L*K), Ha(2*L*K), Hb(2*L*K);
+    for (int l = 0; l < L; l++)
+      for (int k = 0; k < K; k++) SetLane(m_lanes.data(), l, k, ml[l*K + k]);
+    for (int l = std::max(sl, fl + 1); l < L; l++) {
+      for (int k = 0; k < K; k++) {
+        z1[k] = xl[l*K + k]*ml[l*K + k];
+        z2[k] = xl[(l - 1)*K + k]*ml[l*K + k];
+        SetLane(z1_lanes.data(), l, k, z1[k]);
+        SetLane(z2_lanes.data(), l, k, z2[k]);
+        ratio[l*K + k] = (xl[(l - 1)*K + k]/xl[l*K + k])*(xl[(l - 1)*K + k]/xl[l*K + k]);
+
+        // Initial value for the upward recurrence for Q - equations (19a) and (19b)
+        const std::complex<FloatType> Num = std::exp(FloatType(-2.0)*(z1[k].imag() - z2[k].imag()))
+          *std::complex<FloatType>(std::cos(-2.0*z2[k].real()) - std::exp(-2.0*z2[k].imag()), std::sin(-2.0*z2[k].real()));
+        const std::complex<FloatType> Denom = std::complex<FloatType>(std::cos(-2.0*z1[k].real()) - std::exp(-2.0*z1[k].imag()),
+                                                                      std::sin(-2.0*z1[k].real()));
+        SetLane(Q.data(), l, k, Num/Denom);
+      }
+      calcRiccatiBesselLanes(nmax, z1.data(), D1_mlxl + l*stride, D3_mlxl + l*stride, nullptr, nullptr);
+      calcRiccatiBesselLanes(nmax, z2.data(), D1_mlxlM1 + l*stride, D3_mlxlM1 + l*stride, nullptr, nullptr);
+    }
+
+    //**************************************//
+    //Calculate Psi/Zeta ratios for XL      //
+    //**************************************//
+    FloatType xinv_lanes[K];
+    for (int k = 0; k < K; k++) {
+      z1[k] = xl[(L - 1)*K + k];
+      xinv_lanes[k] = FloatType(1.0)/xl[(L - 1)*K + k];
+    }
+    if (!shared_pass && !shared_XL_)
+      calcRiccatiBesselLanes(nmax, z1.data(), D1XL_.data(), D3XL_.data(), RXL_.data(), TXL_.data());
+    const typename V::type xinv = V::Load(xinv_lanes);
+    const FloatType *RXL = RXL_.data(), *TXL = TXL_.data();
+
+    //*********************************************************************//
+    // For each order n calculate Q, Ha and Hb in all the layers and then  //
+    // the scattering coefficients (an and bn)                             //
+    //*********************************************************************//
+    for (int n = 1; n <= nmax; n++) {
+      const typename V::type vn = V::Set1(n);
+      //******************************************************************//
+      // Calculate Ha and Hb in the first layer - equations (7a) and (8a) //
+      //******************************************************************//
+      if (sl > 0) {
+        C::Set1(shared_Ha_[n - 1]).Store(Ha.data() + 2*(sl - 1)*K);
+        C::Set1(shared_Hb_[n - 1]).Store(Hb.data() + 2*(sl - 1)*K);
+      } else {
+        C::Load(D1_mlxl + fl*stride + 2*n*K).Store(Ha.data() + 2*fl*K);
+        C::Load(D1_mlxl + fl*stride + 2*n*K).Store(Hb.data() + 2*fl*K);
+      }
+
+      //*****************************************************//
+      // Iteration from the second layer to the last one (L) //
+      //*****************************************************//
+      for (int l = std::max(sl, fl + 1); l < L; l++) {
+        const FloatType *D1l = D1_mlxl + l*stride, *D1lM1 = D1_mlxlM1 + l*stride;
+        const FloatType *D3l = D3_mlxl + l*stride, *D3lM1 = D3_mlxlM1 + l*stride;
+        const C cz1 = C::Load(z1_lanes.data() + 2*l*K), cz2 = C::Load(z2_lanes.data() + 2*l*K);
+        const C cn = {vn, V::Set1(0.0)};
+        const C D1ln = C::Load(D1l + 2*n*K), D3ln = C::Load(D3l + 2*n*K);
+        const C D1lM1n = C::Load(D1lM1 + 2*n*K), D3lM1n = C::Load(D3lM1 + 2*n*K);
+
+        // Upward recurrence for Q - equations (19a) and (19b)
+        C Num = (cz1*D1ln + cn)*(cn - cz1*C::Load(D3l + 2*(n - 1)*K));
+        C Denom = (cz2*D1lM1n + cn)*(cn - cz2*C::Load(D3lM1 + 2*(n - 1)*K));
+        const C Ql = ((V::Load(ratio.data() + l*K)*C::Load(Q.data() + 2*l*K))*Num)/Denom;
+        Ql.Store(Q.data() + 2*l*K);
+
+        // Upward recurrence for Ha and Hb - equations (7b), (8b) and (12) - (15)
+        const C mlc = C::Load(m_lanes.data() + 2*l*K), mlM1 = C::Load(m_lanes.data() + 2*(l - 1)*K);
+        const C HalM1 = C::Load(Ha.data() + 2*(l - 1)*K), HblM1 = C::Load(Hb.data() + 2*(l - 1)*K);
+        C G1, G2;
+        //Ha
+        if ((l - 1) == pl) { // The layer below the current one is a PEC layer
+          G1 = C::Set1(std::complex<FloatType>(0.0, 0.0)) - D1lM1n;
+          G2 = C::Set1(std::complex<FloatType>(0.0, 0.0)) - D3lM1n;
+        } else {
+          G1 = (mlc*HalM1) - (mlM1*D1lM1n);
+          G2 = (mlc*HalM1) - (mlM1*D3lM1n);
+        }  // end of if PEC
+        C Temp = Ql*G1;
+        ((G2*D1ln - Temp*D3ln)/(G2 - Temp)).Store(Ha.data() + 2*l*K);
+        //Hb
+        if ((l - 1) == pl) { // The layer below the current one is a PEC layer
+          G1 = HblM1;
+          G2 = HblM1;
+        } else {
+          G1 = (mlM1*HblM1) - (mlc*D1lM1n);
+          G2 = (mlM1*HblM1) - (mlc*D3lM1n);
+        }  // end of if PEC
+        Temp = Ql*G1;
+        ((G2*D1ln - Temp*D3ln)/(G2 - Temp)).Store(Hb.data() + 2*l*K);
+      }  // end of for layers iteration
+      if (shared_pass) {
+        shared_Ha_[n - 1] = GetLane(Ha.data(), L - 1, 0);
+        shared_Hb_[n - 1] = GetLane(Hb.data(), L - 1, 0);
+        continue;
+      }
+
+      //******************************************************************//
+      // Calculate an and bn - equations (5) and (6), with numerator and  //
+      // denominator divided by Zeta[n]. Expressions are not valid for a  //
+      // simple PEC sphere, then bn = Psi/Zeta.                           //
+      //******************************************************************//
+      const C nx = {V::Mul(vn, xinv), V::Set1(0.0)};
+      const C Rn = C::Load(RXL + 2*n*K), Tn = C::Load(TXL + 2*n*K);
+      const C RTn = C::Load(RXL + 2*(n - 1)*K)*Tn;
+      if (pl < (L - 1)) {
+        const C mL = C::Load(m_lanes.data() + 2*(L - 1)*K);
+        const C A = C::Load(Ha.data() + 2*(L - 1)*K)/mL + nx;
+        const C B = mL*C::Load(Hb.data() + 2*(L - 1)*K) + nx;
+        ((A*Rn - RTn)/(A - Tn)).Store(an_.data() + 2*(n - 1)*K);
+        ((B*Rn - RTn)/(B - Tn)).Store(bn_.data() + 2*(n - 1)*K);
+      } else {
+        ((nx*Rn - RTn)/(nx - Tn)).Store(an_.data() + 2*(n - 1)*K);
+        Rn.Store(bn_.data() + 2*(n - 1)*K);
+      }
+    }  // end of for an and bn terms
+
+    if (shared_pass) return;
+    for (unsigned int k = 0; k < particles.size(); k++)
+      sumLane(particles[k], k, nmax_[particles[k]]);
+  }
+
+
+  // ********************************************************************** //
+  // Efficiencies of particle p from the coefficients in lane k, see        //
+  // MultiLayerMie::RunMieCalculation - equations (27) - (33)               //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMieBatch<FloatType>::sumLane(const unsigned long p, const int k, const int nmax) {
+    const FloatType *an = an_.data(), *bn = bn_.data();
+    FloatType Qext = 0.0, Qsca = 0.0, Qpr = 0.0;
+    std::complex<FloatType> Qbktmp(0.0, 0.0);
+    for (int i = nmax - 2; i >= 0; i--) {
+      const int n = i + 1;
+      const std::complex<FloatType> ai = GetLane(an, i, k), bi = GetLane(bn, i, k);
+      const std::complex<FloatType> an1 = GetLane(an, n, k), bn1 = GetLane(bn, n, k);
+      Qext += (n + n + 1.0)*(ai.real() + bi.real());
+      Qsca += (n + n + 1.0)*(ai.real()*ai.real() + ai.imag()*ai.imag()
+                             + bi.real()*bi.real() + bi.imag()*bi.imag());
+      Qpr += ((n*(n + 2.0)/(n + 1.0))*((ai*std::conj(an1) + bi*std::conj(bn1)).real())
+              + ((n + n + 1.0)/(n*(n + 1.0)))*(ai*std::conj(bi)).real());
+      Qbktmp += FloatType((n + n + 1.0)*(1.0 - 2.0*(n % 2)))*(ai - bi);
+    }
+    const FloatType x2 = x_[p*L_ + L_ - 1]*x_[p*L_ + L_ - 1];
+    Qext_[p] = 2.0*Qext/x2;
+    Qsca_[p] = 2.0*Qsca/x2;
+    Qabs_[p] = Qext_[p] - Qsca_[p];
+    albedo_[p] = Qsca_[p]/Qext_[p];
+    Qpr_[p] = Qext_[p] - 4.0*Qpr/x2;
+    asymmetry_factor_[p] = (Qext_[p] - Qpr_[p])/Qsca_[p];
+    Qbk_[p] = (Qbktmp.real()*Qbktmp.real() + Qbktmp.imag()*Qbktmp.imag())/x2;
+  }
+
+
+  //**********************************************************************************//
+  // This function calculates the efficiencies (Qext, Qsca, Qabs, Qbk, Qpr, g and     //
+  // Albedo) of all the particles. Particles are sorted by their number of terms     //
+  // and calculated kLanes at a time. Inner layers that are the same for all the      //
+  // particles (e.g. the core in a sweep of the coating) are calculated only once,    //
+  // and so are the Riccati-Bessel functions of a shared outer size parameter.        //
+  //**********************************************************************************//
+  template <typename FloatType>
+  void BasicMieBatch<FloatType>::RunMieCalculation() {
+    if (L_ == 0)
+      throw std::invalid_argument("Initialize model first!");
+    const unsigned long count = x_.size()/L_;
+    const int pl = this->GetPECLayer();
+    if (pl >= static_cast<int>(L_))
+      throw std::invalid_argument("Error! PEC layer is out of range!");
+    const int fl = (pl > 0) ? pl : 0;
+    const unsigned int K = simd::Pack<FloatType>::kLanes;
+
+    for (auto v : {&Qext_, &Qsca_, &Qabs_, &Qbk_, &Qpr_, &asymmetry_factor_, &albedo_})
+      v->assign(count, 0.0);
+    nmax_.resize(count);
+
+    // Number of terms of each particle
+    for (unsigned long p = 0; p < count; p++) {
+      this->size_param_.assign(x_.begin() + p*L_, x_.begin() + (p + 1)*L_);
+      this->refractive_index_.assign(m_.begin() + p*L_, m_.begin() + (p + 1)*L_);
+      nmax_[p] = this->calcNmax(fl);
+    }
+
+    std::vector<unsigned long> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [this](unsigned long a, unsigned long b) {return nmax_[a] < nmax_[b];});
+
+    // Layers shared by all the particles, the outer one is never shared. With
+    // a single block there is nothing to gain.
+    unsigned int shared = L_ - 1;
+    for (unsigned long p = 1; p < count && shared > 0; p++) {
+      unsigned int l = 0;
+      while (l < shared && x_[p*L_ + l] == x_[l] && m_[p*L_ + l] == m_[l]) l++;
+      shared = l;
+    }
+    shared_L_ = 0;
+    if (count > K && static_cast<int>(shared) > fl) {
+      // Calculated with the largest number of terms of all the particles
+      shared_Ha_.resize(nmax_[order.back()]);
+      shared_Hb_.resize(nmax_[order.back()]);
+      calcBlock(std::vector<unsigned long>(1, order.back()), shared);
+      shared_L_ = shared;
+    }
+
+    // The Riccati-Bessel functions of the outer size parameter (the ratios
+    // of Psi and Zeta) are calculated once if all the particles have the
+    // same one, e.g. in a map of the refractive index at a fixed wavelength
+    shared_XL_ = false;
+    bool same_XL = count > K;
+    for (unsigned long p = 1; p < count && same_XL; p++)
+      same_XL = x_[p*L_ + L_ - 1] == x_[L_ - 1];
+    if (same_XL) {
+      const int nmax = nmax_[order.back()];
+      const unsigned long stride = 2*K*(nmax + 1);
+      if (D1XL_.size() < stride) {
+        for (auto v : {&D1XL_, &D3XL_, &RXL_, &TXL_, &PsiZeta_, &an_, &bn_})
+          v->resize(stride);
+      }
+      const std::vector<std::complex<FloatType> > z(K, x_[L_ - 1]);
+      calcRiccatiBesselLanes(nmax, z.data(), D1XL_.data(), D3XL_.data(), RXL_.data(), TXL_.data());
+      shared_XL_ = true;
+    }
+
+    std::vector<unsigned long> block;
+    for (unsigned long first = 0; first < count; first += K) {
+      block.assign(order.begin() + first, order.begin() + std::min<unsigned long>(first + K, count));
+      calcBlock(block, L_);
+    }
+  }
+
+  template class BasicMieBatch<float>;
+  template class BasicMieBatch<double>;
+  template class BasicMieBatch<long double>;
+}  // end of namespace nmie
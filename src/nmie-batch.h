@@ -0,0 +1,103 @@
+#ifndef SRC_NMIE_BATCH_H_
+#define SRC_NMIE_BATCH_H_
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+
+#include <complex>
+#include <vector>
+#include "nmie.h"
+
+namespace nmie {
+  //**********************************************************************************//
+  // Batched evaluation of the far-field efficiencies of many particles with the      //
+  // same number of layers, e.g. the points of a spectrum. The particles are          //
+  // processed in blocks of simd::Pack<FloatType>::kLanes, one particle per lane:     //
+  // D1, D3, Psi/Zeta, Q, Ha, Hb, an and bn are calculated for the whole block with   //
+  // the same instructions. Particles are sorted by their number of terms, so that    //
+  // the lanes of a block do similar work and the sums of each particle only use its  //
+  // own terms. Inner layers and outer size parameters shared by all the particles    //
+  // are calculated only once.                                                        //
+  //**********************************************************************************//
+  template <typename FloatType>
+  class BasicMieBatch : protected BasicMultiLayerMie<FloatType> {
+   public:
+    // Define the particles. x and m contain the size parameters and relative
+    // refractive indexes of the L layers of each particle, stored as [p*L + l].
+    void SetParticles(unsigned int L, const std::vector<FloatType>& x,
+                      const std::vector<std::complex<FloatType> >& m);
+    // Index of the PEC layer, the same for all particles (-1 if there is none)
+    using BasicMultiLayerMie<FloatType>::SetPECLayer;
+    using BasicMultiLayerMie<FloatType>::GetPECLayer;
+
+    // Calculate the efficiencies of all the particles
+    void RunMieCalculation();
+
+    // Return calculation results, one value per particle
+    const std::vector<FloatType>& GetQext() const {return Qext_;};
+    const std::vector<FloatType>& GetQsca() const {return Qsca_;};
+    const std::vector<FloatType>& GetQabs() const {return Qabs_;};
+    const std::vector<FloatType>& GetQbk() const {return Qbk_;};
+    const std::vector<FloatType>& GetQpr() const {return Qpr_;};
+    const std::vector<FloatType>& GetAsymmetryFactor() const {return asymmetry_factor_;};
+    const std::vector<FloatType>& GetAlbedo() const {return albedo_;};
+    const std::vector<int>& GetMaxTerms() const {return nmax_;};
+
+   private:
+    void calcBlock(const std::vector<unsigned long>& particles, int layers);
+    void calcRiccatiBesselLanes(int nmax, const std::complex<FloatType>* z,
+                                FloatType* D1, FloatType* D3, FloatType* R, FloatType* T);
+    void sumLane(unsigned long p, int k, int nmax);
+
+    unsigned int L_ = 0;
+    std::vector<FloatType> x_;
+    std::vector<std::complex<FloatType> > m_;
+
+    std::vector<FloatType> Qext_, Qsca_, Qabs_, Qbk_, Qpr_, asymmetry_factor_, albedo_;
+    std::vector<int> nmax_;
+
+    // Arrays of order n of a block, complex values are stored as [(2*n + c)*kLanes + k],
+    // where c = 0, 1 selects the real or imaginary part of lane k. They only grow.
+    std::vector<FloatType> D1_mlxl_, D1_mlxlM1_, D3_mlxl_, D3_mlxlM1_;
+    std::vector<FloatType> D1XL_, D3XL_, RXL_, TXL_, PsiZeta_;
+    std::vector<FloatType> an_, bn_;
+    // Number of inner layers shared by all the particles, and Ha and Hb of
+    // the outer one of them for each order
+    int shared_L_ = 0;
+    std::vector<std::complex<FloatType> > shared_Ha_, shared_Hb_;
+    // D1XL_, D3XL_, RXL_ and TXL_ hold the values of the outer size parameter
+    // shared by all the particles
+    bool shared_XL_ = false;
+  };  // end of class BasicMieBatch
+
+
+  extern template class BasicMieBatch<float>;
+  extern template class BasicMieBatch<double>;
+  extern template class BasicMieBatch<long double>;
+
+  typedef BasicMieBatch<double> MieBatch;
+}  // end of namespace nmie
+#endif  // SRC_NMIE_BATCH_H_
@@ -0,0 +1,319 @@
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+#include "nmie-ensemble.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace nmie {
+  namespace {
+    // Gauss-Kronrod 7-15 rule on [-1, 1]: positive abscissae (the last one is
+    // the center) and their Kronrod weights. The odd ones are the Gauss nodes.
+    const double kXgk[8] = {0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+                            0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+                            0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+                            0.207784955007898467600689403773245, 0.000000000000000000000000000000000};
+    const double kWgk[8] = {0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+                            0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+                            0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+                            0.204432940075298892414161999234649, 0.209482141084727828012999174891714};
+    const double kWg[4] = {0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+                           0.381830050505118944950369775488975, 0.417959183673469387755102040816327};
+    const int kNodes = 15;
+    // Integrated values of each node: number, geometric cross section, Cext,
+    // Csca, Cbk, g*Csca, Cpr and then |S1|^2 and |S2|^2 for each angle
+    enum {kN, kG, kCext, kCsca, kCbk, kGCsca, kCpr, kIntensities};
+
+    // Interval of ln(s) with the Kronrod integrals, their error estimates and
+    // the largest relative error of all of them
+    struct Interval {
+      double from, to;
+      std::vector<double> K, E;
+      double error;
+    };
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  SizeDistribution SizeDistribution::Lognormal(double median, double sigma) {
+    if (!(median > 0.0) || !(sigma > 0.0))
+      throw std::invalid_argument("Lognormal distribution needs a positive median and width!");
+    SizeDistribution distribution;
+    distribution.model_ = kLognormal;
+    distribution.a_ = median;
+    distribution.b_ = sigma;
+    // The cross sections (weighted by s^2) peak at larger sizes than n(s)
+    distribution.min_ = median*std::exp(-8.0*sigma);
+    distribution.max_ = median*std::exp(8.0*sigma + 3.0*sigma*sigma);
+    return distribution;
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  SizeDistribution SizeDistribution::Gamma(double shape, double scale) {
+    if (!(shape > 0.0) || !(scale > 0.0))
+      throw std::invalid_argument("Gamma distribution needs a positive shape and scale!");
+    SizeDistribution distribution;
+    distribution.model_ = kGamma;
+    distribution.a_ = shape;
+    distribution.b_ = scale;
+    distribution.min_ = scale*std::max(shape - 8.0*std::sqrt(shape), 1e-6*shape);
+    distribution.max_ = scale*(shape + 3.0 + 10.0*std::sqrt(shape + 3.0));
+    return distribution;
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  SizeDistribution SizeDistribution::Tabulated(const std::vector<double>& s, const std::vector<double>& n) {
+    if (s.size() != n.size() || s.size() < 2)
+      throw std::invalid_argument("Size distribution table should have at least two (s, n) rows!");
+    for (unsigned long i = 0; i < s.size(); i++) {
+      if (!(s[i] > (i > 0 ? s[i - 1] : 0.0)))
+        throw std::invalid_argument("Size distribution sizes should be positive and increasing!");
+      if (!(n[i] >= 0.0))
+        throw std::invalid_argument("Size distribution densities should not be negative!");
+    }
+    SizeDistribution distribution;
+    distribution.model_ = kTabulated;
+    distribution.table_s_ = s;
+    distribution.table_n_ = n;
+    distribution.min_ = s.front();
+    distribution.max_ = s.back();
+    return distribution;
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  double SizeDistribution::GetDensity(double s) const {
+    if (model_ == kLognormal) {
+      const double u = std::log(s/a_)/b_;
+      return std::exp(-0.5*u*u)/s;
+    }
+    if (model_ == kGamma) {  // Scaled by its value at the mean to avoid overflows
+      const double mean = a_*b_;
+      return std::exp((a_ - 1.0)*std::log(s/mean) - (s - mean)/b_);
+    }
+    if (s < table_s_.front() || s > table_s_.back()) return 0.0;
+    const unsigned long i = std::min<unsigned long>(
+        std::upper_bound(table_s_.begin(), table_s_.end(), s) - table_s_.begin(), table_s_.size() - 1);
+    const double t = (s - table_s_[i - 1])/(table_s_[i] - table_s_[i - 1]);
+    return (1.0 - t)*table_n_[i - 1] + t*table_n_[i];
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  void MieEnsemble::SetParticle(const std::vector<double>& x, const std::vector<std::complex<double> >& m,
+                                int pl) {
+    if (x.size() != m.size() || x.empty())
+      throw std::invalid_argument("Each layer should have only one index!");
+    x_ = x;
+    m_ = m;
+    pl_ = pl;
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  void MieEnsemble::SetTolerance(double tolerance, unsigned long max_nodes) {
+    if (!(tolerance > 0.0))
+      throw std::invalid_argument("Ensemble tolerance should be positive!");
+    tolerance_ = tolerance;
+    max_nodes_ = max_nodes;
+  }
+
+
+  // ********************************************************************** //
+  // Values to integrate (see kN...) at each scale factor of s, as          //
+  // functions of ln(s). Larger particles go first, so that each thread     //
+  // builds its angle tables for the largest number of terms only once.     //
+  // ********************************************************************** //
+  void MieEnsemble::calcNodes(const std::vector<double>& s, std::vector<double>& values, ThreadPool& pool) {
+    const unsigned long V = kIntensities + 2*theta_.size();
+    values.assign(V*s.size(), 0.0);
+    std::vector<unsigned long> order(s.size());
+    for (unsigned long i = 0; i < order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](unsigned long a, unsigned long b) {return s[a] > s[b];});
+
+    if (models_.size() < pool.GetThreadCount()) models_.resize(pool.GetThreadCount());
+    for (auto& model : models_) {
+      model.SetLayersIndex(m_);
+      model.SetAngles(theta_);
+      model.SetPECLayer(pl_);
+    }
+    pool.ParallelFor(s.size(), 0, [&](unsigned long first, unsigned long count, unsigned int thread) {
+        MultiLayerMie& model = models_[thread];
+        std::vector<double> x(x_.size());
+        for (unsigned long i = first; i < first + count; i++) {
+          const unsigned long p = order[i];
+          for (unsigned long l = 0; l < x.size(); l++) x[l] = s[p]*x_[l];
+          model.SetLayersSize(x);
+          model.RunMieCalculation();
+          double* v = &values[V*p];
+          const double weight = distribution_.GetDensity(s[p])*s[p];
+          const double area = PI_*x.back()*x.back();
+          v[kN] = weight;
+          v[kG] = weight*area;
+          v[kCext] = weight*area*model.GetQext();
+          v[kCsca] = weight*area*model.GetQsca();
+          v[kCbk] = weight*area*model.GetQbk();
+          v[kGCsca] = weight*area*model.GetQsca()*model.GetAsymmetryFactor();
+          v[kCpr] = weight*area*model.GetQpr();
+          for (unsigned long t = 0; t < theta_.size(); t++) {
+            v[kIntensities + t] = weight*std::norm(model.GetS1()[t]);
+            v[kIntensities + theta_.size() + t] = weight*std::norm(model.GetS2()[t]);
+          }
+        }
+      });
+  }
+
+
+  // ********************************************************************** //
+  // Adaptive quadrature over ln(s). Each round evaluates the 15 nodes of   //
+  // all the new intervals together. The error of an interval is the        //
+  // largest error estimate of its Kronrod integrals, relative              //
+  // to the total of the same quantity (g*Csca relative to Csca, and the    //
+  // intensities relative to the largest of them). The intervals with the   //
+  // largest errors are bisected until the remaining ones add up to half    //
+  // the tolerance.                                                         //
+  // ********************************************************************** //
+  void MieEnsemble::RunMieCalculation(ThreadPool& pool) {
+    if (x_.empty())
+      throw std::invalid_argument("Ensemble particle is not defined!");
+    const unsigned long V = kIntensities + 2*theta_.size();
+    const double u_min = std::log(distribution_.GetMinSize()), u_max = std::log(distribution_.GetMaxSize());
+    const double min_width = 1e-12*std::max(1.0, u_max - u_min);
+
+    std::vector<Interval> intervals, pending;
+    const int kInitial = 8;
+    for (int i = 0; i < kInitial; i++)
+      pending.push_back({u_min + i*(u_max - u_min)/kInitial, u_min + (i + 1)*(u_max - u_min)/kInitial,
+                         std::vector<double>(), std::vector<double>(), 0.0});
+    nodes_ = 0;
+    std::vector<double> s, values, total(V), scale(V);
+    while (!pending.empty()) {
+      s.clear();
+      for (const auto& interval : pending) {
+        const double center = 0.5*(interval.from + interval.to), half = 0.5*(interval.to - interval.from);
+        s.push_back(std::exp(center));
+        for (int j = 0; j < 7; j++) {
+          s.push_back(std::exp(center - half*kXgk[j]));
+          s.push_back(std::exp(center + half*kXgk[j]));
+        }
+      }
+      calcNodes(s, values, pool);
+      nodes_ += s.size();
+      for (unsigned long i = 0; i < pending.size(); i++) {
+        Interval& interval = pending[i];
+        const double half = 0.5*(interval.to - interval.from);
+        interval.K.assign(V, 0.0);
+        interval.E.assign(V, 0.0);
+        const double* node = &values[V*kNodes*i];
+        for (unsigned long q = 0; q < V; q++) {
+          double K = kWgk[7]*node[q], G = kWg[3]*node[q];
+          for (int j = 0; j < 7; j++) {
+            const double sum = node[V*(2*j + 1) + q] + node[V*(2*j + 2) + q];
+            K += kWgk[j]*sum;
+            if (j%2 == 1) G += kWg[j/2]*sum;
+          }
+          interval.K[q] = K*half;
+          interval.E[q] = std::abs(K - G)*half;
+        }
+      }
+      intervals.insert(intervals.end(), pending.begin(), pending.end());
+      pending.clear();
+
+      // Scales of the errors and error of each interval
+      std::fill(total.begin(), total.end(), 0.0);
+      for (const auto& interval : intervals)
+        for (unsigned long q = 0; q < V; q++) total[q] += interval.K[q];
+      for (unsigned long q = 0; q < kIntensities; q++) scale[q] = std::abs(total[q]);
+      scale[kGCsca] = std::abs(total[kCsca]);
+      scale[kCpr] = std::abs(total[kCext]);
+      double max_intensity = 0.0;
+      for (unsigned long q = kIntensities; q < V; q++) max_intensity = std::max(max_intensity, std::abs(total[q]));
+      for (unsigned long q = kIntensities; q < V; q++) scale[q] = max_intensity;
+      // Relative error of each quantity, and the largest contribution of
+      // each interval
+      std::vector<double> remaining(V, 0.0);
+      for (auto& interval : intervals) {
+        interval.error = 0.0;
+        for (unsigned long q = 0; q < V; q++) {
+          if (!(scale[q] > 0.0)) continue;
+          remaining[q] += interval.E[q]/scale[q];
+          interval.error = std::max(interval.error, interval.E[q]/scale[q]);
+        }
+      }
+      error_ = *std::max_element(remaining.begin(), remaining.end());
+      if (error_ <= tolerance_) break;
+
+      // Bisect the worst intervals
+      std::sort(intervals.begin(), intervals.end(),
+                [](const Interval& a, const Interval& b) {return a.error > b.error;});
+      unsigned long kept = 0, budget = nodes_;
+      for (unsigned long i = 0; i < intervals.size(); i++) {
+        Interval& interval = intervals[i];
+        if (*std::max_element(remaining.begin(), remaining.end()) > 0.5*tolerance_
+            && budget + 2*kNodes <= max_nodes_ && interval.to - interval.from > min_width) {
+          for (unsigned long q = 0; q < V; q++)
+            if (scale[q] > 0.0) remaining[q] -= interval.E[q]/scale[q];
+          budget += 2*kNodes;
+          const double middle = 0.5*(interval.from + interval.to);
+          pending.push_back({interval.from, middle, std::vector<double>(), std::vector<double>(), 0.0});
+          pending.push_back({middle, interval.to, std::vector<double>(), std::vector<double>(), 0.0});
+        } else {
+          intervals[kept++] = interval;
+        }
+      }
+      intervals.resize(kept);
+    }
+
+    if (!(total[kN] > 0.0) || !(total[kG] > 0.0))
+      throw std::invalid_argument("Size distribution has no particles in its range!");
+    Qext_ = total[kCext]/total[kG];
+    Qsca_ = total[kCsca]/total[kG];
+    Qabs_ = (total[kCext] - total[kCsca])/total[kG];
+    Qbk_ = total[kCbk]/total[kG];
+    Qpr_ = total[kCpr]/total[kG];
+    asymmetry_factor_ = total[kGCsca]/total[kCsca];
+    albedo_ = total[kCsca]/total[kCext];
+    I1_.assign(total.begin() + kIntensities, total.begin() + kIntensities + theta_.size());
+    I2_.assign(total.begin() + kIntensities + theta_.size(), total.end());
+    for (auto& value : I1_) value /= total[kN];
+    for (auto& value : I2_) value /= total[kN];
+  }
+}  // end of namespace nmie
@@ -0,0 +1,116 @@
+#ifndef SRC_NMIE_ENSEMBLE_H_
+#define SRC_NMIE_ENSEMBLE_H_
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+
+#include <complex>
+#include <vector>
+#include "nmie.h"
+#include "nmie-threads.h"
+
+namespace nmie {
+  // Number density n(s) of the scale factor s of the particles (not normalized).
+  // Its range holds all but a negligible fraction of the particles.
+  class SizeDistribution {
+   public:
+    // n(s) = exp(-(ln(s/median))^2/(2*sigma^2))/s
+    static SizeDistribution Lognormal(double median, double sigma);
+    // n(s) = s^(shape - 1)*exp(-s/scale)
+    static SizeDistribution Gamma(double shape, double scale);
+    // Linear interpolation of a table, the sizes should be increasing and positive
+    static SizeDistribution Tabulated(const std::vector<double>& s, const std::vector<double>& n);
+
+    double GetDensity(double s) const;
+    double GetMinSize() const {return min_;};
+    double GetMaxSize() const {return max_;};
+
+   private:
+    enum Model {kLognormal, kGamma, kTabulated};
+    Model model_ = kLognormal;
+    double a_ = 1.0, b_ = 1.0, min_ = 1.0, max_ = 1.0;
+    std::vector<double> table_s_, table_n_;
+  };  // end of class SizeDistribution
+
+
+  //**********************************************************************************//
+  // Far-field results averaged over an ensemble of particles with the same shape and //
+  // materials: the size parameters of the layers are s*x, with s distributed as a    //
+  // SizeDistribution. The integrals over s are calculated by adaptive Gauss-Kronrod  //
+  // (7-15) quadrature on ln(s): the intervals with the largest errors are bisected   //
+  // until the sum of the estimated errors of the cross sections and intensities is   //
+  // below the tolerance. All the nodes of a round are evaluated in parallel, each    //
+  // thread with its own model, so workspaces and angle tables are reused.            //
+  //                                                                                  //
+  // Efficiencies are cross-section weighted, e.g. Qext = <Cext>/<pi*(s*xL)^2>, the   //
+  // asymmetry factor is weighted by Csca, and I1, I2 are the averages of |S1|^2 and  //
+  // |S2|^2 per particle (incoherent sum).                                            //
+  //**********************************************************************************//
+  class MieEnsemble {
+   public:
+    // Particle for s = 1 and its PEC layer (-1 if there is none)
+    void SetParticle(const std::vector<double>& x, const std::vector<std::complex<double> >& m,
+                     int pl = -1);
+    void SetDistribution(const SizeDistribution& distribution) {distribution_ = distribution;};
+    void SetAngles(const std::vector<double>& angles) {theta_ = angles;};
+    // Relative error goal and largest number of evaluated particles
+    void SetTolerance(double tolerance, unsigned long max_nodes = 20000);
+
+    void RunMieCalculation(ThreadPool& pool = ThreadPool::Shared());
+
+    double GetQext() const {return Qext_;};
+    double GetQsca() const {return Qsca_;};
+    double GetQabs() const {return Qabs_;};
+    double GetQbk() const {return Qbk_;};
+    double GetQpr() const {return Qpr_;};
+    double GetAsymmetryFactor() const {return asymmetry_factor_;};
+    double GetAlbedo() const {return albedo_;};
+    const std::vector<double>& GetI1() const {return I1_;};
+    const std::vector<double>& GetI2() const {return I2_;};
+    // Number of evaluated particles and estimated relative error
+    unsigned long GetNodes() const {return nodes_;};
+    double GetErrorEstimate() const {return error_;};
+
+   private:
+    void calcNodes(const std::vector<double>& s, std::vector<double>& values, ThreadPool& pool);
+
+    std::vector<double> x_, theta_;
+    std::vector<std::complex<double> > m_;
+    int pl_ = -1;
+    SizeDistribution distribution_;
+    double tolerance_ = 1e-4;
+    unsigned long max_nodes_ = 20000;
+    // One model (and context) per thread of the pool
+    std::vector<MultiLayerMie> models_;
+
+    double Qext_ = 0.0, Qsca_ = 0.0, Qabs_ = 0.0, Qbk_ = 0.0, Qpr_ = 0.0;
+    double asymmetry_factor_ = 0.0, albedo_ = 0.0;
+    std::vector<double> I1_, I2_;
+    unsigned long nodes_ = 0;
+    double error_ = 0.0;
+  };  // end of class MieEnsemble
+}  // end of namespace nmie
+#endif  // SRC_NMIE_ENSEMBLE_H_
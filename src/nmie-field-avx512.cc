@@ -0,0 +1,69 @@
+//**********************************************************************************//
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+// Field kernels (see nmie-field-lanes.h) for CPUs with AVX-512F. The instruction   //
+// set is enabled with a pragma for the functions of this file only, so it is built //
+// with the same flags as the other files. The standard headers are included before //
+// the pragma, so their inline functions are not built for the new instruction set. //
+//**********************************************************************************//
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <complex>
+#include <immintrin.h>
+
+#define NMIE_SIMD_LEVEL 3
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+
+#include "nmie-field-lanes.h"
+
+namespace nmie {
+  namespace simd {
+    template <> FieldKernel<float> FieldKernelAVX512<float>() {return MakeFieldKernel<float>();}
+    template <> FieldKernel<double> FieldKernelAVX512<double>() {return MakeFieldKernel<double>();}
+  }  // end of namespace simd
+}  // end of namespace nmie
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#else  // Other compilers and CPUs
+#include "nmie-field-lanes.h"
+
+namespace nmie {
+  namespace simd {
+    template <> FieldKernel<float> FieldKernelAVX512<float>() {return {0, nullptr, nullptr, nullptr};}
+    template <> FieldKernel<double> FieldKernelAVX512<double>() {return {0, nullptr, nullptr, nullptr};}
+  }  // end of namespace simd
+}  // end of namespace nmie
+#endif
@@ -0,0 +1,233 @@
+#ifndef SRC_NMIE_FIELD_LANES_H_
+#define SRC_NMIE_FIELD_LANES_H_
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+// Vector kernels of the near field of groups of points of the same layer, one      //
+// point per lane (see MultiLayerMie::calcFieldLanes). The kernels are built once   //
+// per instruction set: with the flags of nmie.cc, and in nmie-field-avx2.cc and    //
+// nmie-field-avx512.cc for AVX2 and AVX-512. GetFieldKernel() selects the widest   //
+// one supported by the CPU the first time it is called. The environment variable   //
+// SCATTNLAY_SIMD limits the choice: "avx2" skips the AVX-512 kernel and "default"  //
+// uses the kernel built with the flags of nmie.cc.                                 //
+//                                                                                  //
+// The kernels only see raw arrays, so that the files built for other instruction   //
+// sets do not emit any inline function shared with the rest of the program.        //
+//**********************************************************************************//
+#include "nmie-simd.h"
+
+namespace nmie {
+  namespace simd {
+    // Maximum number of lanes of a field kernel (AVX-512 with float)
+    const int kMaxFieldLanes = 16;
+
+    // Arrays of a group of lanes. Complex values are stored as lane arrays (see
+    // CPack), with nfull + 1 elements for D1, D3, Psi, Zeta and PsiZeta, and
+    // nmax for Pi and Tau.
+    template <typename T> struct FieldLanes {
+      int nmax, nfull;
+      // 1/z for z = Rho*ml, one element
+      const T *zinv;
+      const T *sin_theta, *cos_theta;
+      // En times aln, bln, cln and dln (see calcFieldSum) for n = 0..nmax - 2,
+      // stored as [8*n + 2*j + c] with c = 0 (real) and 1 (imaginary). For
+      // Angular, the radial terms of one Rho (see calcFieldRadial), stored as
+      // [12*n + 2*j + c].
+      const T *coeffs;
+      // Factor of the magnetic field, real and imaginary parts
+      T hffact[2];
+      // D1 must already have its element nfull, and D3, Psi, Zeta and PsiZeta
+      // their element 0 before Sums
+      T *D1, *D3, *Psi, *Zeta, *PsiZeta, *Pi, *Tau;
+      // For the lanes close to the pole of D1[0] (pole[k] != 0), element 1 of
+      // PsiZeta, D3, Psi and Zeta, as a lane array of 4 elements. pole is null
+      // if there are no such lanes.
+      const int *pole;
+      const T *fix;
+      // Er, Etheta, Ephi, Hr, Htheta and Hphi, a lane array of 6 elements
+      T *EH;
+    };
+
+    template <typename T> struct FieldKernel {
+      int lanes;
+      // Downward recurrence of D1
+      void (*Downward)(const FieldLanes<T>&);
+      // Upward recurrences, angular functions and multipole sums
+      void (*Sums)(const FieldLanes<T>&);
+      // Multipole sums of points with the same Rho, from their radial terms
+      // in coeffs and their angular functions in Pi and Tau
+      void (*Angular)(const FieldLanes<T>&);
+    };
+
+    // Kernel used for type T
+    template <typename T> const FieldKernel<T>& GetFieldKernel();
+
+    // Kernels of nmie-field-avx512.cc and nmie-field-avx2.cc, with no lanes if
+    // the compiler could not build them
+    template <typename T> FieldKernel<T> FieldKernelAVX512();
+    template <> FieldKernel<float> FieldKernelAVX512<float>();
+    template <> FieldKernel<double> FieldKernelAVX512<double>();
+    template <typename T> FieldKernel<T> FieldKernelAVX2();
+    template <> FieldKernel<float> FieldKernelAVX2<float>();
+    template <> FieldKernel<double> FieldKernelAVX2<double>();
+
+  inline namespace NMIE_SIMD_ISA {
+    // Downward recurrence for D1 - equations (16a) and (16b)
+    template <typename T> void FieldDownward(const FieldLanes<T>& f) {
+      typedef Pack<T> V;
+      typedef CPack<T> C;
+      const int K = V::kLanes;
+      const C zinv = C::Load(f.zinv), one = C::Set1(T(1.0), T(0.0));
+      for (int n = f.nfull; n > 0; n--) {
+        const C nz = V::Set1(n)*zinv;
+        (nz - one/(C::Load(f.D1 + 2*n*K) + nz)).Store(f.D1 + 2*(n - 1)*K);
+      }
+    }
+
+    template <typename T> void FieldSums(const FieldLanes<T>& f) {
+      typedef Pack<T> V;
+      typedef CPack<T> C;
+      typedef typename V::type R;
+      const int K = V::kLanes;
+      const int nmax = f.nmax;
+      T *D1 = f.D1, *D3 = f.D3, *Psi = f.Psi, *Zeta = f.Zeta, *PsiZeta = f.PsiZeta, *Pi = f.Pi, *Tau = f.Tau;
+      const C zinv = C::Load(f.zinv), i = C::Set1(T(0.0), T(1.0));
+
+      // Upward recurrences for PsiZeta, D3, Psi and Zeta - equations (18a) - (21b)
+      for (int n = 1; n <= f.nfull; n++) {
+        const C nz = V::Set1(n)*zinv;
+        const C D1nM1 = C::Load(D1 + 2*(n - 1)*K), D3nM1 = C::Load(D3 + 2*(n - 1)*K);
+        const C PZ = C::Load(PsiZeta + 2*(n - 1)*K)*(nz - D1nM1)*(nz - D3nM1);
+        PZ.Store(PsiZeta + 2*n*K);
+        (C::Load(Psi + 2*(n - 1)*K)*(nz - D1nM1)).Store(Psi + 2*n*K);
+        (C::Load(Zeta + 2*(n - 1)*K)*(nz - D3nM1)).Store(Zeta + 2*n*K);
+        (C::Load(D1 + 2*n*K) + i/PZ).Store(D3 + 2*n*K);
+
+        // Lanes close to the pole of D1[0] use the explicit expressions for n = 1
+        if (n == 1 && f.pole != nullptr) {
+          T *fixed[4] = {PsiZeta, D3, Psi, Zeta};
+          for (int k = 0; k < K; k++) {
+            if (f.pole[k] == 0) continue;
+            for (int j = 0; j < 4; j++) {
+              fixed[j][2*K + k] = f.fix[2*j*K + k];
+              fixed[j][3*K + k] = f.fix[(2*j + 1)*K + k];
+            }
+          }
+        }
+      }
+
+      // Angular functions - equations (26a) - (26c)
+      const R cos_t = V::Load(f.cos_theta);
+      V::Store(Pi, V::Set1(1.0));
+      V::Store(Tau, cos_t);
+      if (nmax > 1) {
+        V::Store(Pi + K, V::Mul(V::Mul(V::Set1(3), cos_t), V::Load(Pi)));
+        V::Store(Tau + K, V::Sub(V::Mul(V::Mul(V::Set1(2), cos_t), V::Load(Pi + K)), V::Mul(V::Set1(3), V::Load(Pi))));
+        for (int n = 2; n < nmax; n++) {
+          const R PinM1 = V::Load(Pi + (n - 1)*K);
+          const R Pin = V::Div(V::Sub(V::Mul(V::Mul(V::Set1(n + n + 1), cos_t), PinM1),
+                                      V::Mul(V::Set1(n + 1), V::Load(Pi + (n - 2)*K))), V::Set1(n));
+          V::Store(Pi + n*K, Pin);
+          V::Store(Tau + n*K, V::Sub(V::Mul(V::Mul(V::Set1(n + 1), cos_t), Pin), V::Mul(V::Set1(n + 2), PinM1)));
+        }
+      }
+
+      // Multipole sums, BH 4.50 and eqs. (1) and (2) in Yang, Appl. Opt., 42
+      // (2003) 1710-1720
+      const C zero = C::Set1(T(0.0), T(0.0));
+      C E0 = zero, E1 = zero, E2 = zero, H0 = zero, H1 = zero, H2 = zero;
+      for (int n = nmax - 2; n >= 0; n--) {
+        const int n1 = n + 1;
+        const T *c = f.coeffs + 8*n;
+        const C ea = C::Set1(c[0], c[1]), eb = C::Set1(c[2], c[3]);
+        const C ec = C::Set1(c[4], c[5]), ed = C::Set1(c[6], c[7]);
+
+        // Radial parts of the vector spherical harmonics: rn/Rho, Dn*rn/Rho and
+        // n*(n + 1)*rn/Rho^2, for Psi (1) and Zeta (3)
+        const C A1 = C::Load(Psi + 2*n1*K)*zinv, A3 = C::Load(Zeta + 2*n1*K)*zinv;
+        const C B1 = C::Load(D1 + 2*n1*K)*A1, B3 = C::Load(D3 + 2*n1*K)*A3;
+        const R nn = V::Set1(T(n1)*T(n1) + T(n1));
+        const C C1 = nn*(A1*zinv), C3 = nn*(A3*zinv);
+
+        const R pi = V::Load(Pi + n*K), tau = V::Load(Tau + n*K);
+        const C PE = ec*A1 - eb*A3, QE = i*(ea*B3 - ed*B1), RE = i*(ea*C3 - ed*C1);
+        const C PH = ed*A1 - ea*A3, QH = i*(eb*B3 - ec*B1), RH = i*(eb*C3 - ec*C1);
+        E0 = E0 + pi*RE;
+        E1 = E1 + pi*PE + tau*QE;
+        E2 = E2 - (tau*PE + pi*QE);
+        H0 = H0 + pi*RH;
+        H1 = H1 + pi*PH + tau*QH;
+        H2 = H2 + tau*PH + pi*QH;
+      }
+
+      // magnetic field
+      const R sin_t = V::Load(f.sin_theta);
+      const C hffact = C::Set1(f.hffact[0], f.hffact[1]);
+      (sin_t*E0).Store(f.EH);
+      E1.Store(f.EH + 2*K);
+      E2.Store(f.EH + 4*K);
+      (hffact*(sin_t*H0)).Store(f.EH + 6*K);
+      (hffact*H1).Store(f.EH + 8*K);
+      (hffact*H2).Store(f.EH + 10*K);
+    }
+
+    template <typename T> void FieldAngular(const FieldLanes<T>& f) {
+      typedef Pack<T> V;
+      typedef CPack<T> C;
+      typedef typename V::type R;
+      const int K = V::kLanes;
+      const C zero = C::Set1(T(0.0), T(0.0));
+      C E0 = zero, E1 = zero, E2 = zero, H0 = zero, H1 = zero, H2 = zero;
+      for (int n = f.nmax - 2; n >= 0; n--) {
+        const T *c = f.coeffs + 12*n;
+        const C RE = C::Set1(c[0], c[1]), PE = C::Set1(c[2], c[3]), QE = C::Set1(c[4], c[5]);
+        const C RH = C::Set1(c[6], c[7]), PH = C::Set1(c[8], c[9]), QH = C::Set1(c[10], c[11]);
+        const R pi = V::Load(f.Pi + n*K), tau = V::Load(f.Tau + n*K);
+        E0 = E0 + pi*RE;
+        E1 = E1 + pi*PE + tau*QE;
+        E2 = E2 - (tau*PE + pi*QE);
+        H0 = H0 + pi*RH;
+        H1 = H1 + pi*PH + tau*QH;
+        H2 = H2 + tau*PH + pi*QH;
+      }
+
+      const R sin_t = V::Load(f.sin_theta);
+      (sin_t*E0).Store(f.EH);
+      E1.Store(f.EH + 2*K);
+      E2.Store(f.EH + 4*K);
+      (sin_t*H0).Store(f.EH + 6*K);
+      H1.Store(f.EH + 8*K);
+      H2.Store(f.EH + 10*K);
+    }
+
+    template <typename T> FieldKernel<T> MakeFieldKernel() {
+      FieldKernel<T> kernel = {Pack<T>::kLanes, FieldDownward<T>, FieldSums<T>, FieldAngular<T>};
+      return kernel;
+    }
+  }  // end of namespace NMIE_SIMD_ISA
+  }  // end of namespace simd
+}  // end of namespace nmie
+#endif  // SRC_NMIE_FIELD_LANES_H_
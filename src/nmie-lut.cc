@@ -0,0 +1,362 @@
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+#include "nmie-lut.h"
+#include "nmie.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nmie {
+  namespace {
+    const char kMagic[8] = {'S', 'C', 'N', 'L', 'Y', 'L', 'U', 'T'};
+    const uint32_t kVersion = 1, kByteOrder = 0x01020304;
+    // Qext, Qsca, Qabs, Qbk, Qpr and g, then the moments
+    const unsigned int kFixedValues = 6;
+    // Size of the fixed part of the header (magic and nine uint32)
+    const unsigned long kFixedHeader = 8 + 9*sizeof(uint32_t) + 4;
+
+    // Closes a file descriptor when it goes out of scope
+    struct File {
+      int fd;
+      ~File() {if (fd >= 0) close(fd);};
+    };
+
+    // Header of a table (see the description of MieTable)
+    std::vector<char> BuildHeader(const std::vector<double>& x, const std::vector<double>& n,
+                                  const std::vector<double>& k, unsigned int moments) {
+      std::string names = "Qext Qsca Qabs Qbk Qpr g";
+      for (unsigned int l = 0; l < moments; l++) names += " chi" + std::to_string(l);
+      names.resize((names.size() + 8)/8*8, '\0');
+      const unsigned long size = kFixedHeader + 8*(x.size() + n.size() + k.size()) + names.size();
+      std::vector<char> header(size, 0);
+      const uint32_t fields[9] = {kVersion, kByteOrder, static_cast<uint32_t>(size),
+                                  static_cast<uint32_t>(x.size()), static_cast<uint32_t>(n.size()),
+                                  static_cast<uint32_t>(k.size()), kFixedValues + moments, moments,
+                                  static_cast<uint32_t>(names.size())};
+      std::memcpy(header.data(), kMagic, 8);
+      std::memcpy(header.data() + 8, fields, sizeof(fields));
+      char* grid = header.data() + kFixedHeader;
+      for (const auto* values : {&x, &n, &k}) {
+        std::memcpy(grid, values->data(), 8*values->size());
+        grid += 8*values->size();
+      }
+      std::memcpy(grid, names.data(), names.size());
+      return header;
+    }
+
+    // Gauss-Legendre nodes and weights on [-1, 1], cached for the last N
+    void GaussLegendre(int N, std::vector<double>& mu, std::vector<double>& w) {
+      if (static_cast<int>(mu.size()) == N) return;
+      mu.resize(N);
+      w.resize(N);
+      for (int i = 0; i < (N + 1)/2; i++) {
+        // Newton iteration from the Chebyshev-like initial guess
+        double z = std::cos(PI_*(i + 0.75)/(N + 0.5)), dp = 0.0;
+        for (int iteration = 0; iteration < 100; iteration++) {
+          double p0 = 1.0, p1 = z;
+          for (int j = 2; j <= N; j++) {
+            const double p2 = ((2.0*j - 1.0)*z*p1 - (j - 1.0)*p0)/j;
+            p0 = p1;
+            p1 = p2;
+          }
+          dp = N*(z*p1 - p0)/(z*z - 1.0);
+          const double dz = p1/dp;
+          z -= dz;
+          if (std::abs(dz) < 1e-15) break;
+        }
+        mu[i] = z;
+        mu[N - 1 - i] = -z;
+        w[i] = w[N - 1 - i] = 2.0/((1.0 - z*z)*dp*dp);
+      }
+    }
+
+    // Values of one node calculated with model (see the description of MieTable)
+    void CalcNodeValues(MultiLayerMie& model, std::vector<double>& mu, std::vector<double>& w,
+                        double x, double n, double k, unsigned int moments, double* values) {
+      model.SetLayersSize({x});
+      model.SetLayersIndex({std::complex<double>(n, k)});
+      // The phase function is a polynomial of degree 2*nmax in mu, the
+      // quadrature is exact for its moments
+      model.calcScattCoeffs();
+      const int N = model.GetMaxTerms() + moments/2 + 2;
+      GaussLegendre(N, mu, w);
+      std::vector<double> theta(N);
+      for (int j = 0; j < N; j++) theta[j] = std::acos(mu[j]);
+      model.SetAngles(theta);
+      model.RunMieCalculation();
+      values[0] = model.GetQext();
+      values[1] = model.GetQsca();
+      values[2] = model.GetQabs();
+      values[3] = model.GetQbk();
+      values[4] = model.GetQpr();
+      values[5] = model.GetAsymmetryFactor();
+      double* chi = values + kFixedValues;
+      std::fill(chi, chi + moments, 0.0);
+      if (!(model.GetQsca() > 0.0)) {  // No scattering (m = 1)
+        if (moments > 0) chi[0] = 1.0;
+        return;
+      }
+      const double norm = 1.0/(x*x*model.GetQsca());
+      for (int j = 0; j < N; j++) {
+        const double P = w[j]*norm*(std::norm(model.GetS1()[j]) + std::norm(model.GetS2()[j]));
+        double p0 = 1.0, p1 = mu[j];
+        for (unsigned int l = 0; l < moments; l++) {
+          chi[l] += P*p0;
+          const double p2 = ((2.0*l + 3.0)*mu[j]*p1 - (l + 1.0)*p0)/(l + 2.0);
+          p0 = p1;
+          p1 = p2;
+        }
+      }
+    }
+
+    // Nodes and weights along one axis of the table: up to 4 nodes from
+    // 'first', with the weights of the cubic Lagrange polynomial and of the
+    // linear interpolation
+    unsigned long Stencil(const std::vector<double>& grid, double v, unsigned long& first,
+                          double cubic[4], double linear[4]) {
+      std::fill(cubic, cubic + 4, 0.0);
+      std::fill(linear, linear + 4, 0.0);
+      const unsigned long G = grid.size();
+      if (!(v >= grid.front() && v <= grid.back()))
+        throw std::invalid_argument("Point is out of the table!");
+      if (G == 1) {
+        first = 0;
+        cubic[0] = linear[0] = 1.0;
+        return 1;
+      }
+      const unsigned long i = std::min<unsigned long>(
+          std::upper_bound(grid.begin(), grid.end(), v) - grid.begin() - 1, G - 2);
+      const unsigned long count = std::min(G, 4ul);
+      first = std::min(i > 0 ? i - 1 : 0, G - count);
+      for (unsigned long a = 0; a < count; a++) {
+        cubic[a] = 1.0;
+        for (unsigned long b = 0; b < count; b++)
+          if (b != a) cubic[a] *= (v - grid[first + b])/(grid[first + a] - grid[first + b]);
+      }
+      const double t = (v - grid[i])/(grid[i + 1] - grid[i]);
+      linear[i - first] = 1.0 - t;
+      linear[i + 1 - first] = t;
+      return count;
+    }
+  }  // end of anonymous namespace
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  void MieTable::CalcNode(double x, double n, double k, unsigned int moments, double* values) {
+    MultiLayerMie model;
+    std::vector<double> mu, w;
+    CalcNodeValues(model, mu, w, x, n, k, moments, values);
+  }
+
+
+  // ********************************************************************** //
+  // Create the file (all nodes NaN) or check that it holds the same grids, //
+  // then calculate the missing nodes in parallel. Each thread writes its   //
+  // nodes at their offsets with pwrite, as soon as they are calculated.    //
+  // ********************************************************************** //
+  void MieTable::Generate(const std::string& file_name, const std::vector<double>& x,
+                          const std::vector<double>& n, const std::vector<double>& k,
+                          unsigned int moments, ThreadPool& pool) {
+    for (const auto* grid : {&x, &n, &k}) {
+      if (grid->empty())
+        throw std::invalid_argument("Table grids should not be empty!");
+      for (unsigned long i = 1; i < grid->size(); i++)
+        if (!((*grid)[i] > (*grid)[i - 1]))
+          throw std::invalid_argument("Table grids should be increasing!");
+    }
+    if (!(x.front() > 0.0))
+      throw std::invalid_argument("Table size parameters should be positive!");
+    const std::vector<char> header = BuildHeader(x, n, k, moments);
+    const unsigned long V = kFixedValues + moments, nodes = x.size()*n.size()*k.size();
+    const unsigned long size = header.size() + 8*V*nodes;
+
+    File file = {open(file_name.c_str(), O_RDWR | O_CREAT, 0644)};
+    struct stat status;
+    if (file.fd < 0 || fstat(file.fd, &status) != 0)
+      throw std::invalid_argument("Cannot open table file " + file_name + "!");
+    auto write_all = [&](const void* buffer, unsigned long bytes, unsigned long offset) {
+      if (pwrite(file.fd, buffer, bytes, offset) != static_cast<ssize_t>(bytes))
+        throw std::invalid_argument("Cannot write table file " + file_name + "!");
+    };
+    const unsigned long kBlock = 4096;  // Nodes per block read or written
+    std::vector<double> block(V*kBlock, std::numeric_limits<double>::quiet_NaN());
+    if (status.st_size == 0) {
+      write_all(header.data(), header.size(), 0);
+      for (unsigned long node = 0; node < nodes; node += kBlock)
+        write_all(block.data(), 8*V*std::min(kBlock, nodes - node), header.size() + 8*V*node);
+    } else {
+      std::vector<char> old(header.size());
+      if (static_cast<unsigned long>(status.st_size) != size
+          || pread(file.fd, old.data(), old.size(), 0) != static_cast<ssize_t>(old.size())
+          || old != header)
+        throw std::invalid_argument("Table file " + file_name + " holds a different table!");
+    }
+
+    // Nodes still missing (NaN Qext)
+    std::vector<unsigned long> missing;
+    for (unsigned long node = 0; node < nodes; node += kBlock) {
+      const unsigned long count = std::min(kBlock, nodes - node);
+      if (pread(file.fd, block.data(), 8*V*count, header.size() + 8*V*node) != static_cast<ssize_t>(8*V*count))
+        throw std::invalid_argument("Cannot read table file " + file_name + "!");
+      for (unsigned long i = 0; i < count; i++)
+        if (std::isnan(block[V*i])) missing.push_back(node + i);
+    }
+
+    std::vector<MultiLayerMie> models(pool.GetThreadCount());
+    pool.ParallelFor(missing.size(), 0, [&](unsigned long first, unsigned long count, unsigned int thread) {
+        std::vector<double> values(V), mu, w;
+        for (unsigned long i = first; i < first + count; i++) {
+          const unsigned long node = missing[i];
+          const unsigned long ik = node%k.size(), in = (node/k.size())%n.size(), ix = node/(k.size()*n.size());
+          try {
+            CalcNodeValues(models[thread], mu, w, x[ix], n[in], k[ik], moments, values.data());
+          } catch(const std::invalid_argument& ia) {
+            continue;  // Left missing
+          }
+          write_all(values.data(), 8*V, header.size() + 8*V*node);
+        }
+      });
+    fsync(file.fd);
+  }
+
+
+  // ********************************************************************** //
+  // Map the file and check its header                                      //
+  // ********************************************************************** //
+  MieTable::MieTable(const std::string& file_name) {
+    File file = {open(file_name.c_str(), O_RDONLY)};
+    struct stat status;
+    if (file.fd < 0 || fstat(file.fd, &status) != 0)
+      throw std::invalid_argument("Cannot open table file " + file_name + "!");
+    const unsigned long size = status.st_size;
+    if (size < kFixedHeader)
+      throw std::invalid_argument("File " + file_name + " is not a Mie table!");
+    map_ = mmap(nullptr, size, PROT_READ, MAP_SHARED, file.fd, 0);
+    if (map_ == MAP_FAILED) {
+      map_ = nullptr;
+      throw std::invalid_argument("Cannot map table file " + file_name + "!");
+    }
+    map_size_ = size;
+    const char* bytes = static_cast<const char*>(map_);
+    uint32_t fields[9];
+    std::memcpy(fields, bytes + 8, sizeof(fields));
+    const unsigned long header_size = fields[2];
+    const unsigned long grid_size = 8*(static_cast<unsigned long>(fields[3]) + fields[4] + fields[5]);
+    try {
+      if (std::memcmp(bytes, kMagic, 8) != 0)
+        throw std::invalid_argument("File " + file_name + " is not a Mie table!");
+      if (fields[0] != kVersion)
+        throw std::invalid_argument("Table file " + file_name + " has an unsupported version!");
+      if (fields[1] != kByteOrder)
+        throw std::invalid_argument("Table file " + file_name + " has a different byte order!");
+      if (header_size != kFixedHeader + grid_size + fields[8] || fields[3]*fields[4]*fields[5] == 0
+          || fields[6] != kFixedValues + fields[7]
+          || size != header_size + 8ul*fields[6]*fields[3]*fields[4]*fields[5])
+        throw std::invalid_argument("Table file " + file_name + " is corrupted!");
+    } catch(...) {
+      munmap(map_, map_size_);
+      map_ = nullptr;
+      throw;
+    }
+    const double* grid = reinterpret_cast<const double*>(bytes + kFixedHeader);
+    x_.assign(grid, grid + fields[3]);
+    n_.assign(grid + fields[3], grid + fields[3] + fields[4]);
+    k_.assign(grid + fields[3] + fields[4], grid + fields[3] + fields[4] + fields[5]);
+    std::istringstream names(std::string(bytes + kFixedHeader + grid_size,
+                                         strnlen(bytes + kFixedHeader + grid_size, fields[8])));
+    std::string name;
+    while (names >> name) names_.push_back(name);
+    values_ = fields[6];
+    moments_ = fields[7];
+    data_ = reinterpret_cast<const double*>(bytes + header_size);
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  MieTable::~MieTable() {
+    if (map_) munmap(map_, map_size_);
+  }
+
+
+  // ********************************************************************** //
+  // Tensor product of the cubic (and linear) weights of the three axes     //
+  // ********************************************************************** //
+  double MieTable::Interpolate(double x, double n, double k, std::vector<double>& values) const {
+    unsigned long first[3], count[3];
+    double cubic[3][4], linear[3][4];
+    count[0] = Stencil(x_, x, first[0], cubic[0], linear[0]);
+    count[1] = Stencil(n_, n, first[1], cubic[1], linear[1]);
+    count[2] = Stencil(k_, k, first[2], cubic[2], linear[2]);
+    values.assign(values_, 0.0);
+    std::vector<double> linear_values(values_, 0.0);
+    for (unsigned long a = 0; a < count[0]; a++) {
+      for (unsigned long b = 0; b < count[1]; b++) {
+        for (unsigned long c = 0; c < count[2]; c++) {
+          const double* node = data_ + values_*(((first[0] + a)*n_.size() + first[1] + b)*k_.size() + first[2] + c);
+          const double wc = cubic[0][a]*cubic[1][b]*cubic[2][c];
+          const double wl = linear[0][a]*linear[1][b]*linear[2][c];
+          for (unsigned int q = 0; q < values_; q++) {
+            values[q] += wc*node[q];
+            linear_values[q] += wl*node[q];
+          }
+        }
+      }
+    }
+    const double scale = std::max(std::max(std::abs(values[0]), std::abs(values[1])), std::abs(values[2]));
+    double error = 0.0;
+    for (unsigned int q = 0; q < values_; q++) {
+      const double difference = std::abs(values[q] - linear_values[q]);
+      if (std::isnan(difference)) return std::numeric_limits<double>::quiet_NaN();
+      error = std::max(error, (q < 3 && scale > 0.0) ? difference/scale : difference);
+    }
+    return error;
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  void MieTable::Evaluate(double x, double n, double k, double tolerance, std::vector<double>& values) const {
+    const bool inside = x >= x_.front() && x <= x_.back() && n >= n_.front() && n <= n_.back()
+      && k >= k_.front() && k <= k_.back();
+    if (inside && Interpolate(x, n, k, values) <= tolerance) return;
+    values.resize(values_);
+    CalcNode(x, n, k, moments_, values.data());
+  }
+}  // end of namespace nmie
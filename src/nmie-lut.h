@@ -0,0 +1,100 @@
+#ifndef SRC_NMIE_LUT_H_
+#define SRC_NMIE_LUT_H_
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+
+#include <string>
+#include <vector>
+#include "nmie-threads.h"
+
+namespace nmie {
+  //**********************************************************************************//
+  // Lookup table of the far-field results of homogeneous spheres on a grid of size   //
+  // parameters x and refractive indexes n + ik, for radiative transfer codes. Each   //
+  // node holds Qext, Qsca, Qabs, Qbk, Qpr, g and the first Legendre moments chi_l    //
+  // of the phase function P(mu) = 2*(|S1|^2 + |S2|^2)/(x^2*Qsca), normalized so      //
+  // that chi_0 = 1 and chi_1 = g.                                                    //
+  //                                                                                  //
+  // The binary file (native byte order, checked when it is read) starts with a       //
+  // self-describing header:                                                          //
+  //   char[8] "SCNLYLUT", uint32 version, byte order mark 0x01020304, header size,   //
+  //   nx, nn, nk, values per node, moments, size of the names, reserved (0);         //
+  //   double x[nx], n[nn], k[nk]; the names of the values separated by spaces,       //
+  //   padded with zeros to a multiple of 8 bytes.                                    //
+  // followed by the values of the nodes as double [ix][in][ik][value]. Nodes that    //
+  // were not calculated yet are NaN.                                                 //
+  //                                                                                  //
+  // Tables are read through a read-only shared memory map, so all the processes      //
+  // that use the same file share one copy in the page cache.                         //
+  //**********************************************************************************//
+  class MieTable {
+   public:
+    // Calculate the table for the increasing grids x, n and k with 'moments'
+    // Legendre moments and write it to file_name. If the file already holds a
+    // table with the same grids, only its missing nodes are calculated, so an
+    // interrupted generation can be resumed. Nodes are written as soon as
+    // they are calculated.
+    static void Generate(const std::string& file_name, const std::vector<double>& x,
+                         const std::vector<double>& n, const std::vector<double>& k,
+                         unsigned int moments, ThreadPool& pool = ThreadPool::Shared());
+
+    explicit MieTable(const std::string& file_name);
+    ~MieTable();
+    MieTable(const MieTable&) = delete;
+    MieTable& operator=(const MieTable&) = delete;
+
+    const std::vector<double>& GetX() const {return x_;};
+    const std::vector<double>& GetN() const {return n_;};
+    const std::vector<double>& GetK() const {return k_;};
+    // Names of the values of each node ("Qext", ..., "g", "chi0", ...)
+    const std::vector<std::string>& GetNames() const {return names_;};
+    unsigned int GetMoments() const {return moments_;};
+
+    // Values at (x, n, k) interpolated with cubic Lagrange polynomials along
+    // each axis. Returns an error estimate: the largest difference with the
+    // linear interpolation, relative to the largest value of the cross
+    // sections (Qext, Qsca, Qabs) or absolute for the other values. It is
+    // NaN if a node of the stencil is missing.
+    double Interpolate(double x, double n, double k, std::vector<double>& values) const;
+    // Interpolated values if the error estimate is below tolerance, otherwise
+    // they are calculated with MultiLayerMie
+    void Evaluate(double x, double n, double k, double tolerance, std::vector<double>& values) const;
+
+    // Calculate the values of one node (see the class description)
+    static void CalcNode(double x, double n, double k, unsigned int moments, double* values);
+
+   private:
+    std::vector<double> x_, n_, k_;
+    std::vector<std::string> names_;
+    unsigned int moments_ = 0, values_ = 0;
+    // Memory map of the whole file and its node values
+    void* map_ = nullptr;
+    unsigned long map_size_ = 0;
+    const double* data_ = nullptr;
+  };  // end of class MieTable
+}  // end of namespace nmie
+#endif  // SRC_NMIE_LUT_H_
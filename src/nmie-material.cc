@@ -0,0 +1,181 @@
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+#include "nmie-material.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace nmie {
+  namespace {
+    // Photon energy in eV times its wavelength in nm
+    const double kHC = 1239.841984;
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  Material::Material(std::complex<double> index) : index_(index) {}
+
+
+  // ********************************************************************** //
+  // Natural cubic spline through the table: second derivatives from the    //
+  // tridiagonal system of the continuity conditions (Thomas algorithm).    //
+  // ********************************************************************** //
+  Material Material::Tabulated(const std::vector<double>& WL,
+                               const std::vector< std::complex<double> >& index) {
+    if (WL.size() != index.size() || WL.size() < 2)
+      throw std::invalid_argument("Material table should have at least two (WL, index) rows!");
+    for (unsigned long i = 1; i < WL.size(); i++)
+      if (!(WL[i] > WL[i - 1]))
+        throw std::invalid_argument("Material table wavelengths should be increasing!");
+    Material material;
+    material.model_ = kTabulated;
+    material.table_WL_ = WL;
+    material.table_index_ = index;
+    const unsigned long N = WL.size();
+    std::vector< std::complex<double> >& d2 = material.table_d2_;
+    d2.assign(N, std::complex<double>(0.0, 0.0));
+    std::vector<double> c(N, 0.0);
+    for (unsigned long i = 1; i + 1 < N; i++) {
+      const double h0 = WL[i] - WL[i - 1], h1 = WL[i + 1] - WL[i];
+      const std::complex<double> rhs = 6.0*((index[i + 1] - index[i])/h1 - (index[i] - index[i - 1])/h0);
+      const double diag = 2.0*(h0 + h1) - h0*c[i - 1];
+      c[i] = h1/diag;
+      d2[i] = (rhs - h0*d2[i - 1])/diag;
+    }
+    for (unsigned long i = N - 2; i > 0; i--) d2[i] -= c[i]*d2[i + 1];
+    return material;
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  Material Material::Load(const std::string& file_name) {
+    std::ifstream file(file_name);
+    if (!file)
+      throw std::invalid_argument("Cannot open material file " + file_name + "!");
+    std::vector<double> WL;
+    std::vector< std::complex<double> > index;
+    std::string line;
+    while (std::getline(file, line)) {
+      line = line.substr(0, line.find('#'));
+      std::istringstream row(line);
+      double wl, n, k;
+      if (!(row >> wl)) continue;  // Empty line
+      if (!(row >> n >> k))
+        throw std::invalid_argument("Material file " + file_name + " should have columns WL n k!");
+      WL.push_back(wl);
+      index.push_back(std::complex<double>(n, k));
+    }
+    return Tabulated(WL, index);
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  Material Material::Drude(double eps_inf, double plasma_eV, double damping_eV) {
+    Material material;
+    material.model_ = kDrudeLorentz;
+    material.eps_inf_ = eps_inf;
+    material.terms_.push_back({{plasma_eV*plasma_eV, 0.0, damping_eV}});
+    return material;
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  Material Material::Sellmeier(const std::vector<double>& B, const std::vector<double>& C) {
+    if (B.size() != C.size())
+      throw std::invalid_argument("Each Sellmeier term should have B and C!");
+    Material material;
+    material.model_ = kSellmeier;
+    for (unsigned long i = 0; i < B.size(); i++) material.terms_.push_back({{B[i], C[i], 0.0}});
+    return material;
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  void Material::AddLorentz(double strength, double resonance_eV, double damping_eV) {
+    if (model_ != kDrudeLorentz)
+      throw std::invalid_argument("Lorentz terms can only be added to a Drude material!");
+    terms_.push_back({{strength*resonance_eV*resonance_eV, resonance_eV, damping_eV}});
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  std::complex<double> Material::GetIndex(double WL) const {
+    switch (model_) {
+      case kConstant:
+        return index_;
+      case kTabulated: {
+        if (WL < table_WL_.front() || WL > table_WL_.back())
+          throw std::invalid_argument("Wavelength is out of the material table!");
+        const unsigned long i = std::min<unsigned long>(
+            std::upper_bound(table_WL_.begin(), table_WL_.end(), WL) - table_WL_.begin(),
+            table_WL_.size() - 1);
+        const double h = table_WL_[i] - table_WL_[i - 1];
+        const double a = (table_WL_[i] - WL)/h, b = 1.0 - a;
+        return a*table_index_[i - 1] + b*table_index_[i]
+          + ((a*a*a - a)*table_d2_[i - 1] + (b*b*b - b)*table_d2_[i])*(h*h/6.0);
+      }
+      case kDrudeLorentz: {
+        const double w = kHC/WL;
+        std::complex<double> eps(eps_inf_, 0.0);
+        for (const auto& term : terms_)
+          eps += term[0]/std::complex<double>(term[1]*term[1] - w*w, -term[2]*w);
+        return std::sqrt(eps);
+      }
+      case kSellmeier: {
+        const double WL2 = WL*WL*1e-6;  // um^2
+        double n2 = 1.0;
+        for (const auto& term : terms_) n2 += term[0]*WL2/(WL2 - term[1]);
+        return std::sqrt(std::complex<double>(n2, 0.0));
+      }
+    }
+    return index_;
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  std::vector< std::complex<double> > Material::GetIndex(const std::vector<double>& WLs) const {
+    std::vector< std::complex<double> > index(WLs.size());
+    for (unsigned long i = 0; i < WLs.size(); i++) index[i] = GetIndex(WLs[i]);
+    return index;
+  }
+}  // end of namespace nmie
@@ -0,0 +1,78 @@
+#ifndef SRC_NMIE_MATERIAL_H_
+#define SRC_NMIE_MATERIAL_H_
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+
+#include <array>
+#include <complex>
+#include <string>
+#include <vector>
+
+namespace nmie {
+  //**********************************************************************************//
+  // Refractive index of a material as a function of the wavelength. It can be        //
+  // constant, interpolated from a table of (WL, n, k) with a natural cubic spline,   //
+  // or given by a Drude-Lorentz or Sellmeier model. Analytic models take the         //
+  // wavelength in nm; tables use the units of their wavelengths. Absorbing           //
+  // materials have k > 0.                                                            //
+  //**********************************************************************************//
+  class Material {
+   public:
+    explicit Material(std::complex<double> index = std::complex<double>(1.0, 0.0));
+    // Interpolated table, the wavelengths should be increasing
+    static Material Tabulated(const std::vector<double>& WL,
+                              const std::vector< std::complex<double> >& index);
+    // Table read from a text file with columns WL n k ('#' starts a comment)
+    static Material Load(const std::string& file_name);
+    // eps = eps_inf - wp^2/(w^2 + i*gamma*w), energies in eV; Lorentz
+    // oscillators can be added with AddLorentz()
+    static Material Drude(double eps_inf, double plasma_eV, double damping_eV);
+    // n^2 = 1 + sum(B_i*WL^2/(WL^2 - C_i)) with WL in um (C_i in um^2)
+    static Material Sellmeier(const std::vector<double>& B, const std::vector<double>& C);
+
+    // Add the term strength*w0^2/(w0^2 - w^2 - i*gamma*w) to the permittivity
+    // of a Drude-Lorentz material (energies in eV)
+    void AddLorentz(double strength, double resonance_eV, double damping_eV);
+
+    std::complex<double> GetIndex(double WL) const;
+    // Indexes for all the wavelengths of WLs
+    std::vector< std::complex<double> > GetIndex(const std::vector<double>& WLs) const;
+
+   private:
+    enum Model {kConstant, kTabulated, kDrudeLorentz, kSellmeier};
+    Model model_ = kConstant;
+    std::complex<double> index_;
+    // Table and second derivatives of its spline
+    std::vector<double> table_WL_;
+    std::vector< std::complex<double> > table_index_, table_d2_;
+    // Drude-Lorentz: {strength, resonance, damping} for each term, the Drude
+    // term has resonance 0 and strength wp^2; Sellmeier: {B, C}
+    double eps_inf_ = 1.0;
+    std::vector< std::array<double, 3> > terms_;
+  };  // end of class Material
+}  // end of namespace nmie
+#endif  // SRC_NMIE_MATERIAL_H_
@@ -0,0 +1,230 @@
+#ifndef SRC_NMIE_SIMD_H_
+#define SRC_NMIE_SIMD_H_
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+//**********************************************************************************//
+// Minimal wrapper around the vector extensions of the target CPU. Kernels written  //
+// with Pack<T> process Pack<T>::kLanes values per instruction. For double: 8 with  //
+// AVX-512, 4 with AVX/AVX2 and 2 with SSE2; for float twice as many. Other types   //
+// (and all of them without vector extensions) use plain scalar code with kLanes =  //
+// 1. The instruction set is selected at compile time, e.g. with -march=native, or  //
+// with NMIE_SIMD_LEVEL (3 for AVX-512, 2 for AVX, 1 for SSE2 and 0 for scalar) in  //
+// files whose functions are built for another instruction set (see                 //
+// nmie-field-avx512.cc). Everything that depends on it lives in an inline          //
+// namespace named after the instruction set, so files built for different          //
+// instruction sets can be linked together.                                         //
+//                                                                                  //
+// Loads and stores are unaligned, so any pointer to T can be used. The tails of    //
+// the arrays (less than kLanes elements) should be processed with scalar code.     //
+//**********************************************************************************//
+#include <complex>
+
+#ifndef NMIE_SIMD_LEVEL
+#if defined(__AVX512F__)
+#define NMIE_SIMD_LEVEL 3
+#elif defined(__AVX__)
+#define NMIE_SIMD_LEVEL 2
+#elif defined(__SSE2__)
+#define NMIE_SIMD_LEVEL 1
+#else
+#define NMIE_SIMD_LEVEL 0
+#endif
+#endif
+
+#if NMIE_SIMD_LEVEL == 3
+#define NMIE_SIMD_ISA avx512
+#elif NMIE_SIMD_LEVEL == 2
+#define NMIE_SIMD_ISA avx
+#elif NMIE_SIMD_LEVEL == 1
+#define NMIE_SIMD_ISA sse2
+#else
+#define NMIE_SIMD_ISA scalar
+#endif
+
+#if NMIE_SIMD_LEVEL > 0
+#include <immintrin.h>
+#endif
+
+namespace nmie {
+  namespace simd {
+  inline namespace NMIE_SIMD_ISA {
+    // Scalar fallback
+    template <typename T> struct Pack {
+      static const int kLanes = 1;
+      typedef T type;
+      static type Load(const T *p) {return *p;}
+      static void Store(T *p, type a) {*p = a;}
+      static type Set1(T a) {return a;}
+      static type Add(type a, type b) {return a + b;}
+      static type Sub(type a, type b) {return a - b;}
+      static type Mul(type a, type b) {return a*b;}
+      static type Div(type a, type b) {return a/b;}
+      static type Abs(type a) {return a < 0 ? -a : a;}
+    };
+
+#if NMIE_SIMD_LEVEL == 3
+    template <> struct Pack<double> {
+      static const int kLanes = 8;
+      typedef __m512d type;
+      static type Load(const double *p) {return _mm512_loadu_pd(p);}
+      static void Store(double *p, type a) {_mm512_storeu_pd(p, a);}
+      static type Set1(double a) {return _mm512_set1_pd(a);}
+      static type Add(type a, type b) {return _mm512_add_pd(a, b);}
+      static type Sub(type a, type b) {return _mm512_sub_pd(a, b);}
+      static type Mul(type a, type b) {return _mm512_mul_pd(a, b);}
+      static type Div(type a, type b) {return _mm512_div_pd(a, b);}
+      static type Abs(type a) {return _mm512_abs_pd(a);}
+    };
+    template <> struct Pack<float> {
+      static const int kLanes = 16;
+      typedef __m512 type;
+      static type Load(const float *p) {return _mm512_loadu_ps(p);}
+      static void Store(float *p, type a) {_mm512_storeu_ps(p, a);}
+      static type Set1(float a) {return _mm512_set1_ps(a);}
+      static type Add(type a, type b) {return _mm512_add_ps(a, b);}
+      static type Sub(type a, type b) {return _mm512_sub_ps(a, b);}
+      static type Mul(type a, type b) {return _mm512_mul_ps(a, b);}
+      static type Div(type a, type b) {return _mm512_div_ps(a, b);}
+      static type Abs(type a) {return _mm512_abs_ps(a);}
+    };
+#elif NMIE_SIMD_LEVEL == 2
+    template <> struct Pack<double> {
+      static const int kLanes = 4;
+      typedef __m256d type;
+      static type Load(const double *p) {return _mm256_loadu_pd(p);}
+      static void Store(double *p, type a) {_mm256_storeu_pd(p, a);}
+      static type Set1(double a) {return _mm256_set1_pd(a);}
+      static type Add(type a, type b) {return _mm256_add_pd(a, b);}
+      static type Sub(type a, type b) {return _mm256_sub_pd(a, b);}
+      static type Mul(type a, type b) {return _mm256_mul_pd(a, b);}
+      static type Div(type a, type b) {return _mm256_div_pd(a, b);}
+      static type Abs(type a) {return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a);}
+    };
+    template <> struct Pack<float> {
+      static const int kLanes = 8;
+      typedef __m256 type;
+      static type Load(const float *p) {return _mm256_loadu_ps(p);}
+      static void Store(float *p, type a) {_mm256_storeu_ps(p, a);}
+      static type Set1(float a) {return _mm256_set1_ps(a);}
+      static type Add(type a, type b) {return _mm256_add_ps(a, b);}
+      static type Sub(type a, type b) {return _mm256_sub_ps(a, b);}
+      static type Mul(type a, type b) {return _mm256_mul_ps(a, b);}
+      static type Div(type a, type b) {return _mm256_div_ps(a, b);}
+      static type Abs(type a) {return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);}
+    };
+#elif NMIE_SIMD_LEVEL == 1
+    template <> struct Pack<double> {
+      static const int kLanes = 2;
+      typedef __m128d type;
+      static type Load(const double *p) {return _mm_loadu_pd(p);}
+      static void Store(double *p, type a) {_mm_storeu_pd(p, a);}
+      static type Set1(double a) {return _mm_set1_pd(a);}
+      static type Add(type a, type b) {return _mm_add_pd(a, b);}
+      static type Sub(type a, type b) {return _mm_sub_pd(a, b);}
+      static type Mul(type a, type b) {return _mm_mul_pd(a, b);}
+      static type Div(type a, type b) {return _mm_div_pd(a, b);}
+      static type Abs(type a) {return _mm_andnot_pd(_mm_set1_pd(-0.0), a);}
+    };
+    template <> struct Pack<float> {
+      static const int kLanes = 4;
+      typedef __m128 type;
+      static type Load(const float *p) {return _mm_loadu_ps(p);}
+      static void Store(float *p, type a) {_mm_storeu_ps(p, a);}
+      static type Set1(float a) {return _mm_set1_ps(a);}
+      static type Add(type a, type b) {return _mm_add_ps(a, b);}
+      static type Sub(type a, type b) {return _mm_sub_ps(a, b);}
+      static type Mul(type a, type b) {return _mm_mul_ps(a, b);}
+      static type Div(type a, type b) {return _mm_div_ps(a, b);}
+      static type Abs(type a) {return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);}
+    };
+#endif
+
+    // Complex numbers of Pack<T>::kLanes lanes, real and imaginary parts are
+    // kept in separate registers (and arrays: element n of an array of
+    // lanes is stored at [2*n*kLanes + k] and [(2*n + 1)*kLanes + k])
+    template <typename T> struct CPack {
+      typedef simd::Pack<T> V;
+      typename V::type re, im;
+
+      static CPack Load(const T *p) {return {V::Load(p), V::Load(p + V::kLanes)};}
+      static CPack Set1(std::complex<T> a) {return {V::Set1(a.real()), V::Set1(a.imag())};}
+      static CPack Set1(T re, T im) {return {V::Set1(re), V::Set1(im)};}
+      void Store(T *p) const {V::Store(p, re); V::Store(p + V::kLanes, im);}
+    };
+
+    template <typename T> inline CPack<T> operator+(const CPack<T>& a, const CPack<T>& b) {
+      typedef simd::Pack<T> V;
+      return {V::Add(a.re, b.re), V::Add(a.im, b.im)};
+    }
+    template <typename T> inline CPack<T> operator-(const CPack<T>& a, const CPack<T>& b) {
+      typedef simd::Pack<T> V;
+      return {V::Sub(a.re, b.re), V::Sub(a.im, b.im)};
+    }
+    template <typename T> inline CPack<T> operator*(const CPack<T>& a, const CPack<T>& b) {
+      typedef simd::Pack<T> V;
+      return {V::Sub(V::Mul(a.re, b.re), V::Mul(a.im, b.im)),
+              V::Add(V::Mul(a.re, b.im), V::Mul(a.im, b.re))};
+    }
+    // Product by a real number in each lane
+    template <typename T> inline CPack<T> operator*(const typename simd::Pack<T>::type& a, const CPack<T>& b) {
+      typedef simd::Pack<T> V;
+      return {V::Mul(a, b.re), V::Mul(a, b.im)};
+    }
+    // Division scaled by |b.re| + |b.im|, so that |b|^2 does not overflow for the
+    // large values of Zeta (std::complex does the same)
+    template <typename T> inline CPack<T> operator/(const CPack<T>& a, const CPack<T>& b) {
+      typedef simd::Pack<T> V;
+      const typename V::type r = V::Div(V::Set1(1.0), V::Add(V::Abs(b.re), V::Abs(b.im)));
+      const typename V::type br = V::Mul(b.re, r), bi = V::Mul(b.im, r);
+      const typename V::type d = V::Div(r, V::Add(V::Mul(br, br), V::Mul(bi, bi)));
+      return {V::Mul(V::Add(V::Mul(a.re, br), V::Mul(a.im, bi)), d),
+              V::Mul(V::Sub(V::Mul(a.im, br), V::Mul(a.re, bi)), d)};
+    }
+
+    // Value of lane k of element n of a lane array
+    template <typename T> inline std::complex<T> GetLane(const T *a, int n, int k) {
+      const int K = simd::Pack<T>::kLanes;
+      return std::complex<T>(a[2*n*K + k], a[(2*n + 1)*K + k]);
+    }
+    template <typename T> inline void SetLane(T *a, int n, int k, std::complex<T> value) {
+      const int K = simd::Pack<T>::kLanes;
+      a[2*n*K + k] = value.real();
+      a[(2*n + 1)*K + k] = value.imag();
+    }
+  }  // end of namespace NMIE_SIMD_ISA
+
+    // Same as above for arrays of a number of lanes only known at run time
+    template <typename T> inline std::complex<T> GetLane(const T *a, int lanes, int n, int k) {
+      return std::complex<T>(a[2*n*lanes + k], a[(2*n + 1)*lanes + k]);
+    }
+    template <typename T> inline void SetLane(T *a, int lanes, int n, int k, std::complex<T> value) {
+      a[2*n*lanes + k] = value.real();
+      a[(2*n + 1)*lanes + k] = value.imag();
+    }
+  }  // end of namespace simd
+}  // end of namespace nmie
+#endif  // SRC_NMIE_SIMD_H_
@@ -0,0 +1,308 @@
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+#include "nmie-surrogate.h"
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace nmie {
+  namespace {
+    // ******************************************************************** //
+    // Right singular vector of the smallest singular value of the          //
+    // rows x cols matrix A (stored by columns and overwritten), rows >=    //
+    // cols. A is first reduced to its triangular factor R with Householder //
+    // reflections, then R is diagonalized with one-sided Jacobi rotations, //
+    // which find the small singular values to high relative accuracy.      //
+    // ******************************************************************** //
+    std::vector<double> MinRightSingularVector(std::vector<double>& A, unsigned long rows,
+                                               unsigned int cols) {
+      for (unsigned int c = 0; c < cols; c++) {
+        double* a = &A[c*rows];
+        double norm = 0.0;
+        for (unsigned long r = c; r < rows; r++) norm += a[r]*a[r];
+        norm = std::sqrt(norm);
+        if (norm == 0.0) continue;
+        const double alpha = a[c] > 0.0 ? -norm : norm;
+        // v = a[c..rows) - alpha*e_c is stored in place, H = I - 2 v v^T/(v^T v)
+        const double vv = 2.0*norm*(norm + std::abs(a[c]));
+        a[c] -= alpha;
+        for (unsigned int c2 = c + 1; c2 < cols; c2++) {
+          double* b = &A[c2*rows];
+          double dot = 0.0;
+          for (unsigned long r = c; r < rows; r++) dot += a[r]*b[r];
+          dot *= 2.0/vv;
+          for (unsigned long r = c; r < rows; r++) b[r] -= dot*a[r];
+        }
+        a[c] = alpha;
+      }
+      // Upper triangle of the reduced matrix
+      std::vector<double> R(cols*cols, 0.0), V(cols*cols, 0.0);
+      for (unsigned int c = 0; c < cols; c++) {
+        for (unsigned int r = 0; r <= c; r++) R[c*cols + r] = A[c*rows + r];
+        V[c*cols + c] = 1.0;
+      }
+      const double eps = std::numeric_limits<double>::epsilon();
+      for (int sweep = 0; sweep < 100; sweep++) {
+        bool rotated = false;
+        for (unsigned int p = 0; p + 1 < cols; p++) {
+          for (unsigned int q = p + 1; q < cols; q++) {
+            double* ap = &R[p*cols];
+            double* aq = &R[q*cols];
+            double alpha = 0.0, beta = 0.0, gamma = 0.0;
+            for (unsigned int r = 0; r < cols; r++) {
+              alpha += ap[r]*ap[r];
+              beta += aq[r]*aq[r];
+              gamma += ap[r]*aq[r];
+            }
+            if (std::abs(gamma) <= eps*std::sqrt(alpha*beta)) continue;
+            rotated = true;
+            const double zeta = (beta - alpha)/(2.0*gamma);
+            const double t = std::copysign(1.0, zeta)/(std::abs(zeta) + std::sqrt(1.0 + zeta*zeta));
+            const double c = 1.0/std::sqrt(1.0 + t*t), s = c*t;
+            double* vp = &V[p*cols];
+            double* vq = &V[q*cols];
+            for (unsigned int r = 0; r < cols; r++) {
+              const double rp = ap[r], rq = aq[r];
+              ap[r] = c*rp - s*rq;
+              aq[r] = s*rp + c*rq;
+              const double wp = vp[r], wq = vq[r];
+              vp[r] = c*wp - s*wq;
+              vq[r] = s*wp + c*wq;
+            }
+          }
+        }
+        if (!rotated) break;
+      }
+      // The singular values are the norms of the columns
+      unsigned int min_col = 0;
+      double min_norm = std::numeric_limits<double>::infinity();
+      for (unsigned int c = 0; c < cols; c++) {
+        double norm = 0.0;
+        for (unsigned int r = 0; r < cols; r++) norm += R[c*cols + r]*R[c*cols + r];
+        if (norm < min_norm) {
+          min_norm = norm;
+          min_col = c;
+        }
+      }
+      return std::vector<double>(&V[min_col*cols], &V[min_col*cols] + cols);
+    }
+  }  // end of anonymous namespace
+
+
+  // ********************************************************************** //
+  // AAA fit. Each step adds as support point the sample with the largest   //
+  // error, then the weights are the right singular vector of the smallest  //
+  // singular value of the Loewner matrix (F_i - f_j)/(Z_i - z_j) of the    //
+  // remaining samples, stacked for the four efficiencies.                  //
+  // ********************************************************************** //
+  void SpectrumSurrogate::Fit(const std::vector<double>& spectra, double tolerance,
+                              unsigned int max_terms) {
+    if (!(tolerance > 0.0))
+      throw std::invalid_argument("Tolerance should be positive!");
+    // Valid samples sorted by wavelength, without repetitions
+    std::vector< std::array<double, 5> > samples;
+    for (unsigned long i = 0; i < spectra.size()/5; i++) {
+      std::array<double, 5> row;
+      bool valid = true;
+      for (int j = 0; j < 5; j++) {
+        row[j] = spectra[5*i + j];
+        valid = valid && std::isfinite(row[j]);
+      }
+      if (valid) samples.push_back(row);
+    }
+    std::sort(samples.begin(), samples.end());
+    samples.erase(std::unique(samples.begin(), samples.end(),
+                              [](const std::array<double, 5>& a, const std::array<double, 5>& b) {
+                                return a[0] == b[0];
+                              }), samples.end());
+    if (samples.empty())
+      throw std::invalid_argument("Spectrum has no valid samples!");
+    const unsigned long M = samples.size();
+    from_WL_ = samples.front()[0];
+    to_WL_ = samples.back()[0];
+    double scale = 0.0;
+    for (const auto& row : samples)
+      for (int k = 1; k < 5; k++) scale = std::max(scale, std::abs(row[k]));
+
+    // Start from the mean value
+    std::vector< std::array<double, 4> > approx(M, std::array<double, 4>{{0.0, 0.0, 0.0, 0.0}});
+    for (const auto& row : samples)
+      for (int k = 0; k < 4; k++) approx[0][k] += row[k + 1]/M;
+    for (auto& value : approx) value = approx[0];
+    std::vector<bool> is_support(M, false);
+    std::vector<unsigned long> support, others;
+    support_WL_.clear();
+    weight_.clear();
+    support_Q_.clear();
+    fit_error_ = 0.0;
+    validation_error_ = 0.0;
+    // More terms than half the samples would not leave enough samples to fit them
+    max_terms = std::max(1u, std::min<unsigned int>(max_terms, (M + 1)/2));
+    while (true) {
+      // Sample with the largest error
+      unsigned long worst = M;
+      fit_error_ = 0.0;
+      for (unsigned long i = 0; i < M; i++) {
+        if (is_support[i]) continue;
+        for (int k = 0; k < 4; k++) {
+          const double err = std::abs(samples[i][k + 1] - approx[i][k]);
+          if (worst == M || err > fit_error_) {
+            fit_error_ = err;
+            worst = i;
+          }
+        }
+      }
+      if (worst == M || (!support.empty() && fit_error_ <= tolerance*scale)
+          || support.size() == max_terms) break;
+      is_support[worst] = true;
+      support.push_back(worst);
+      others.clear();
+      for (unsigned long i = 0; i < M; i++)
+        if (!is_support[i]) others.push_back(i);
+
+      const unsigned int m = support.size();
+      const unsigned long rows = 4*others.size();
+      std::vector<double> weight(m, 1.0);
+      if (rows >= m) {
+        std::vector<double> A(rows*m);
+        for (unsigned int j = 0; j < m; j++) {
+          const auto& s = samples[support[j]];
+          for (unsigned long i = 0; i < others.size(); i++) {
+            const auto& f = samples[others[i]];
+            const double cauchy = 1.0/(f[0] - s[0]);
+            for (int k = 0; k < 4; k++) A[j*rows + 4*i + k] = (f[k + 1] - s[k + 1])*cauchy;
+          }
+        }
+        weight = MinRightSingularVector(A, rows, m);
+      }
+      support_WL_.resize(m);
+      weight_ = weight;
+      support_Q_.resize(m);
+      for (unsigned int j = 0; j < m; j++) {
+        support_WL_[j] = samples[support[j]][0];
+        for (int k = 0; k < 4; k++) support_Q_[j][k] = samples[support[j]][k + 1];
+      }
+      for (auto i : others) approx[i] = Evaluate(samples[i][0]);
+    }
+  }
+
+
+  // ********************************************************************** //
+  // Largest error on the (valid) rows of spectra                           //
+  // ********************************************************************** //
+  double SpectrumSurrogate::Validate(const std::vector<double>& spectra) {
+    double error = 0.0;
+    for (unsigned long i = 0; i < spectra.size()/5; i++) {
+      const double* row = &spectra[5*i];
+      const auto Q = Evaluate(row[0]);
+      for (int k = 0; k < 4; k++)
+        if (std::isfinite(row[k + 1])) error = std::max(error, std::abs(row[k + 1] - Q[k]));
+    }
+    validation_error_ = std::max(validation_error_, error);
+    return error;
+  }
+
+
+  // ********************************************************************** //
+  // Barycentric formula r = sum(w_j f_j/(WL - z_j))/sum(w_j/(WL - z_j))    //
+  // ********************************************************************** //
+  std::array<double, 4> SpectrumSurrogate::Evaluate(double WL) const {
+    double N0 = 0.0, N1 = 0.0, N2 = 0.0, N3 = 0.0, D = 0.0;
+    for (unsigned int j = 0; j < support_WL_.size(); j++) {
+      const double diff = WL - support_WL_[j];
+      if (diff == 0.0) return support_Q_[j];
+      const double c = weight_[j]/diff;
+      const auto& f = support_Q_[j];
+      D += c;
+      N0 += c*f[0];
+      N1 += c*f[1];
+      N2 += c*f[2];
+      N3 += c*f[3];
+    }
+    return std::array<double, 4>{{N0/D, N1/D, N2/D, N3/D}};
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  void SpectrumSurrogate::Evaluate(const std::vector<double>& WLs,
+                                   std::vector<double>& spectra) const {
+    spectra.resize(5*WLs.size());
+    for (unsigned long i = 0; i < WLs.size(); i++) {
+      const auto Q = Evaluate(WLs[i]);
+      spectra[5*i] = WLs[i];
+      for (int k = 0; k < 4; k++) spectra[5*i + k + 1] = Q[k];
+    }
+  }
+
+
+  // ********************************************************************** //
+  // Text format: a header line with the format version, the range and the  //
+  // errors, then one line {WL, weight, Qext, Qsca, Qabs, Qbk} per term.    //
+  // ********************************************************************** //
+  void SpectrumSurrogate::Save(std::ostream& out) const {
+    const auto precision = out.precision(17);
+    out << "scattnlay-surrogate 1 " << support_WL_.size() << " " << from_WL_ << " " << to_WL_
+        << " " << fit_error_ << " " << validation_error_ << "\n";
+    for (unsigned int j = 0; j < support_WL_.size(); j++) {
+      out << support_WL_[j] << " " << weight_[j];
+      for (int k = 0; k < 4; k++) out << " " << support_Q_[j][k];
+      out << "\n";
+    }
+    out.precision(precision);
+  }
+
+
+  // ********************************************************************** //
+  // ********************************************************************** //
+  // ********************************************************************** //
+  void SpectrumSurrogate::Load(std::istream& in) {
+    std::string magic;
+    int version = 0;
+    unsigned int terms = 0;
+    in >> magic >> version >> terms;
+    if (!in || magic != "scattnlay-surrogate")
+      throw std::invalid_argument("Input is not a spectrum surrogate!");
+    if (version != 1)
+      throw std::invalid_argument("Unsupported spectrum surrogate version!");
+    SpectrumSurrogate surrogate;
+    in >> surrogate.from_WL_ >> surrogate.to_WL_ >> surrogate.fit_error_
+       >> surrogate.validation_error_;
+    surrogate.support_WL_.resize(terms);
+    surrogate.weight_.resize(terms);
+    surrogate.support_Q_.resize(terms);
+    for (unsigned int j = 0; j < terms; j++) {
+      in >> surrogate.support_WL_[j] >> surrogate.weight_[j];
+      for (int k = 0; k < 4; k++) in >> surrogate.support_Q_[j][k];
+    }
+    if (!in)
+      throw std::invalid_argument("Spectrum surrogate is truncated!");
+    *this = surrogate;
+  }
+}  // end of namespace nmie
@@ -0,0 +1,84 @@
+#ifndef SRC_NMIE_SURROGATE_H_
+#define SRC_NMIE_SURROGATE_H_
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <vector>
+
+namespace nmie {
+  //**********************************************************************************//
+  // Rational approximation of the efficiencies Qext, Qsca, Qabs and Qbk as functions //
+  // of the wavelength, fitted to calculated spectra with the AAA algorithm:          //
+  //                                                                                  //
+  //   Y. Nakatsukasa, O. Sete and L. N. Trefethen, "The AAA algorithm for rational   //
+  //   approximation," SIAM J. Sci. Comput. 40 (2018) A1494-A1522.                    //
+  //                                                                                  //
+  // The four efficiencies share the support wavelengths and weights of a single      //
+  // barycentric formula, so that an evaluation costs one pass over the support.      //
+  // The fit error is measured on the fitted samples; Validate() measures the error   //
+  // on spectra that were not used for the fit (e.g. the midpoints of the samples).   //
+  // The approximation is only meaningful inside the fitted wavelength range.         //
+  //**********************************************************************************//
+  class SpectrumSurrogate {
+   public:
+    // Fit the rows {WL, Qext, Qsca, Qabs, Qbk} of spectra (as returned by
+    // MultiLayerMieApplied::GetSpectra) until the largest error on the samples is
+    // below tolerance*(largest efficiency) or max_terms support points are used.
+    // Rows with NaN efficiencies are ignored.
+    void Fit(const std::vector<double>& spectra, double tolerance, unsigned int max_terms = 100);
+    // Largest error of the surrogate on the rows of spectra, also kept as part of
+    // the error estimate
+    double Validate(const std::vector<double>& spectra);
+
+    // Efficiencies {Qext, Qsca, Qabs, Qbk} at wavelength WL
+    std::array<double, 4> Evaluate(double WL) const;
+    // Rows {WL, Qext, Qsca, Qabs, Qbk} for each wavelength of WLs
+    void Evaluate(const std::vector<double>& WLs, std::vector<double>& spectra) const;
+
+    unsigned int GetTerms() const {return support_WL_.size();};
+    double GetFitError() const {return fit_error_;};
+    double GetValidationError() const {return validation_error_;};
+    // Largest absolute error of the efficiencies on all the checked samples
+    double GetErrorEstimate() const {return std::max(fit_error_, validation_error_);};
+    double GetFromWL() const {return from_WL_;};
+    double GetToWL() const {return to_WL_;};
+
+    // Text serialization; Load throws std::invalid_argument for malformed input
+    void Save(std::ostream& out) const;
+    void Load(std::istream& in);
+
+   private:
+    std::vector<double> support_WL_, weight_;
+    std::vector< std::array<double, 4> > support_Q_;
+    double from_WL_ = 0.0, to_WL_ = 0.0;
+    double fit_error_ = 0.0, validation_error_ = 0.0;
+  };  // end of class SpectrumSurrogate
+}  // end of namespace nmie
+#endif  // SRC_NMIE_SURROGATE_H_
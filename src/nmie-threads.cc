@@ -0,0 +1,166 @@
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+#include "nmie-threads.h"
+#include <algorithm>
+
+namespace nmie {
+  namespace {
+    // Pool whose chunk the current thread is running (null if none) and index
+    // of the thread in that pool
+    thread_local const ThreadPool* current_pool = nullptr;
+    thread_local unsigned int current_thread = 0;
+  }
+
+
+  // ********************************************************************** //
+  // Start the worker threads                                               //
+  // ********************************************************************** //
+  ThreadPool::ThreadPool(unsigned int threads) : next_(0) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int i = 1; i < threads; i++)
+      workers_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+  }
+
+
+  // ********************************************************************** //
+  // Stop the worker threads                                                //
+  // ********************************************************************** //
+  ThreadPool::~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& worker : workers_) worker.join();
+  }
+
+
+  // ********************************************************************** //
+  // Pool shared by the whole process                                       //
+  // ********************************************************************** //
+  ThreadPool& ThreadPool::Shared() {
+    static ThreadPool pool;
+    return pool;
+  }
+
+
+  // ********************************************************************** //
+  // Wait for a loop, run its chunks and wait for the next one              //
+  // ********************************************************************** //
+  void ThreadPool::WorkerLoop(unsigned int thread) {
+    unsigned long generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [&] {return stop_ || generation_ != generation;});
+        if (stop_) return;
+        generation = generation_;
+      }
+      RunChunks(thread);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--running_ == 0) done_.notify_one();
+      }
+    }
+  }
+
+
+  // ********************************************************************** //
+  // Take chunks of the current loop until none is left                     //
+  // ********************************************************************** //
+  void ThreadPool::RunChunks(unsigned int thread) {
+    current_pool = this;
+    current_thread = thread;
+    unsigned long first;
+    while ((first = next_.fetch_add(chunk_)) < n_) {
+      try {
+        (*task_)(first, std::min(chunk_, n_ - first), thread);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) error_ = std::current_exception();
+        next_ = n_;  // Skip the remaining chunks
+      }
+    }
+    current_pool = nullptr;
+  }
+
+
+  // ********************************************************************** //
+  // Run the task for all the chunks of [0, n)                              //
+  // ********************************************************************** //
+  void ThreadPool::ParallelFor(unsigned long n, unsigned long chunk, const Task& task) {
+    if (n == 0) return;
+    if (chunk == 0) chunk = std::max(1ul, n/(4*GetThreadCount()));
+
+    // Nested loops run in the calling thread, which keeps its index in this
+    // pool. Threads of other pools may have indexes beyond the size of this
+    // one, so they use 0.
+    if (current_pool != nullptr) {
+      const unsigned int thread = current_pool == this ? current_thread : 0;
+      for (unsigned long first = 0; first < n; first += chunk)
+        task(first, std::min(chunk, n - first), thread);
+      return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    // Single-threaded pools and loops of a single chunk
+    if (workers_.empty() || n <= chunk) {
+      current_pool = this;
+      current_thread = 0;
+      try {
+        for (unsigned long first = 0; first < n; first += chunk)
+          task(first, std::min(chunk, n - first), 0);
+      } catch (...) {
+        current_pool = nullptr;
+        throw;
+      }
+      current_pool = nullptr;
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      task_ = &task;
+      n_ = n;
+      chunk_ = chunk;
+      next_ = 0;
+      error_ = nullptr;
+      running_ = workers_.size();
+      ++generation_;
+    }
+    start_.notify_all();
+    RunChunks(0);
+    std::exception_ptr error;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_.wait(lock, [&] {return running_ == 0;});
+      task_ = nullptr;
+      error = error_;
+    }
+    if (error) std::rethrow_exception(error);
+  }
+}  // end of namespace nmie
@@ -0,0 +1,87 @@
+#ifndef SRC_NMIE_THREADS_H_
+#define SRC_NMIE_THREADS_H_
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nmie {
+  //**********************************************************************************//
+  // Fixed set of worker threads to run parallel loops. The calling thread works too, //
+  // so a pool of N threads starts N - 1 of them (none for N = 1). Each thread has an //
+  // index in [0, GetThreadCount()), which can be used to select per-thread scratch   //
+  // memory (e.g. a MieContext). Loops started from inside a running loop are         //
+  // executed serially by the calling thread, with its index if the running loop      //
+  // belongs to the same pool and with index 0 otherwise.                             //
+  //**********************************************************************************//
+  class ThreadPool {
+   public:
+    // Task for the elements [first, first + count) executed by thread 'thread'
+    typedef std::function<void(unsigned long first, unsigned long count, unsigned int thread)> Task;
+
+    // threads = 0 uses one thread per hardware thread
+    explicit ThreadPool(unsigned int threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Split [0, n) in chunks of at most 'chunk' elements (0 for an automatic
+    // value) and run the task for all of them. Returns when all the chunks are
+    // done; the first exception thrown by a task is rethrown here.
+    void ParallelFor(unsigned long n, unsigned long chunk, const Task& task);
+    unsigned int GetThreadCount() const {return workers_.size() + 1;};
+
+    // Pool shared by the whole process (one thread per hardware thread)
+    static ThreadPool& Shared();
+
+   private:
+    void WorkerLoop(unsigned int thread);
+    void RunChunks(unsigned int thread);
+
+    std::vector<std::thread> workers_;
+    // Serializes the loops started from different threads
+    std::mutex run_mutex_;
+    std::mutex mutex_;
+    std::condition_variable start_, done_;
+    unsigned long generation_ = 0;
+    unsigned int running_ = 0;
+    bool stop_ = false;
+
+    // Current loop
+    const Task *task_ = nullptr;
+    unsigned long n_ = 0, chunk_ = 1;
+    std::atomic<unsigned long> next_;
+    std::exception_ptr error_;
+  };  // end of class ThreadPool
+}  // end of namespace nmie
+#endif  // SRC_NMIE_THREADS_H_
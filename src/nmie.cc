@@ -38,10 +38,14 @@
 // Hereinafter all equations numbers refer to [2]                                   //
 //**********************************************************************************//
 #include "nmie.h"
+#include "nmie-simd.h"
+#include "nmie-field-lanes.h"
 #include <array>
 #include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <stdexcept>
 #include <vector>
 
@@ -53,6 +57,38 @@ namespace nmie {
   }
 
 
+  namespace simd {
+    // Widest field kernel supported by the CPU, see nmie-field-lanes.h. Only
+    // float and double have kernels for other instruction sets.
+    template <typename T> FieldKernel<T> SelectFieldKernel() {return MakeFieldKernel<T>();}
+
+    template <typename T> FieldKernel<T> SelectX86FieldKernel() {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+      const char* limit = std::getenv("SCATTNLAY_SIMD");
+      if (limit != nullptr && std::strcmp(limit, "default") == 0) return MakeFieldKernel<T>();
+      FieldKernel<T> kernel = {0, nullptr, nullptr, nullptr};
+      __builtin_cpu_init();
+      if ((limit == nullptr || std::strcmp(limit, "avx2") != 0) && __builtin_cpu_supports("avx512f"))
+        kernel = FieldKernelAVX512<T>();
+      if (kernel.lanes == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        kernel = FieldKernelAVX2<T>();
+      if (kernel.lanes > Pack<T>::kLanes) return kernel;
+#endif
+      return MakeFieldKernel<T>();
+    }
+    template <> FieldKernel<float> SelectFieldKernel<float>() {return SelectX86FieldKernel<float>();}
+    template <> FieldKernel<double> SelectFieldKernel<double>() {return SelectX86FieldKernel<double>();}
+
+    template <typename T> const FieldKernel<T>& GetFieldKernel() {
+      static const FieldKernel<T> kernel = SelectFieldKernel<T>();
+      return kernel;
+    }
+    template const FieldKernel<float>& GetFieldKernel<float>();
+    template const FieldKernel<double>& GetFieldKernel<double>();
+    template const FieldKernel<long double>& GetFieldKernel<long double>();
+  }  // end of namespace simd
+
+
   //**********************************************************************************//
   // This function emulates a C call to calculate the scattering coefficients         //
   // required to calculate both the near- and far-field parameters.                   //
@@ -77,7 +113,9 @@ namespace nmie {
     if (x.size() != L || m.size() != L)
         throw std::invalid_argument("Declared number of layers do not fit x and m!");
     try {
-      MultiLayerMie ml_mie;
+      // The object is reused by consecutive calls from the same thread, so
+      // its scratch buffers are allocated only once.
+      thread_local MultiLayerMie ml_mie;
       ml_mie.SetLayersSize(x);
       ml_mie.SetLayersIndex(m);
       ml_mie.SetPECLayer(pl);
@@ -134,7 +172,9 @@ namespace nmie {
     if (Theta.size() != nTheta)
         throw std::invalid_argument("Declared number of sample for Theta is not correct!");
     try {
-      MultiLayerMie ml_mie;
+      // The object is reused by consecutive calls from the same thread, so
+      // its scratch buffers are allocated only once.
+      thread_local MultiLayerMie ml_mie;
       ml_mie.SetLayersSize(x);
       ml_mie.SetLayersIndex(m);
       ml_mie.SetAngles(Theta);
@@ -320,9 +360,11 @@ namespace nmie {
   // ********************************************************************** //
   // Returns previously calculated Qext                                     //
   // ********************************************************************** //
-  double MultiLayerMie::GetQext() {
+  template <typename FloatType>
+  FloatType BasicMieContext<FloatType>::GetQext() const {
     if (!isMieCalculated_)
       throw std::invalid_argument("You should run calculations before result request!");
+    checkRequested(kEfficiencies);
     return Qext_;
   }
 
@@ -330,9 +372,11 @@ namespace nmie {
   // ********************************************************************** //
   // Returns previously calculated Qabs                                     //
   // ********************************************************************** //
-  double MultiLayerMie::GetQabs() {
+  template <typename FloatType>
+  FloatType BasicMieContext<FloatType>::GetQabs() const {
     if (!isMieCalculated_)
       throw std::invalid_argument("You should run calculations before result request!");
+    checkRequested(kEfficiencies);
     return Qabs_;
   }
 
@@ -340,9 +384,11 @@ namespace nmie {
   // ********************************************************************** //
   // Returns previously calculated Qsca                                     //
   // ********************************************************************** //
-  double MultiLayerMie::GetQsca() {
+  template <typename FloatType>
+  FloatType BasicMieContext<FloatType>::GetQsca() const {
     if (!isMieCalculated_)
       throw std::invalid_argument("You should run calculations before result request!");
+    checkRequested(kEfficiencies);
     return Qsca_;
   }
 
@@ -350,9 +396,11 @@ namespace nmie {
   // ********************************************************************** //
   // Returns previously calculated Qbk                                      //
   // ********************************************************************** //
-  double MultiLayerMie::GetQbk() {
+  template <typename FloatType>
+  FloatType BasicMieContext<FloatType>::GetQbk() const {
     if (!isMieCalculated_)
       throw std::invalid_argument("You should run calculations before result request!");
+    checkRequested(kBackscattering);
     return Qbk_;
   }
 
@@ -360,9 +408,11 @@ namespace nmie {
   // ********************************************************************** //
   // Returns previously calculated Qpr                                      //
   // ********************************************************************** //
-  double MultiLayerMie::GetQpr() {
+  template <typename FloatType>
+  FloatType BasicMieContext<FloatType>::GetQpr() const {
     if (!isMieCalculated_)
       throw std::invalid_argument("You should run calculations before result request!");
+    checkRequested(kRadiationPressure);
     return Qpr_;
   }
 
@@ -370,9 +420,11 @@ namespace nmie {
   // ********************************************************************** //
   // Returns previously calculated assymetry factor                         //
   // ********************************************************************** //
-  double MultiLayerMie::GetAsymmetryFactor() {
+  template <typename FloatType>
+  FloatType BasicMieContext<FloatType>::GetAsymmetryFactor() const {
     if (!isMieCalculated_)
       throw std::invalid_argument("You should run calculations before result request!");
+    checkRequested(kRadiationPressure);
     return asymmetry_factor_;
   }
 
@@ -380,9 +432,11 @@ namespace nmie {
   // ********************************************************************** //
   // Returns previously calculated Albedo                                   //
   // ********************************************************************** //
-  double MultiLayerMie::GetAlbedo() {
+  template <typename FloatType>
+  FloatType BasicMieContext<FloatType>::GetAlbedo() const {
     if (!isMieCalculated_)
       throw std::invalid_argument("You should run calculations before result request!");
+    checkRequested(kEfficiencies);
     return albedo_;
   }
 
@@ -390,9 +444,11 @@ namespace nmie {
   // ********************************************************************** //
   // Returns previously calculated S1                                       //
   // ********************************************************************** //
-  std::vector<std::complex<double> > MultiLayerMie::GetS1() {
+  template <typename FloatType>
+  const std::vector<std::complex<FloatType> >& BasicMieContext<FloatType>::GetS1() const {
     if (!isMieCalculated_)
       throw std::invalid_argument("You should run calculations before result request!");
+    checkRequested(kAmplitudes);
     return S1_;
   }
 
@@ -400,18 +456,93 @@ namespace nmie {
   // ********************************************************************** //
   // Returns previously calculated S2                                       //
   // ********************************************************************** //
-  std::vector<std::complex<double> > MultiLayerMie::GetS2() {
+  template <typename FloatType>
+  const std::vector<std::complex<FloatType> >& BasicMieContext<FloatType>::GetS2() const {
     if (!isMieCalculated_)
       throw std::invalid_argument("You should run calculations before result request!");
+    checkRequested(kAmplitudes);
     return S2_;
   }
 
 
+  // ********************************************************************** //
+  // Returns previously calculated S1 and S2 for Theta = 180 deg            //
+  // ********************************************************************** //
+  template <typename FloatType>
+  std::complex<FloatType> BasicMieContext<FloatType>::GetS1Backward() const {
+    if (!isMieCalculated_)
+      throw std::invalid_argument("You should run calculations before result request!");
+    checkRequested(kBackscattering);
+    return S1_back_;
+  }
+
+
+  template <typename FloatType>
+  std::complex<FloatType> BasicMieContext<FloatType>::GetS2Backward() const {
+    if (!isMieCalculated_)
+      throw std::invalid_argument("You should run calculations before result request!");
+    checkRequested(kBackscattering);
+    return S2_back_;
+  }
+
+
+  // ********************************************************************** //
+  // Check that the result was requested in the output mask                 //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMieContext<FloatType>::checkRequested(unsigned int output) const {
+    if (!(output_mask_ & output))
+      throw std::invalid_argument("This result was not requested! Check the output mask.");
+  }
+
+
+  // ********************************************************************** //
+  // Returns results of the last calculation done without an explicit      //
+  // evaluation context                                                     //
+  // ********************************************************************** //
+  template <typename FloatType>
+  FloatType BasicMultiLayerMie<FloatType>::GetQext() {return ctx_.GetQext();}
+  template <typename FloatType>
+  FloatType BasicMultiLayerMie<FloatType>::GetQabs() {return ctx_.GetQabs();}
+  template <typename FloatType>
+  FloatType BasicMultiLayerMie<FloatType>::GetQsca() {return ctx_.GetQsca();}
+  template <typename FloatType>
+  FloatType BasicMultiLayerMie<FloatType>::GetQbk() {return ctx_.GetQbk();}
+  template <typename FloatType>
+  FloatType BasicMultiLayerMie<FloatType>::GetQpr() {return ctx_.GetQpr();}
+  template <typename FloatType>
+  FloatType BasicMultiLayerMie<FloatType>::GetAsymmetryFactor() {return ctx_.GetAsymmetryFactor();}
+  template <typename FloatType>
+  FloatType BasicMultiLayerMie<FloatType>::GetAlbedo() {return ctx_.GetAlbedo();}
+  template <typename FloatType>
+  const std::vector<std::complex<FloatType> >& BasicMultiLayerMie<FloatType>::GetS1() {return ctx_.GetS1();}
+  template <typename FloatType>
+  const std::vector<std::complex<FloatType> >& BasicMultiLayerMie<FloatType>::GetS2() {return ctx_.GetS2();}
+  template <typename FloatType>
+  std::complex<FloatType> BasicMultiLayerMie<FloatType>::GetS1Backward() {return ctx_.GetS1Backward();}
+  template <typename FloatType>
+  std::complex<FloatType> BasicMultiLayerMie<FloatType>::GetS2Backward() {return ctx_.GetS2Backward();}
+
+
+  // ********************************************************************** //
+  // Mark results of the context as uncalculated                            //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMieContext<FloatType>::MarkUncalculated() {
+    isExpCoeffsCalc_ = false;
+    isScaCoeffsCalc_ = false;
+
+    isMieCalculated_ = false;
+  }
+
+
   // ********************************************************************** //
   // Modify scattering (theta) angles                                       //
   // ********************************************************************** //
-  void MultiLayerMie::SetAngles(const std::vector<double>& angles) {
-    MarkUncalculated();
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::SetAngles(const std::vector<FloatType>& angles) {
+    // Angles do not change the scattering coefficients
+    ctx_.MarkUncalculated();
     theta_ = angles;
   }
 
@@ -419,10 +550,11 @@ namespace nmie {
   // ********************************************************************** //
   // Modify size of all layers                                             //
   // ********************************************************************** //
-  void MultiLayerMie::SetLayersSize(const std::vector<double>& layer_size) {
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::SetLayersSize(const std::vector<FloatType>& layer_size) {
     MarkUncalculated();
     size_param_.clear();
-    double prev_layer_size = 0.0;
+    FloatType prev_layer_size = 0.0;
     for (auto curr_layer_size : layer_size) {
       if (curr_layer_size <= 0.0)
         throw std::invalid_argument("Size parameter should be positive!");
@@ -438,7 +570,8 @@ namespace nmie {
   // ********************************************************************** //
   // Modify refractive index of all layers                                  //
   // ********************************************************************** //
-  void MultiLayerMie::SetLayersIndex(const std::vector< std::complex<double> >& index) {
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::SetLayersIndex(const std::vector< std::complex<FloatType> >& index) {
     MarkUncalculated();
     refractive_index_ = index;
   }
@@ -447,7 +580,8 @@ namespace nmie {
   // ********************************************************************** //
   // Modify coordinates for field calculation                               //
   // ********************************************************************** //
-  void MultiLayerMie::SetFieldCoords(const std::vector< std::vector<double> >& coords) {
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::SetFieldCoords(const std::vector< std::vector<FloatType> >& coords) {
     if (coords.size() != 3)
       throw std::invalid_argument("Error! Wrong dimension of field monitor points!");
     if (coords[0].size() != coords[1].size() || coords[0].size() != coords[2].size())
@@ -459,7 +593,8 @@ namespace nmie {
   // ********************************************************************** //
   // Modify index of PEC layer                                              //
   // ********************************************************************** //
-  void MultiLayerMie::SetPECLayer(int layer_position) {
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::SetPECLayer(int layer_position) {
     MarkUncalculated();
     if (layer_position < 0 && layer_position != -1)
       throw std::invalid_argument("Error! Layers are numbered from 0!");
@@ -470,16 +605,42 @@ namespace nmie {
   // ********************************************************************** //
   // Set maximun number of terms to be used                                 //
   // ********************************************************************** //
-  void MultiLayerMie::SetMaxTerms(int nmax) {
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::SetMaxTerms(int nmax) {
     MarkUncalculated();
     nmax_preset_ = nmax;
   }
 
 
+  // ********************************************************************** //
+  // Set tolerance for the truncation of the multipole series               //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::SetTolerance(FloatType tol) {
+    MarkUncalculated();
+    if (tol < 0.0 || tol >= 1.0)
+      throw std::invalid_argument("Error! Tolerance should be in [0, 1)!");
+    tolerance_ = tol;
+  }
+
+
+  // ********************************************************************** //
+  // Select the results to be calculated by RunMieCalculation (OutputMask)  //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::SetOutputMask(unsigned int mask) {
+    ctx_.MarkUncalculated();
+    if (mask == 0 || (mask & ~kAll))
+      throw std::invalid_argument("Error! Wrong output mask!");
+    output_mask_ = mask;
+  }
+
+
   // ********************************************************************** //
   // Get total size parameter of particle                                   //
   // ********************************************************************** //
-  double MultiLayerMie::GetSizeParameter() {
+  template <typename FloatType>
+  FloatType BasicMultiLayerMie<FloatType>::GetSizeParameter() {
     if (size_param_.size() > 0)
       return size_param_.back();
     else
@@ -489,16 +650,17 @@ namespace nmie {
   // ********************************************************************** //
   // Mark uncalculated                                                      //
   // ********************************************************************** //
-  void MultiLayerMie::MarkUncalculated() {
-    isExpCoeffsCalc_ = false;
-    isScaCoeffsCalc_ = false;
-
-    isMieCalculated_ = false;
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::MarkUncalculated() {
+    ctx_.MarkUncalculated();
+    // Coefficients stored in other contexts are outdated now
+    ++revision_;
   }
   // ********************************************************************** //
   // Clear layer information                                                //
   // ********************************************************************** //
-  void MultiLayerMie::ClearLayers() {
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::ClearLayers() {
     MarkUncalculated();
     size_param_.clear();
     refractive_index_.clear();
@@ -514,17 +676,38 @@ namespace nmie {
   // ********************************************************************** //
 
 
+  // ********************************************************************** //
+  // Grow the scratch buffers to fit nmax terms and L layers. Buffers never  //
+  // shrink, hence the memory is allocated only for a new maximum.           //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMieWorkspace<FloatType>::Reserve(int nmax, int L) {
+    if (nmax <= nmax_ && L <= L_) return;
+    nmax_ = std::max(nmax, nmax_);
+    L_ = std::max(L, L_);
+    const unsigned int size = nmax_ + 1;
+    for (auto v : {&PsiXL, &ZetaXL, &D1z, &D1z1, &D3z, &D3z1, &Psiz, &Psiz1, &Zetaz, &Zetaz1,
+                   &PsiZeta, &D1, &D3, &D1Rho, &D3Rho, &PsiRho, &ZetaRho})
+      v->resize(size);
+    for (auto v : {&Pi, &Tau})
+      v->resize(size);
+    for (auto v : {&D1_mlxl, &D1_mlxlM1, &D3_mlxl, &D3_mlxlM1, &Q, &Ha, &Hb})
+      v->resize(L_*size);
+  }
+
+
   // ********************************************************************** //
   // Calculate calcNstop - equation (17)                                    //
   // ********************************************************************** //
-  void MultiLayerMie::calcNstop() {
-    const double& xL = size_param_.back();
+  template <typename FloatType>
+  int BasicMultiLayerMie<FloatType>::calcNstop() const {
+    const FloatType& xL = size_param_.back();
     if (xL <= 8) {
-      nmax_ = round(xL + 4.0*pow(xL, 1.0/3.0) + 1);
+      return round(xL + 4.0*pow(xL, 1.0/3.0) + 1);
     } else if (xL <= 4200) {
-      nmax_ = round(xL + 4.05*pow(xL, 1.0/3.0) + 2);
+      return round(xL + 4.05*pow(xL, 1.0/3.0) + 2);
     } else {
-      nmax_ = round(xL + 4.0*pow(xL, 1.0/3.0) + 2);
+      return round(xL + 4.0*pow(xL, 1.0/3.0) + 2);
     }
   }
 
@@ -532,37 +715,43 @@ namespace nmie {
   // ********************************************************************** //
   // Maximum number of terms required for the calculation                   //
   // ********************************************************************** //
-  void MultiLayerMie::calcNmax(unsigned int first_layer) {
+  template <typename FloatType>
+  int BasicMultiLayerMie<FloatType>::calcNmax(unsigned int first_layer) const {
     int ri, riM1;
-    const std::vector<double>& x = size_param_;
-    const std::vector<std::complex<double> >& m = refractive_index_;
-    calcNstop();  // Set initial nmax_ value
+    const std::vector<FloatType>& x = size_param_;
+    const std::vector<std::complex<FloatType> >& m = refractive_index_;
+    int nmax = calcNstop();  // Set initial nmax value
     for (unsigned int i = first_layer; i < x.size(); i++) {
       if (static_cast<int>(i) > PEC_layer_position_)  // static_cast used to avoid warning
         ri = round(std::abs(x[i]*m[i]));
       else
         ri = 0;
-      nmax_ = std::max(nmax_, ri);
+      nmax = std::max(nmax, ri);
       // first layer is pec, if pec is present
       if ((i > first_layer) && (static_cast<int>(i - 1) > PEC_layer_position_))
         riM1 = round(std::abs(x[i - 1]* m[i]));
       else
         riM1 = 0;
-      nmax_ = std::max(nmax_, riM1);
+      nmax = std::max(nmax, riM1);
     }
-    nmax_ += 15;  // Final nmax_ value
+    // The downward recurrence for D1 starts from the exact value (calcD1confra),
+    // hence the extra terms are not needed for its stability. They are kept for
+    // the convergence of the near field (see also SetTolerance).
+    nmax += 15;  // Final nmax value
+    return nmax;
   }
 
 
   // ********************************************************************** //
   // Calculate an - equation (5)                                            //
   // ********************************************************************** //
-  std::complex<double> MultiLayerMie::calc_an(int n, double XL, std::complex<double> Ha, std::complex<double> mL,
-                                              std::complex<double> PsiXL, std::complex<double> ZetaXL,
-                                              std::complex<double> PsiXLM1, std::complex<double> ZetaXLM1) {
+  template <typename FloatType>
+  std::complex<FloatType> BasicMultiLayerMie<FloatType>::calc_an(int n, FloatType XL, std::complex<FloatType> Ha, std::complex<FloatType> mL,
+                                                                 std::complex<FloatType> PsiXL, std::complex<FloatType> ZetaXL,
+                                                                 std::complex<FloatType> PsiXLM1, std::complex<FloatType> ZetaXLM1) const {
 
-    std::complex<double> Num = (Ha/mL + n/XL)*PsiXL - PsiXLM1;
-    std::complex<double> Denom = (Ha/mL + n/XL)*ZetaXL - ZetaXLM1;
+    std::complex<FloatType> Num = (Ha/mL + n/XL)*PsiXL - PsiXLM1;
+    std::complex<FloatType> Denom = (Ha/mL + n/XL)*ZetaXL - ZetaXLM1;
 
     return Num/Denom;
   }
@@ -571,12 +760,13 @@ namespace nmie {
   // ********************************************************************** //
   // Calculate bn - equation (6)                                            //
   // ********************************************************************** //
-  std::complex<double> MultiLayerMie::calc_bn(int n, double XL, std::complex<double> Hb, std::complex<double> mL,
-                                              std::complex<double> PsiXL, std::complex<double> ZetaXL,
-                                              std::complex<double> PsiXLM1, std::complex<double> ZetaXLM1) {
+  template <typename FloatType>
+  std::complex<FloatType> BasicMultiLayerMie<FloatType>::calc_bn(int n, FloatType XL, std::complex<FloatType> Hb, std::complex<FloatType> mL,
+                                                                 std::complex<FloatType> PsiXL, std::complex<FloatType> ZetaXL,
+                                                                 std::complex<FloatType> PsiXLM1, std::complex<FloatType> ZetaXLM1) const {
 
-    std::complex<double> Num = (mL*Hb + n/XL)*PsiXL - PsiXLM1;
-    std::complex<double> Denom = (mL*Hb + n/XL)*ZetaXL - ZetaXLM1;
+    std::complex<FloatType> Num = (mL*Hb + n/XL)*PsiXL - PsiXLM1;
+    std::complex<FloatType> Denom = (mL*Hb + n/XL)*ZetaXL - ZetaXLM1;
 
     return Num/Denom;
   }
@@ -585,9 +775,10 @@ namespace nmie {
   // ********************************************************************** //
   // Calculates S1 - equation (25a)                                         //
   // ********************************************************************** //
-  std::complex<double> MultiLayerMie::calc_S1(int n, std::complex<double> an, std::complex<double> bn,
-                                              double Pi, double Tau) {
-    return double(n + n + 1)*(Pi*an + Tau*bn)/double(n*n + n);
+  template <typename FloatType>
+  std::complex<FloatType> BasicMultiLayerMie<FloatType>::calc_S1(int n, std::complex<FloatType> an, std::complex<FloatType> bn,
+                                                                 FloatType Pi, FloatType Tau) const {
+    return FloatType(n + n + 1)*(Pi*an + Tau*bn)/FloatType(n*n + n);
   }
 
 
@@ -595,82 +786,211 @@ namespace nmie {
   // Calculates S2 - equation (25b) (it's the same as (25a), just switches  //
   // Pi and Tau)                                                            //
   // ********************************************************************** //
-  std::complex<double> MultiLayerMie::calc_S2(int n, std::complex<double> an, std::complex<double> bn,
-                                              double Pi, double Tau) {
+  template <typename FloatType>
+  std::complex<FloatType> BasicMultiLayerMie<FloatType>::calc_S2(int n, std::complex<FloatType> an, std::complex<FloatType> bn,
+                                                                 FloatType Pi, FloatType Tau) const {
     return calc_S1(n, an, bn, Tau, Pi);
   }
 
 
+  //**********************************************************************************//
+  // Function CONFRA ported from MIEV0.f (Wiscombe,1979)
+  // Ref. to NCAR Technical Notes, Wiscombe, 1979
+  /*
+c         Compute Bessel function ratio A-sub-N from its
+c         continued fraction using Lentz method
+
+c         ZINV = Reciprocal of argument of A
+
+
+c    I N T E R N A L    V A R I A B L E S
+c    ------------------------------------
+
+c    CAK      Term in continued fraction expansion of A (Eq. R25)
+c     a_k
+
+c    CAPT     Factor used in Lentz iteration for A (Eq. R27)
+c     T_k
+
+c    CNUMER   Numerator   in capT  (Eq. R28A)
+c     N_k
+c    CDENOM   Denominator in capT  (Eq. R28B)
+c     D_k
+
+c    CDTD     Product of two successive denominators of capT factors
+c                 (Eq. R34C)
+c     xi_1
+
+c    CNTN     Product of two successive numerators of capT factors
+c                 (Eq. R34B)
+c     xi_2
+
+c    EPS1     Ill-conditioning criterion
+c    EPS2     Convergence criterion
+
+c    KK       Subscript k of cAk  (Eq. R25B)
+c     k
+
+c    KOUNT    Iteration counter (used to prevent infinite looping)
+
+c    MAXIT    Max. allowed no. of iterations
+
+c    MM + 1  and - 1, alternately
+*/
+  template <typename FloatType>
+  std::complex<FloatType> BasicMultiLayerMie<FloatType>::calcD1confra(const int N, const std::complex<FloatType> z) const {
+    int KK, KOUNT, MAXIT = 10000, MM;
+    //    FloatType EPS1=1.0e-2;
+    const FloatType EPS2 = 10*std::numeric_limits<FloatType>::epsilon();
+    std::complex<FloatType> CAK, CAPT, CDENOM, CDTD, CNTN, CNUMER;
+    std::complex<FloatType> one = std::complex<FloatType>(1.0,0.0);
+    std::complex<FloatType> ZINV = one/z;
+// c                                 ** Eq. R25a
+    std::complex<FloatType> CONFRA = static_cast<std::complex<FloatType> >(N + 1)*ZINV;   //debug ZINV
+    MM = - 1; 
+    KK = 2*N +3; //debug 3
+// c                                 ** Eq. R25b, k=2
+    CAK    = static_cast<std::complex<FloatType> >(MM*KK)*ZINV; //debug -3 ZINV
+    CDENOM = CAK;
+    CNUMER = CDENOM + one/CONFRA; //-3zinv+z
+    KOUNT  = 1;
+    //10 CONTINUE
+    do {      ++KOUNT;
+      if (KOUNT > MAXIT)
+        throw std::invalid_argument("ConFra--Iteration failed to converge!\n");
+      MM *= - 1;      KK += 2;  //debug  mm=1 kk=5
+      CAK = static_cast<std::complex<FloatType> >(MM*KK)*ZINV; //    ** Eq. R25b //debug 5zinv
+     //  //c ** Eq. R32    Ill-conditioned case -- stride two terms instead of one
+     //  if (std::abs(CNUMER/CAK) >= EPS1 ||  std::abs(CDENOM/CAK) >= EPS1) {
+     //         //c                       ** Eq. R34
+     //         CNTN   = CAK*CNUMER + 1.0;
+     //         CDTD   = CAK*CDENOM + 1.0;
+     //         CONFRA = (CNTN/CDTD)*CONFRA; // ** Eq. R33
+     //         MM  *= - 1;        KK  += 2;
+     //         CAK = static_cast<std::complex<FloatType> >(MM*KK)*ZINV; // ** Eq. R25b
+     //         //c                        ** Eq. R35
+     //         CNUMER = CAK + CNUMER/CNTN;
+     //         CDENOM = CAK + CDENOM/CDTD;
+     //         ++KOUNT;
+     //         //GO TO  10
+     //         continue;
+     // } else { //c                           *** Well-conditioned case
+      {
+        CAPT   = CNUMER/CDENOM; // ** Eq. R27 //debug (-3zinv + z)/(-3zinv)
+        // printf("re(%g):im(%g)**\t", CAPT.real(), CAPT.imag());
+       CONFRA = CAPT*CONFRA; // ** Eq. R26
+       //c                                  ** Check for convergence; Eq. R31
+       if (std::abs(CAPT.real() - 1.0) >= EPS2 ||  std::abs(CAPT.imag()) >= EPS2) {
+//c                                        ** Eq. R30
+         CNUMER = CAK + one/CNUMER;
+         CDENOM = CAK + one/CDENOM;
+         continue;
+         //GO TO  10
+       }  // end of if < eps2
+      }
+      break;
+    } while(1);    
+    //if (N == 0)  printf(" return confra for z=(%g,%g)\n", ZINV.real(), ZINV.imag());
+    return CONFRA;
+  }
+
+
+  // ********************************************************************** //
+  // Starting value of the downward recurrence for D1 at order N: the exact //
+  // value from the continued fraction, unless |z| is well above N (e.g.    //
+  // field points far from the particle). Then the continued fraction needs //
+  // about |z| - N iterations (and fails to converge for |z| of about 1e4), //
+  // so the recurrence starts from zero instead.                            //
+  // ********************************************************************** //
+  template <typename FloatType>
+  std::complex<FloatType> BasicMultiLayerMie<FloatType>::calcD1Start(const int N, const std::complex<FloatType> z) const {
+    if (std::abs(z) > FloatType(2*N)) return std::complex<FloatType>(0.0, 0.0);
+    return calcD1confra(N, z);
+  }
+
+
   //**********************************************************************************//
   // This function calculates the logarithmic derivatives of the Riccati-Bessel       //
-  // functions (D1 and D3) for a complex argument (z).                                //
-  // Equations (16a), (16b) and (18a) - (18d)                                         //
+  // functions (D1 and D3) and, optionally, the Riccati-Bessel functions (Psi and     //
+  // Zeta) for a complex argument (z). D1 is obtained with a downward recurrence,     //
+  // then D3, Psi and Zeta are obtained together in a single upward sweep.            //
+  // Equations (16a), (16b), (18a) - (18d) and (20a) - (21b)                          //
   //                                                                                  //
   // Input parameters:                                                                //
-  //   z: Complex argument to evaluate D1 and D3                                      //
-  //   nmax_: Maximum number of terms to calculate D1 and D3                          //
+  //   z: Complex argument to evaluate D1, D3, Psi and Zeta                           //
+  //   ctx.nmax_full_: Maximum number of terms to calculate D1, D3, Psi and Zeta      //
   //                                                                                  //
   // Output parameters:                                                               //
   //   D1, D3: Logarithmic derivatives of the Riccati-Bessel functions                //
+  //   Psi, Zeta: Riccati-Bessel functions (not calculated if Psi is nullptr)         //
+  //   ctx.ws_.PsiZeta: Product of Psi and Zeta                                       //
   //**********************************************************************************//
-  void MultiLayerMie::calcD1D3(const std::complex<double> z,
-                               std::vector<std::complex<double> >& D1,
-                               std::vector<std::complex<double> >& D3) {
-
-    // Downward recurrence for D1 - equations (16a) and (16b)
-    D1[nmax_] = std::complex<double>(0.0, 0.0);
-    const std::complex<double> zinv = std::complex<double>(1.0, 0.0)/z;
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcRiccatiBessel(BasicMieContext<FloatType>& ctx, const std::complex<FloatType> z,
+                                                        std::complex<FloatType>* D1, std::complex<FloatType>* D3,
+                                                        std::complex<FloatType>* Psi, std::complex<FloatType>* Zeta) const {
+    const int nmax_ = ctx.nmax_full_;
+    std::complex<FloatType>* PsiZeta = ctx.ws_.PsiZeta.data();
+
+    // Downward recurrence for D1 - equations (16a) and (16b), starting from
+    // the value given by the continued fraction (see calcD1Start), so that it
+    // is accurate for any nmax_.
+    D1[nmax_] = calcD1Start(nmax_, z);
+    const std::complex<FloatType> zinv = std::complex<FloatType>(1.0, 0.0)/z;
 
     for (int n = nmax_; n > 0; n--) {
-      D1[n - 1] = static_cast<double>(n)*zinv - 1.0/(D1[n] + static_cast<double>(n)*zinv);
+      D1[n - 1] = static_cast<FloatType>(n)*zinv - FloatType(1.0)/(D1[n] + static_cast<FloatType>(n)*zinv);
     }
 
-    if (std::abs(D1[0]) > 1.0e15) {
-      throw std::invalid_argument("Unstable D1! Please, try to change input parameters!\n");
-    //printf("Warning: Potentially unstable D1! Please, try to change input parameters!\n");
+    // Upward recurrence for PsiZeta and D3 - equations (18a) - (18d), and
+    // for Psi and Zeta - equations (20a) - (21b)
+    PsiZeta[0] = FloatType(0.5)*(FloatType(1.0) - std::complex<FloatType>(std::cos(FloatType(2.0)*z.real()),
+                                                                          std::sin(FloatType(2.0)*z.real()))
+                                 *std::exp(FloatType(-2.0)*z.imag()));
+    D3[0] = std::complex<FloatType>(0.0, 1.0);
+    if (Psi != nullptr) {
+      Psi[0] = std::sin(z);
+      Zeta[0] = std::sin(z) - std::complex<FloatType>(0.0, 1.0)*std::cos(z);
     }
-
-    // Upward recurrence for PsiZeta and D3 - equations (18a) - (18d)
-    PsiZeta_[0] = 0.5*(1.0 - std::complex<double>(std::cos(2.0*z.real()), std::sin(2.0*z.real()))
-                      *std::exp(-2.0*z.imag()));
-    D3[0] = std::complex<double>(0.0, 1.0);
-    for (int n = 1; n <= nmax_; n++) {
-      PsiZeta_[n] = PsiZeta_[n - 1]*(static_cast<double>(n)*zinv - D1[n - 1])
-                                   *(static_cast<double>(n)*zinv - D3[n - 1]);
-      D3[n] = D1[n] + std::complex<double>(0.0, 1.0)/PsiZeta_[n];
+    int n0 = 1;
+    //*********************************************************************//
+    // D1[0] = cot(z) has a pole at z = k*Pi, where it looses accuracy due //
+    // to cancellation. Then the first step of the recurrences (the only   //
+    // one using D1[0]) is replaced by the explicit expressions for n = 1. //
+    //*********************************************************************//
+    if (std::abs(D1[0]) > 1.0e4) {
+      const std::complex<FloatType> Psi1 = std::sin(z)*zinv - std::cos(z);
+      const std::complex<FloatType> Zeta1 = (std::sin(z) - std::complex<FloatType>(0.0, 1.0)*std::cos(z))
+                                        *(zinv - std::complex<FloatType>(0.0, 1.0));
+      PsiZeta[1] = Psi1*Zeta1;
+      D3[1] = D1[1] + std::complex<FloatType>(0.0, 1.0)/PsiZeta[1];
+      if (Psi != nullptr) {
+        Psi[1] = Psi1;
+        Zeta[1] = Zeta1;
+      }
+      n0 = 2;
+    }
+    for (int n = n0; n <= nmax_; n++) {
+      PsiZeta[n] = PsiZeta[n - 1]*(static_cast<FloatType>(n)*zinv - D1[n - 1])
+                                   *(static_cast<FloatType>(n)*zinv - D3[n - 1]);
+      if (Psi != nullptr) {
+        const std::complex<FloatType> nz = static_cast<FloatType>(n)/z;
+        Psi[n]  =  Psi[n - 1]*(nz - D1[n - 1]);
+        Zeta[n] = Zeta[n - 1]*(nz - D3[n - 1]);
+      }
+      D3[n] = D1[n] + std::complex<FloatType>(0.0, 1.0)/PsiZeta[n];
     }
   }
 
 
   //**********************************************************************************//
-  // This function calculates the Riccati-Bessel functions (Psi and Zeta) for a       //
-  // complex argument (z).                                                            //
-  // Equations (20a) - (21b)                                                          //
-  //                                                                                  //
-  // Input parameters:                                                                //
-  //   z: Complex argument to evaluate Psi and Zeta                                   //
-  //   nmax: Maximum number of terms to calculate Psi and Zeta                        //
-  //                                                                                  //
-  // Output parameters:                                                               //
-  //   Psi, Zeta: Riccati-Bessel functions                                            //
+  // This function calculates the logarithmic derivatives of the Riccati-Bessel       //
+  // functions (D1 and D3) for a complex argument (z), see calcRiccatiBessel.         //
   //**********************************************************************************//
-  void MultiLayerMie::calcPsiZeta(std::complex<double> z,
-                                  std::vector<std::complex<double> >& Psi,
-                                  std::vector<std::complex<double> >& Zeta) {
-
-    std::complex<double> c_i(0.0, 1.0);
-    std::vector<std::complex<double> > D1(nmax_ + 1), D3(nmax_ + 1);
-
-    // First, calculate the logarithmic derivatives
-    calcD1D3(z, D1, D3);
-
-    // Now, use the upward recurrence to calculate Psi and Zeta - equations (20a) - (21b)
-    Psi[0] = std::sin(z);
-    Zeta[0] = std::sin(z) - c_i*std::cos(z);
-    for (int n = 1; n <= nmax_; n++) {
-      Psi[n]  =  Psi[n - 1]*(static_cast<double>(n)/z - D1[n - 1]);
-      Zeta[n] = Zeta[n - 1]*(static_cast<double>(n)/z - D3[n - 1]);
-    }
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcD1D3(BasicMieContext<FloatType>& ctx, const std::complex<FloatType> z,
+                                               std::complex<FloatType>* D1, std::complex<FloatType>* D3) const {
+    calcRiccatiBessel(ctx, z, D1, D3, nullptr, nullptr);
   }
 
 
@@ -687,8 +1007,9 @@ namespace nmie {
   // Output parameters:                                                               //
   //   Pi, Tau: Angular functions Pi and Tau, as defined in equations (26a) - (26c)   //
   //**********************************************************************************//
-  void MultiLayerMie::calcPiTau(const double& costheta,
-                                std::vector<double>& Pi, std::vector<double>& Tau) {
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcPiTau(const int nmax_, const FloatType& costheta,
+                                                std::vector<FloatType>& Pi, std::vector<FloatType>& Tau) const {
 
     int i;
     //****************************************************//
@@ -709,14 +1030,138 @@ namespace nmie {
   }  // end of MultiLayerMie::calcPiTau(...)
 
 
+  //**********************************************************************************//
+  // This function calculates Pi and Tau for all the scattering angles at once.       //
+  // The recurrence is the same as in calcPiTau, but it is done order by order, so    //
+  // that each order is evaluated for all angles in a single pass. The table depends  //
+  // only on the angles, hence it is kept until the angles change or a larger nmax_   //
+  // is required.                                                                     //
+  //                                                                                  //
+  // Input parameters:                                                                //
+  //   ctx.nmax_: Maximum number of terms to calculate Pi and Tau                     //
+  //   first_angle, angle_count: Block of the scattering angles (theta_)              //
+  //                                                                                  //
+  // Output parameters:                                                               //
+  //   ctx.Pi_table_, ctx.Tau_table_: Angular functions Pi and Tau for the angles     //
+  //                                  in ctx.table_theta_, Pi_table_[n*nTheta + t]    //
+  //**********************************************************************************//
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcPiTauTable(BasicMieContext<FloatType>& ctx, const unsigned long first_angle,
+                                                     const unsigned long angle_count) const {
+    typedef simd::Pack<FloatType> V;
+    typedef typename V::type vtype;
+    const int nmax_ = ctx.nmax_;
+    const int nTheta = angle_count;
+    const typename std::vector<FloatType>::const_iterator theta = theta_.begin() + first_angle;
+    if (ctx.table_nmax_ >= nmax_ && ctx.table_theta_.size() == angle_count
+        && std::equal(ctx.table_theta_.begin(), ctx.table_theta_.end(), theta)) return;
+
+    ctx.table_theta_.assign(theta, theta + nTheta);
+    ctx.Pi_table_.resize(nmax_*nTheta);
+    ctx.Tau_table_.resize(nmax_*nTheta);
+
+    FloatType *Pi = ctx.Pi_table_.data(), *Tau = ctx.Tau_table_.data();
+    // The recurrence is evaluated for V::kLanes angles at once, the
+    // remaining angles are processed one by one.
+    const int nVec = nTheta - nTheta%V::kLanes;
+    // Equations (26a) - (26c)
+    for (int t = 0; t < nTheta; t++) {
+      Pi[t] = 1.0;  // n=1
+      Tau[t] = std::cos(theta[t]);
+    }
+    if (nmax_ > 1) {
+      const FloatType *costheta = Tau;
+      FloatType *Pi1 = Pi + nTheta, *Tau1 = Tau + nTheta;
+      for (int t = 0; t < nTheta; t++) { //n=2
+        Pi1[t] = 3*costheta[t]*Pi[t];
+        Tau1[t] = 2*costheta[t]*Pi1[t] - 3*Pi[t];
+      }
+      for (int i = 2; i < nmax_; i++) { //n=[3..nmax_]
+        const FloatType *PiM2 = Pi + (i - 2)*nTheta, *PiM1 = Pi + (i - 1)*nTheta;
+        FloatType *Pii = Pi + i*nTheta, *Taui = Tau + i*nTheta;
+        const vtype a = V::Set1(i + i + 1), b = V::Set1(i + 1),
+                            c = V::Set1(i + 2), d = V::Set1(i);
+        for (int t = 0; t < nVec; t += V::kLanes) {
+          const vtype ct = V::Load(costheta + t), p1 = V::Load(PiM1 + t);
+          const vtype p = V::Div(V::Sub(V::Mul(V::Mul(a, ct), p1),
+                                                      V::Mul(b, V::Load(PiM2 + t))), d);
+          V::Store(Pii + t, p);
+          V::Store(Taui + t, V::Sub(V::Mul(V::Mul(b, ct), p), V::Mul(c, p1)));
+        }
+        for (int t = nVec; t < nTheta; t++) {
+          Pii[t] = ((i + i + 1)*costheta[t]*PiM1[t] - (i + 1)*PiM2[t])/i;
+          Taui[t] = (i + 1)*costheta[t]*Pii[t] - (i + 2)*PiM1[t];
+        }
+      }
+    }
+    ctx.table_nmax_ = nmax_;
+  }  // end of MultiLayerMie::calcPiTauTable()
+
+
+  //**********************************************************************************//
+  // This function calculates the scattering amplitudes S1 and S2 for all the         //
+  // scattering angles from the table of angular functions. The angles are kept in    //
+  // separate arrays for the real and imaginary parts of S1 and S2, so that each      //
+  // instruction accumulates V::kLanes angles. The remaining angles (and all of    //
+  // them if there are no vector extensions) are accumulated with calc_S1/calc_S2.    //
+  // Equations (25a) - (25b)                                                          //
+  //                                                                                  //
+  // Input parameters:                                                                //
+  //   ctx.an_, ctx.bn_: Complex scattering coefficients                              //
+  //   ctx.Pi_table_, ctx.Tau_table_: Angular functions for the scattering angles     //
+  //                                                                                  //
+  // Output parameters:                                                               //
+  //   ctx.S1_, ctx.S2_: Complex scattering amplitudes                                //
+  //**********************************************************************************//
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcS1S2(BasicMieContext<FloatType>& ctx) const {
+    typedef simd::Pack<FloatType> V;
+    typedef typename V::type vtype;
+    const int nmax_ = ctx.nmax_;
+    const std::vector<std::complex<FloatType> > &an_ = ctx.an_, &bn_ = ctx.bn_;
+    std::vector<std::complex<FloatType> > &S1_ = ctx.S1_, &S2_ = ctx.S2_;
+    const int nTheta = ctx.table_theta_.size();
+    const int nVec = nTheta - nTheta%V::kLanes;
+
+    ctx.S_lanes_.assign(4*nVec, 0.0);
+    FloatType *S1r = ctx.S_lanes_.data(), *S1i = S1r + nVec, *S2r = S1i + nVec, *S2i = S2r + nVec;
+
+    // Same order of summation as for the efficiencies (downward)
+    for (int i = nmax_ - 2; i >= 0; i--) {
+      const int n = i + 1;
+      const FloatType *Pi = ctx.Pi_table_.data() + i*nTheta, *Tau = ctx.Tau_table_.data() + i*nTheta;
+
+      const FloatType factor = FloatType(n + n + 1)/FloatType(n*n + n);
+      const vtype ar = V::Set1(factor*an_[i].real()), ai = V::Set1(factor*an_[i].imag()),
+                          br = V::Set1(factor*bn_[i].real()), bi = V::Set1(factor*bn_[i].imag());
+      for (int t = 0; t < nVec; t += V::kLanes) {
+        const vtype p = V::Load(Pi + t), tau = V::Load(Tau + t);
+        V::Store(S1r + t, V::Add(V::Load(S1r + t), V::Add(V::Mul(p, ar), V::Mul(tau, br))));
+        V::Store(S1i + t, V::Add(V::Load(S1i + t), V::Add(V::Mul(p, ai), V::Mul(tau, bi))));
+        V::Store(S2r + t, V::Add(V::Load(S2r + t), V::Add(V::Mul(tau, ar), V::Mul(p, br))));
+        V::Store(S2i + t, V::Add(V::Load(S2i + t), V::Add(V::Mul(tau, ai), V::Mul(p, bi))));
+      }
+      for (int t = nVec; t < nTheta; t++) {
+        S1_[t] += calc_S1(n, an_[i], bn_[i], Pi[t], Tau[t]);
+        S2_[t] += calc_S2(n, an_[i], bn_[i], Pi[t], Tau[t]);
+      }
+    }
+    for (int t = 0; t < nVec; t++) {
+      S1_[t] = std::complex<FloatType>(S1r[t], S1i[t]);
+      S2_[t] = std::complex<FloatType>(S2r[t], S2i[t]);
+    }
+  }  // end of MultiLayerMie::calcS1S2()
+
+
   //**********************************************************************************//
   // This function calculates vector spherical harmonics (eq. 4.50, p. 95 BH),        //
   // required to calculate the near-field parameters.                                 //
   //                                                                                  //
   // Input parameters:                                                                //
   //   Rho: Radial distance                                                           //
-  //   Phi: Azimuthal angle                                                           //
-  //   Theta: Polar angle                                                             //
+  //   sin_theta: Sine of the polar angle                                             //
+  //   cos_phi, sin_phi: Cosine and sine of the azimuthal angle (both 1 to get the    //
+  //                     amplitudes of the cos(Phi) and sin(Phi) dependences)         //
   //   rn: Either the spherical Ricatti-Bessel function of first or third kind        //
   //   Dn: Logarithmic derivative of rn                                               //
   //   Pi, Tau: Angular functions Pi and Tau                                          //
@@ -725,29 +1170,28 @@ namespace nmie {
   // Output parameters:                                                               //
   //   Mo1n, Me1n, No1n, Ne1n: Complex vector spherical harmonics                     //
   //**********************************************************************************//
-  void MultiLayerMie::calcSpherHarm(const std::complex<double> Rho, const double Theta, const double Phi,
-                                    const std::complex<double>& rn, const std::complex<double>& Dn,
-                                    const double& Pi, const double& Tau, const double& n,
-                                    std::vector<std::complex<double> >& Mo1n, std::vector<std::complex<double> >& Me1n, 
-                                    std::vector<std::complex<double> >& No1n, std::vector<std::complex<double> >& Ne1n) {
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcSpherHarm(const std::complex<FloatType> Rho, const FloatType sin_theta,
+                                                    const FloatType cos_phi, const FloatType sin_phi,
+                                                    const std::complex<FloatType>& rn, const std::complex<FloatType>& Dn,
+                                                    const FloatType& Pi, const FloatType& Tau, const FloatType& n,
+                                                    FieldVector& Mo1n, FieldVector& Me1n, FieldVector& No1n, FieldVector& Ne1n) const {
 
     // using eq 4.50 in BH
-    std::complex<double> c_zero(0.0, 0.0);
+    std::complex<FloatType> c_zero(0.0, 0.0);
 
-    using std::sin;
-    using std::cos;
     Mo1n[0] = c_zero;
-    Mo1n[1] = cos(Phi)*Pi*rn/Rho;
-    Mo1n[2] = -sin(Phi)*Tau*rn/Rho;
+    Mo1n[1] = cos_phi*Pi*rn/Rho;
+    Mo1n[2] = -sin_phi*Tau*rn/Rho;
     Me1n[0] = c_zero;
-    Me1n[1] = -sin(Phi)*Pi*rn/Rho;
-    Me1n[2] = -cos(Phi)*Tau*rn/Rho;
-    No1n[0] = sin(Phi)*(n*n + n)*sin(Theta)*Pi*rn/Rho/Rho;
-    No1n[1] = sin(Phi)*Tau*Dn*rn/Rho;
-    No1n[2] = cos(Phi)*Pi*Dn*rn/Rho;
-    Ne1n[0] = cos(Phi)*(n*n + n)*sin(Theta)*Pi*rn/Rho/Rho;
-    Ne1n[1] = cos(Phi)*Tau*Dn*rn/Rho;
-    Ne1n[2] = -sin(Phi)*Pi*Dn*rn/Rho;
+    Me1n[1] = -sin_phi*Pi*rn/Rho;
+    Me1n[2] = -cos_phi*Tau*rn/Rho;
+    No1n[0] = sin_phi*(n*n + n)*sin_theta*Pi*rn/Rho/Rho;
+    No1n[1] = sin_phi*Tau*Dn*rn/Rho;
+    No1n[2] = cos_phi*Pi*Dn*rn/Rho;
+    Ne1n[0] = cos_phi*(n*n + n)*sin_theta*Pi*rn/Rho/Rho;
+    Ne1n[1] = cos_phi*Tau*Dn*rn/Rho;
+    Ne1n[2] = -sin_phi*Pi*Dn*rn/Rho;
   }  // end of MultiLayerMie::calcSpherHarm(...)
 
 
@@ -770,12 +1214,15 @@ namespace nmie {
   // Return value:                                                                    //
   //   Number of multipolar expansion terms used for the calculations                 //
   //**********************************************************************************//
-  void MultiLayerMie::calcScattCoeffs() {
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcScattCoeffs(BasicMieContext<FloatType>& ctx) const {
+    checkModel();
 
-    isScaCoeffsCalc_ = false;
+    ctx.isScaCoeffsCalc_ = false;
+    ctx.isExpCoeffsCalc_ = false;
 
-    const std::vector<double>& x = size_param_;
-    const std::vector<std::complex<double> >& m = refractive_index_;
+    const std::vector<FloatType>& x = size_param_;
+    const std::vector<std::complex<FloatType> >& m = refractive_index_;
     const int& pl = PEC_layer_position_;
     const int L = refractive_index_.size();
 
@@ -785,10 +1232,13 @@ namespace nmie {
     // below the PEC are discarded.                                           //
     // ***********************************************************************//
     int fl = (pl > 0) ? pl : 0;
-    if (nmax_preset_ <= 0) calcNmax(fl);
-    else nmax_ = nmax_preset_;
+    if (nmax_preset_ <= 0) ctx.nmax_full_ = calcNmax(fl);
+    else ctx.nmax_full_ = nmax_preset_;
+    const int nmax_ = ctx.nmax_full_;
+    ctx.nmax_ = nmax_;
+    std::vector<std::complex<FloatType> > &an_ = ctx.an_, &bn_ = ctx.bn_;
 
-    std::complex<double> z1, z2;
+    std::complex<FloatType> z1, z2;
     //**************************************************************************//
     // Note that since Fri, Nov 14, 2014 all arrays start from 0 (zero), which  //
     // means that index = layer number - 1 or index = n - 1. The only exception //
@@ -796,131 +1246,208 @@ namespace nmie {
     // for the index 0 (zero), hence it is important to consider this shift     //
     // between different arrays. The change was done to optimize memory usage.  //
     //**************************************************************************//
-    // Allocate memory to the arrays
-    std::vector<std::complex<double> > D1_mlxl(nmax_ + 1), D1_mlxlM1(nmax_ + 1),
-                                       D3_mlxl(nmax_ + 1), D3_mlxlM1(nmax_ + 1);
-
-    std::vector<std::vector<std::complex<double> > > Q(L), Ha(L), Hb(L);
-
-    for (int l = 0; l < L; l++) {
-      Q[l].resize(nmax_ + 1);
-      Ha[l].resize(nmax_);
-      Hb[l].resize(nmax_);
-    }
+    // Get memory for the arrays (allocated only for a new maximum of nmax_ and L)
+    BasicMieWorkspace<FloatType>& ws_ = ctx.ws_;
+    ws_.Reserve(nmax_, L);
+    std::vector<std::complex<FloatType> >& PsiXL = ws_.PsiXL;
+    std::vector<std::complex<FloatType> >& ZetaXL = ws_.ZetaXL;
+
+    // D1, D3, Q, Ha and Hb are stored layer by layer, each layer uses nmax_ + 1
+    // elements. D1 and D3 are kept for all layers, so that Q, Ha and Hb can be
+    // calculated order by order and the recurrences stop once the series has
+    // converged (see SetTolerance).
+    const int stride = nmax_ + 1;
+    std::complex<FloatType> *D1_mlxl = ws_.D1_mlxl.data(), *D1_mlxlM1 = ws_.D1_mlxlM1.data();
+    std::complex<FloatType> *D3_mlxl = ws_.D3_mlxl.data(), *D3_mlxlM1 = ws_.D3_mlxlM1.data();
+    std::complex<FloatType> *Q = ws_.Q.data(), *Ha = ws_.Ha.data(), *Hb = ws_.Hb.data();
 
     an_.resize(nmax_);
     bn_.resize(nmax_);
-    PsiZeta_.resize(nmax_ + 1);
 
-    std::vector<std::complex<double> > PsiXL(nmax_ + 1), ZetaXL(nmax_ + 1);
+    //*************************************************************************//
+    // Layers below reuse_l are the same as in the previous calculation with  //
+    // this context, hence their D1, D3, Q, Ha and Hb (for the first          //
+    // reuse_orders orders) are still in the workspace. The stored prefix is  //
+    // invalidated until the calculation finishes.                            //
+    //*************************************************************************//
+    int reuse_l = fl, reuse_orders = 0;
+    if (ctx.prefix_pl_ == pl && ctx.prefix_nmax_ == nmax_) {
+      const int prefix_L = std::min<int>(L, ctx.prefix_x_.size());
+      while (reuse_l < prefix_L && x[reuse_l] == ctx.prefix_x_[reuse_l]
+             && m[reuse_l] == ctx.prefix_m_[reuse_l]) reuse_l++;
+      reuse_orders = ctx.prefix_orders_;
+    }
+    ctx.prefix_nmax_ = -1;
 
     //*************************************************//
     // Calculate D1 and D3 for z1 in the first layer   //
     //*************************************************//
-    if (fl == pl) {  // PEC layer
-      for (int n = 0; n <= nmax_; n++) {
-        D1_mlxl[n] = std::complex<double>(0.0, - 1.0);
-        D3_mlxl[n] = std::complex<double>(0.0, 1.0);
+    if (reuse_l == fl) {
+      if (fl == pl) {  // PEC layer
+        for (int n = 0; n <= nmax_; n++) {
+          D1_mlxl[fl*stride + n] = std::complex<FloatType>(0.0, - 1.0);
+          D3_mlxl[fl*stride + n] = std::complex<FloatType>(0.0, 1.0);
+        }
+      } else { // Regular layer
+        z1 = x[fl]* m[fl];
+        // Calculate D1 and D3
+        calcD1D3(ctx, z1, D1_mlxl + fl*stride, D3_mlxl + fl*stride);
       }
-    } else { // Regular layer
-      z1 = x[fl]* m[fl];
-      // Calculate D1 and D3
-      calcD1D3(z1, D1_mlxl, D3_mlxl);
-    }
-
-    //******************************************************************//
-    // Calculate Ha and Hb in the first layer - equations (7a) and (8a) //
-    //******************************************************************//
-    for (int n = 0; n < nmax_; n++) {
-      Ha[fl][n] = D1_mlxl[n + 1];
-      Hb[fl][n] = D1_mlxl[n + 1];
-    }
-    //*****************************************************//
-    // Iteration from the second layer to the last one (L) //
-    //*****************************************************//
-    std::complex<double> Temp, Num, Denom;
-    std::complex<double> G1, G2;
-    for (int l = fl + 1; l < L; l++) {
-      //************************************************************//
-      //Calculate D1 and D3 for z1 and z2 in the layers fl + 1..L   //
-      //************************************************************//
+    }  // else: already calculated
+
+    //************************************************************//
+    //Calculate D1 and D3 for z1 and z2 in the layers fl + 1..L   //
+    //************************************************************//
+    std::complex<FloatType> Temp, Num, Denom;
+    std::complex<FloatType> G1, G2;
+    for (int l = std::max(reuse_l, fl + 1); l < L; l++) {
       z1 = x[l]*m[l];
       z2 = x[l - 1]*m[l];
       //Calculate D1 and D3 for z1
-      calcD1D3(z1, D1_mlxl, D3_mlxl);
+      calcD1D3(ctx, z1, D1_mlxl + l*stride, D3_mlxl + l*stride);
       //Calculate D1 and D3 for z2
-      calcD1D3(z2, D1_mlxlM1, D3_mlxlM1);
-
-      //*************************************************//
-      //Calculate Q, Ha and Hb in the layers fl + 1..L   //
-      //*************************************************//
-      // Upward recurrence for Q - equations (19a) and (19b)
-      Num = std::exp(-2.0*(z1.imag() - z2.imag()))
-           *std::complex<double>(std::cos(-2.0*z2.real()) - std::exp(-2.0*z2.imag()), std::sin(-2.0*z2.real()));
-      Denom = std::complex<double>(std::cos(-2.0*z1.real()) - std::exp(-2.0*z1.imag()), std::sin(-2.0*z1.real()));
-      Q[l][0] = Num/Denom;
-      for (int n = 1; n <= nmax_; n++) {
-        Num = (z1*D1_mlxl[n] + double(n))*(double(n) - z1*D3_mlxl[n - 1]);
-        Denom = (z2*D1_mlxlM1[n] + double(n))*(double(n) - z2*D3_mlxlM1[n - 1]);
-        Q[l][n] = ((pow2(x[l - 1]/x[l])* Q[l][n - 1])*Num)/Denom;
+      calcD1D3(ctx, z2, D1_mlxlM1 + l*stride, D3_mlxlM1 + l*stride);
+
+      // Initial value for the upward recurrence for Q - equations (19a) and (19b)
+      Num = std::exp(FloatType(-2.0)*(z1.imag() - z2.imag()))
+           *std::complex<FloatType>(std::cos(-2.0*z2.real()) - std::exp(-2.0*z2.imag()), std::sin(-2.0*z2.real()));
+      Denom = std::complex<FloatType>(std::cos(-2.0*z1.real()) - std::exp(-2.0*z1.imag()), std::sin(-2.0*z1.real()));
+      Q[l*stride] = Num/Denom;
+    }
+
+    //**************************************//
+    //Calculate Psi and Zeta for XL         //
+    //**************************************//
+    // Calculate PsiXL and ZetaXL
+    calcRiccatiBessel(ctx, x[L - 1], ws_.D1.data(), ws_.D3.data(), PsiXL.data(), ZetaXL.data());
+
+    //*********************************************************************//
+    // Now, for each order n we calculate Q, Ha and Hb in all the layers   //
+    // and then the scattering coefficients (an and bn). Note that for     //
+    // these arrays the first layer is 0 (zero), in future versions all    //
+    // arrays will follow this convention to save memory. (13 Nov, 2014)  //
+    //*********************************************************************//
+    // Partial sum of (2n + 1)(|an| + |bn|) and number of consecutive terms below tolerance_
+    FloatType partial_sum = 0.0;
+    int converged = 0;
+    int n_last = nmax_;
+    for (int n = 1; n <= nmax_; n++) {
+      // First layer to be calculated for this order
+      const int first_l = (n <= reuse_orders) ? reuse_l : fl;
+      //******************************************************************//
+      // Calculate Ha and Hb in the first layer - equations (7a) and (8a) //
+      //******************************************************************//
+      if (first_l == fl) {
+        Ha[fl*stride + n - 1] = D1_mlxl[fl*stride + n];
+        Hb[fl*stride + n - 1] = D1_mlxl[fl*stride + n];
       }
-      // Upward recurrence for Ha and Hb - equations (7b), (8b) and (12) - (15)
-      for (int n = 1; n <= nmax_; n++) {
+
+      //*****************************************************//
+      // Iteration from the second layer to the last one (L) //
+      //*****************************************************//
+      for (int l = std::max(first_l, fl + 1); l < L; l++) {
+        const std::complex<FloatType> *D1l = D1_mlxl + l*stride, *D1lM1 = D1_mlxlM1 + l*stride;
+        const std::complex<FloatType> *D3l = D3_mlxl + l*stride, *D3lM1 = D3_mlxlM1 + l*stride;
+        std::complex<FloatType> *Ql = Q + l*stride;
+        std::complex<FloatType> *Hal = Ha + l*stride, *HalM1 = Ha + (l - 1)*stride;
+        std::complex<FloatType> *Hbl = Hb + l*stride, *HblM1 = Hb + (l - 1)*stride;
+        z1 = x[l]*m[l];
+        z2 = x[l - 1]*m[l];
+
+        // Upward recurrence for Q - equations (19a) and (19b)
+        Num = (z1*D1l[n] + FloatType(n))*(FloatType(n) - z1*D3l[n - 1]);
+        Denom = (z2*D1lM1[n] + FloatType(n))*(FloatType(n) - z2*D3lM1[n - 1]);
+        Ql[n] = ((pow2(x[l - 1]/x[l])* Ql[n - 1])*Num)/Denom;
+
+        // Upward recurrence for Ha and Hb - equations (7b), (8b) and (12) - (15)
         //Ha
         if ((l - 1) == pl) { // The layer below the current one is a PEC layer
-          G1 = -D1_mlxlM1[n];
-          G2 = -D3_mlxlM1[n];
+          G1 = -D1lM1[n];
+          G2 = -D3lM1[n];
         } else {
-          G1 = (m[l]*Ha[l - 1][n - 1]) - (m[l - 1]*D1_mlxlM1[n]);
-          G2 = (m[l]*Ha[l - 1][n - 1]) - (m[l - 1]*D3_mlxlM1[n]);
+          G1 = (m[l]*HalM1[n - 1]) - (m[l - 1]*D1lM1[n]);
+          G2 = (m[l]*HalM1[n - 1]) - (m[l - 1]*D3lM1[n]);
         }  // end of if PEC
-        Temp = Q[l][n]*G1;
-        Num = (G2*D1_mlxl[n]) - (Temp*D3_mlxl[n]);
+        Temp = Ql[n]*G1;
+        Num = (G2*D1l[n]) - (Temp*D3l[n]);
         Denom = G2 - Temp;
-        Ha[l][n - 1] = Num/Denom;
+        Hal[n - 1] = Num/Denom;
         //Hb
         if ((l - 1) == pl) { // The layer below the current one is a PEC layer
-          G1 = Hb[l - 1][n - 1];
-          G2 = Hb[l - 1][n - 1];
+          G1 = HblM1[n - 1];
+          G2 = HblM1[n - 1];
         } else {
-          G1 = (m[l - 1]*Hb[l - 1][n - 1]) - (m[l]*D1_mlxlM1[n]);
-          G2 = (m[l - 1]*Hb[l - 1][n - 1]) - (m[l]*D3_mlxlM1[n]);
+          G1 = (m[l - 1]*HblM1[n - 1]) - (m[l]*D1lM1[n]);
+          G2 = (m[l - 1]*HblM1[n - 1]) - (m[l]*D3lM1[n]);
         }  // end of if PEC
 
-        Temp = Q[l][n]*G1;
-        Num = (G2*D1_mlxl[n]) - (Temp* D3_mlxl[n]);
+        Temp = Ql[n]*G1;
+        Num = (G2*D1l[n]) - (Temp* D3l[n]);
         Denom = (G2- Temp);
-        Hb[l][n - 1] = (Num/ Denom);
-      }  // end of for Ha and Hb terms
-    }  // end of for layers iteration
+        Hbl[n - 1] = (Num/ Denom);
+      }  // end of for layers iteration
 
-    //**************************************//
-    //Calculate Psi and Zeta for XL         //
-    //**************************************//
-    // Calculate PsiXL and ZetaXL
-    calcPsiZeta(x[L - 1], PsiXL, ZetaXL);
-
-    //*********************************************************************//
-    // Finally, we calculate the scattering coefficients (an and bn) and   //
-    // the angular functions (Pi and Tau). Note that for these arrays the  //
-    // first layer is 0 (zero), in future versions all arrays will follow  //
-    // this convention to save memory. (13 Nov, 2014)                      //
-    //*********************************************************************//
-    for (int n = 0; n < nmax_; n++) {
       //********************************************************************//
       //Expressions for calculating an and bn coefficients are not valid if //
       //there is only one PEC layer (ie, for a simple PEC sphere).          //
       //********************************************************************//
+      const int i = n - 1;
       if (pl < (L - 1)) {
-        an_[n] = calc_an(n + 1, x[L - 1], Ha[L - 1][n], m[L - 1], PsiXL[n + 1], ZetaXL[n + 1], PsiXL[n], ZetaXL[n]);
-        bn_[n] = calc_bn(n + 1, x[L - 1], Hb[L - 1][n], m[L - 1], PsiXL[n + 1], ZetaXL[n + 1], PsiXL[n], ZetaXL[n]);
+        an_[i] = calc_an(n, x[L - 1], Ha[(L - 1)*stride + i], m[L - 1], PsiXL[n], ZetaXL[n], PsiXL[i], ZetaXL[i]);
+        bn_[i] = calc_bn(n, x[L - 1], Hb[(L - 1)*stride + i], m[L - 1], PsiXL[n], ZetaXL[n], PsiXL[i], ZetaXL[i]);
       } else {
-        an_[n] = calc_an(n + 1, x[L - 1], std::complex<double>(0.0, 0.0), std::complex<double>(1.0, 0.0), PsiXL[n + 1], ZetaXL[n + 1], PsiXL[n], ZetaXL[n]);
-        bn_[n] = PsiXL[n + 1]/ZetaXL[n + 1];
+        an_[i] = calc_an(n, x[L - 1], std::complex<FloatType>(0.0, 0.0), std::complex<FloatType>(1.0, 0.0), PsiXL[n], ZetaXL[n], PsiXL[i], ZetaXL[i]);
+        bn_[i] = PsiXL[n]/ZetaXL[n];
+      }
+
+      //******************************************************************//
+      // Stop when two consecutive terms are below the tolerance. The     //
+      // efficiencies and amplitudes skip the last term, which is only    //
+      // used as the neighbour of the previous one for Qpr.               //
+      //******************************************************************//
+      if (tolerance_ > 0.0) {
+        const FloatType term = FloatType(n + n + 1)*(std::abs(an_[i]) + std::abs(bn_[i]));
+        partial_sum += term;
+        converged = (term <= tolerance_*partial_sum) ? converged + 1 : 0;
+        if (converged == 2 && n < nmax_) {
+          ctx.nmax_ = n_last = n;
+          an_.resize(n);
+          bn_.resize(n);
+          break;
+        }
       }
     }  // end of for an and bn terms
-    isScaCoeffsCalc_ = true;
-  }  // end of MultiLayerMie::calcScattCoeffs()
+
+    ctx.prefix_x_.assign(x.begin(), x.end());
+    ctx.prefix_m_.assign(m.begin(), m.end());
+    ctx.prefix_pl_ = pl;
+    ctx.prefix_nmax_ = nmax_;
+    ctx.prefix_orders_ = n_last;
+    ctx.model_ = this;
+    ctx.revision_ = revision_;
+    ctx.isScaCoeffsCalc_ = true;
+  }  // end of MultiLayerMie::calcScattCoeffs(...)
+
+
+  // ********************************************************************** //
+  // Calculate scattering coefficients using the internal context          //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcScattCoeffs() {
+    calcScattCoeffs(ctx_);
+  }
+
+
+  // ********************************************************************** //
+  // Check that the model is properly defined                               //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::checkModel() const {
+    if (size_param_.size() != refractive_index_.size())
+      throw std::invalid_argument("Each size parameter should have only one index!");
+    if (size_param_.size() == 0)
+      throw std::invalid_argument("Initialize model first!");
+  }
 
 
   //**********************************************************************************//
@@ -951,18 +1478,30 @@ namespace nmie {
   // Return value:                                                                    //
   //   Number of multipolar expansion terms used for the calculations                 //
   //**********************************************************************************//
-  void MultiLayerMie::RunMieCalculation() {
-    if (size_param_.size() != refractive_index_.size())
-      throw std::invalid_argument("Each size parameter should have only one index!");
-    if (size_param_.size() == 0)
-      throw std::invalid_argument("Initialize model first!");
-
-    const std::vector<double>& x = size_param_;
-
-    MarkUncalculated();
-
-    // Calculate scattering coefficients
-    calcScattCoeffs();
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunMieCalculation(BasicMieContext<FloatType>& ctx, const unsigned long first_angle,
+                                                        const unsigned long angle_count) const {
+    checkModel();
+    if (first_angle + angle_count > theta_.size())
+      throw std::invalid_argument("Requested angles are out of range!");
+
+    const std::vector<FloatType>& x = size_param_;
+
+    ctx.isMieCalculated_ = false;
+
+    // Calculate scattering coefficients, unless this context already has
+    // them for the current model
+    if (!ctx.isScaCoeffsCalc_ || ctx.model_ != this || ctx.revision_ != revision_)
+      calcScattCoeffs(ctx);
+    const int nmax_ = ctx.nmax_;
+    const std::vector<std::complex<FloatType> > &an_ = ctx.an_, &bn_ = ctx.bn_;
+    FloatType &Qext_ = ctx.Qext_, &Qsca_ = ctx.Qsca_, &Qabs_ = ctx.Qabs_, &Qbk_ = ctx.Qbk_,
+           &Qpr_ = ctx.Qpr_, &asymmetry_factor_ = ctx.asymmetry_factor_, &albedo_ = ctx.albedo_;
+
+    // Radiation pressure and asymmetry factor can not be obtained without Qext and Qsca
+    unsigned int mask = output_mask_;
+    if (mask & kRadiationPressure) mask |= kEfficiencies;
+    ctx.output_mask_ = mask;
 
     // Initialize the scattering parameters
     Qext_ = 0.0;
@@ -972,55 +1511,86 @@ namespace nmie {
     Qpr_ = 0.0;
     asymmetry_factor_ = 0.0;
     albedo_ = 0.0;
+    ctx.S1_back_ = ctx.S2_back_ = std::complex<FloatType>(0.0, 0.0);
 
     // Initialize the scattering amplitudes
-    std::vector<std::complex<double> > tmp1(theta_.size(),std::complex<double>(0.0, 0.0));
-    S1_.swap(tmp1);
-    S2_ = S1_;
+    ctx.S1_.assign((mask & kAmplitudes) ? angle_count : 0, std::complex<FloatType>(0.0, 0.0));
+    ctx.S2_.assign((mask & kAmplitudes) ? angle_count : 0, std::complex<FloatType>(0.0, 0.0));
 
-    std::vector<double> Pi(nmax_), Tau(nmax_);
-
-    std::complex<double> Qbktmp(0.0, 0.0);
-    std::vector< std::complex<double> > Qbktmp_ch(nmax_ - 1, Qbktmp);
+    // Each requested quantity is summed in its own loop, so that nothing is
+    // done for the rest of them.
     // By using downward recurrence we avoid loss of precision due to float rounding errors
     // See: https://docs.oracle.com/cd/E19957-01/806-3568/ncg_goldberg.html
     //      http://en.wikipedia.org/wiki/Loss_of_significance
-    for (int i = nmax_ - 2; i >= 0; i--) {
-      const int n = i + 1;
-      // Equation (27)
-      Qext_ += (n + n + 1.0)*(an_[i].real() + bn_[i].real());
-      // Equation (28)
-      Qsca_ += (n + n + 1.0)*(an_[i].real()*an_[i].real() + an_[i].imag()*an_[i].imag()
-                            + bn_[i].real()*bn_[i].real() + bn_[i].imag()*bn_[i].imag());
-      // Equation (29)
-      Qpr_ += ((n*(n + 2.0)/(n + 1.0))*((an_[i]*std::conj(an_[n]) + bn_[i]*std::conj(bn_[n])).real())
-               + ((n + n + 1.0)/(n*(n + 1.0)))*(an_[i]*std::conj(bn_[i])).real());
-      // Equation (33)
-      Qbktmp += (n + n + 1.0)*(1.0 - 2.0*(n % 2))*(an_[i]- bn_[i]);
-      // Calculate the scattering amplitudes (S1 and S2)    //
-      // Precalculate cos(theta) - gives about 5% speed up.
-      std::vector<double> costheta(theta_.size(), 0.0);
-      for (int t = 0; t < theta_.size(); t++) {
-        costheta[t] = std::cos(theta_[t]);
+    FloatType x2 = pow2(x.back());
+    if (mask & kEfficiencies) {
+      for (int i = nmax_ - 2; i >= 0; i--) {
+        const int n = i + 1;
+        // Equation (27)
+        Qext_ += (n + n + 1.0)*(an_[i].real() + bn_[i].real());
+        // Equation (28)
+        Qsca_ += (n + n + 1.0)*(an_[i].real()*an_[i].real() + an_[i].imag()*an_[i].imag()
+                              + bn_[i].real()*bn_[i].real() + bn_[i].imag()*bn_[i].imag());
       }
-      // Equations (25a) - (25b)                            //
-      for (unsigned int t = 0; t < theta_.size(); t++) {
-        calcPiTau(costheta[t], Pi, Tau);
+      Qext_ = 2.0*(Qext_)/x2;                                 // Equation (27)
+      Qsca_ = 2.0*(Qsca_)/x2;                                 // Equation (28)
+      Qabs_ = Qext_ - Qsca_;                                  // Equation (30)
+      albedo_ = Qsca_/Qext_;                                  // Equation (31)
+    }
 
-        S1_[t] += calc_S1(n, an_[i], bn_[i], Pi[i], Tau[i]);
-        S2_[t] += calc_S2(n, an_[i], bn_[i], Pi[i], Tau[i]);
+    if (mask & kRadiationPressure) {
+      for (int i = nmax_ - 2; i >= 0; i--) {
+        const int n = i + 1;
+        // Equation (29)
+        Qpr_ += ((n*(n + 2.0)/(n + 1.0))*((an_[i]*std::conj(an_[n]) + bn_[i]*std::conj(bn_[n])).real())
+                 + ((n + n + 1.0)/(n*(n + 1.0)))*(an_[i]*std::conj(bn_[i])).real());
       }
+      Qpr_ = Qext_ - 4.0*(Qpr_)/x2;                           // Equation (29)
+      asymmetry_factor_ = (Qext_ - Qpr_)/Qsca_;               // Equation (32)
     }
-    double x2 = pow2(x.back());
-    Qext_ = 2.0*(Qext_)/x2;                                 // Equation (27)
-    Qsca_ = 2.0*(Qsca_)/x2;                                 // Equation (28)
-    Qpr_ = Qext_ - 4.0*(Qpr_)/x2;                           // Equation (29)
-    Qabs_ = Qext_ - Qsca_;                                  // Equation (30)
-    albedo_ = Qsca_/Qext_;                                  // Equation (31)
-    asymmetry_factor_ = (Qext_ - Qpr_)/Qsca_;               // Equation (32)
-    Qbk_ = (Qbktmp.real()*Qbktmp.real() + Qbktmp.imag()*Qbktmp.imag())/x2;    // Equation (33)
-
-    isMieCalculated_ = true;
+
+    if (mask & kBackscattering) {
+      std::complex<FloatType> Qbktmp(0.0, 0.0);
+      for (int i = nmax_ - 2; i >= 0; i--) {
+        const int n = i + 1;
+        // Equation (33)
+        Qbktmp += FloatType((n + n + 1.0)*(1.0 - 2.0*(n % 2)))*(an_[i]- bn_[i]);
+      }
+      Qbk_ = (Qbktmp.real()*Qbktmp.real() + Qbktmp.imag()*Qbktmp.imag())/x2;    // Equation (33)
+      // At Theta = 180 deg Pi = (-1)^(n + 1)*n*(n + 1)/2 and Tau = -Pi, hence
+      // equations (25a) - (25b) reduce to the same sum used for Qbk
+      ctx.S1_back_ = FloatType(-0.5)*Qbktmp;
+      ctx.S2_back_ = FloatType(0.5)*Qbktmp;
+    }
+
+    // Calculate the scattering amplitudes (S1 and S2). Angular functions
+    // are calculated only once for all orders and angles.
+    if ((mask & kAmplitudes) && angle_count > 0) {
+      calcPiTauTable(ctx, first_angle, angle_count);
+      calcS1S2(ctx);
+    }
+
+    ctx.isMieCalculated_ = true;
+  }
+
+
+  // ********************************************************************** //
+  // Calculate the scattering parameters and amplitudes for all the angles  //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunMieCalculation(BasicMieContext<FloatType>& ctx) const {
+    RunMieCalculation(ctx, 0, theta_.size());
+  }
+
+
+  // ********************************************************************** //
+  // Calculate the scattering parameters and amplitudes using the internal  //
+  // context. The scattering coefficients are always recalculated.          //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunMieCalculation() {
+    ctx_.MarkUncalculated();
+    RunMieCalculation(ctx_);
   }
 
 
@@ -1043,15 +1613,20 @@ namespace nmie {
   // Return value:                                                                    //
   //   Number of multipolar expansion terms used for the calculations                 //
   //**********************************************************************************//
-  void MultiLayerMie::calcExpanCoeffs() {
-    if (!isScaCoeffsCalc_)
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcExpanCoeffs(BasicMieContext<FloatType>& ctx) const {
+    if (!ctx.isScaCoeffsCalc_)
       throw std::invalid_argument("(ExpanCoeffs) You should calculate external coefficients first!");
 
-    isExpCoeffsCalc_ = false;
+    ctx.isExpCoeffsCalc_ = false;
 
-    std::complex<double> c_one(1.0, 0.0), c_zero(0.0, 0.0);
+    std::complex<FloatType> c_one(1.0, 0.0), c_zero(0.0, 0.0);
 
     const int L = refractive_index_.size();
+    const int nmax_ = ctx.nmax_;
+    const std::vector<std::complex<FloatType> > &an_ = ctx.an_, &bn_ = ctx.bn_;
+    std::vector< std::vector<std::complex<FloatType> > > &aln_ = ctx.aln_, &bln_ = ctx.bln_,
+                                                      &cln_ = ctx.cln_, &dln_ = ctx.dln_;
 
     aln_.resize(L + 1);
     bln_.resize(L + 1);
@@ -1073,18 +1648,19 @@ namespace nmie {
       dln_[L][n] = c_one;
     }
 
-    std::vector<std::complex<double> > D1z(nmax_ + 1), D1z1(nmax_ + 1), D3z(nmax_ + 1), D3z1(nmax_ + 1);
-    std::vector<std::complex<double> > Psiz(nmax_ + 1), Psiz1(nmax_ + 1), Zetaz(nmax_ + 1), Zetaz1(nmax_ + 1);
-    std::complex<double> denomZeta, denomPsi, T1, T2, T3, T4;
+    BasicMieWorkspace<FloatType>& ws_ = ctx.ws_;
+    ws_.Reserve(ctx.nmax_full_, L);
+    std::vector<std::complex<FloatType> > &D1z = ws_.D1z, &D1z1 = ws_.D1z1, &D3z = ws_.D3z, &D3z1 = ws_.D3z1;
+    std::vector<std::complex<FloatType> > &Psiz = ws_.Psiz, &Psiz1 = ws_.Psiz1, &Zetaz = ws_.Zetaz, &Zetaz1 = ws_.Zetaz1;
+    std::complex<FloatType> denomZeta, denomPsi, T1, T2, T3, T4;
 
     auto& m = refractive_index_;
-    std::vector< std::complex<double> > m1(L);
-
-    for (int l = 0; l < L - 1; l++) m1[l] = m[l + 1];
-    m1[L - 1] = std::complex<double> (1.0, 0.0);
+    // Index of the next layer (the host medium for the last one)
+    std::complex<FloatType> m1l;
 
-    std::complex<double> z, z1;
+    std::complex<FloatType> z, z1;
     for (int l = L - 1; l >= 0; l--) {
+      m1l = (l < L - 1) ? m[l + 1] : c_one;
       if (l <= PEC_layer_position_) { // We are inside a PEC. All coefficients must be zero!!!
         for (int n = 0; n < nmax_; n++) {
           // aln
@@ -1098,12 +1674,10 @@ namespace nmie {
         }
       } else { // Regular material, just do the calculation
         z = size_param_[l]*m[l];
-        z1 = size_param_[l]*m1[l];
+        z1 = size_param_[l]*m1l;
 
-        calcD1D3(z, D1z, D3z);
-        calcD1D3(z1, D1z1, D3z1);
-        calcPsiZeta(z, Psiz, Zetaz);
-        calcPsiZeta(z1, Psiz1, Zetaz1);
+        calcRiccatiBessel(ctx, z, D1z.data(), D3z.data(), Psiz.data(), Zetaz.data());
+        calcRiccatiBessel(ctx, z1, D1z1.data(), D3z1.data(), Psiz1.data(), Zetaz1.data());
 
         for (int n = 0; n < nmax_; n++) {
           int n1 = n + 1;
@@ -1112,9 +1686,9 @@ namespace nmie {
           denomPsi  =  Psiz[n1]*(D1z[n1] - D3z[n1]);
 
           T1 =  aln_[l + 1][n]*Zetaz1[n1] - dln_[l + 1][n]*Psiz1[n1];
-          T2 = (bln_[l + 1][n]*Zetaz1[n1] - cln_[l + 1][n]*Psiz1[n1])*m[l]/m1[l];
+          T2 = (bln_[l + 1][n]*Zetaz1[n1] - cln_[l + 1][n]*Psiz1[n1])*m[l]/m1l;
 
-          T3 = (dln_[l + 1][n]*D1z1[n1]*Psiz1[n1] - aln_[l + 1][n]*D3z1[n1]*Zetaz1[n1])*m[l]/m1[l];
+          T3 = (dln_[l + 1][n]*D1z1[n1]*Psiz1[n1] - aln_[l + 1][n]*D3z1[n1]*Zetaz1[n1])*m[l]/m1l;
           T4 =  cln_[l + 1][n]*D1z1[n1]*Psiz1[n1] - bln_[l + 1][n]*D3z1[n1]*Zetaz1[n1];
 
           // aln
@@ -1130,23 +1704,24 @@ namespace nmie {
     }  // end of all l
 
     // Check the result and change  aln_[0][n] and aln_[0][n] for exact zero
+    const FloatType zero_tol = std::max<FloatType>(1e-10, 1e4*std::numeric_limits<FloatType>::epsilon());
     for (int n = 0; n < nmax_; ++n) {
-      if (std::abs(aln_[0][n]) < 1e-10) aln_[0][n] = 0.0;
+      if (std::abs(aln_[0][n]) < zero_tol) aln_[0][n] = 0.0;
       else {
         //throw std::invalid_argument("Unstable calculation of aln_[0][n]!");
-        printf("Warning: Potentially unstable calculation of aln (aln[0][%i] = %g, %gi)\n", n, aln_[0][n].real(), aln_[0][n].imag());
+        printf("Warning: Potentially unstable calculation of aln (aln[0][%i] = %g, %gi)\n", n, static_cast<double>(aln_[0][n].real()), static_cast<double>(aln_[0][n].imag()));
         aln_[0][n] = 0.0;
       }
-      if (std::abs(bln_[0][n]) < 1e-10) bln_[0][n] = 0.0;
+      if (std::abs(bln_[0][n]) < zero_tol) bln_[0][n] = 0.0;
       else {
         //throw std::invalid_argument("Unstable calculation of bln_[0][n]!");
-        printf("Warning: Potentially unstable calculation of bln (bln[0][%i] = %g, %gi) pl=%d\n", n, bln_[0][n].real(), bln_[0][n].imag(), PEC_layer_position_);
+        printf("Warning: Potentially unstable calculation of bln (bln[0][%i] = %g, %gi) pl=%d\n", n, static_cast<double>(bln_[0][n].real()), static_cast<double>(bln_[0][n].imag()), PEC_layer_position_);
         bln_[0][n] = 0.0;
       }
     }
 
-    isExpCoeffsCalc_ = true;
-  }  // end of   void MultiLayerMie::calcExpanCoeffs()
+    ctx.isExpCoeffsCalc_ = true;
+  }  // end of   void MultiLayerMie::calcExpanCoeffs(...)
 
 
   //**********************************************************************************//
@@ -1155,34 +1730,49 @@ namespace nmie {
   //                                                                                  //
   // Input parameters (coordinates of the point):                                     //
   //   Rho: Radial distance                                                           //
-  //   Phi: Azimuthal angle                                                           //
-  //   Theta: Polar angle                                                             //
+  //   sin_theta, cos_theta: Sine and cosine of the polar angle                       //
+  //   cos_phi, sin_phi: Cosine and sine of the azimuthal angle                       //
   //                                                                                  //
   // Output parameters:                                                               //
   //   E, H: Complex electric and magnetic fields                                     //
+  //                                                                                  //
+  // For the incident plane wave (polarized along x) Er, Etheta and Hphi are          //
+  // proportional to cos(Phi) and Ephi, Hr and Htheta to sin(Phi), so cos_phi =       //
+  // sin_phi = 1 gives the amplitudes of those dependences (see                       //
+  // RunFieldCalculationPolar). The functions of Rho*ml and Theta are stored in the   //
+  // workspace of the context, hence no memory is allocated.                          //
   //**********************************************************************************//
-  void MultiLayerMie::calcField(const double Rho, const double Theta, const double Phi,
-                                std::vector<std::complex<double> >& E, std::vector<std::complex<double> >& H)  {
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcField(BasicMieContext<FloatType>& ctx, const FloatType Rho, const FloatType sin_theta,
+                                                const FloatType cos_theta, const FloatType cos_phi, const FloatType sin_phi,
+                                                FieldVector& E, FieldVector& H) const {
+    BasicMieWorkspace<FloatType>& ws = ctx.ws_;
+    ws.Reserve(ctx.nmax_full_, size_param_.size());
 
-    std::complex<double> c_zero(0.0, 0.0), c_i(0.0, 1.0), c_one(1.0, 0.0);
-    std::vector<std::complex<double> > ipow = {c_one, c_i, -c_one, -c_i}; // Vector containing precomputed integer powers of i to avoid computation
-    std::vector<std::complex<double> > M3o1n(3), M3e1n(3), N3o1n(3), N3e1n(3);
-    std::vector<std::complex<double> > M1o1n(3), M1e1n(3), N1o1n(3), N1e1n(3);
-    std::vector<std::complex<double> > Psi(nmax_ + 1), D1n(nmax_ + 1), Zeta(nmax_ + 1), D3n(nmax_ + 1);
-    std::vector<double> Pi(nmax_), Tau(nmax_);
+    std::complex<FloatType> ml;
+    const int l = calcFieldLayer(Rho, ml);
 
-    int l = 0;  // Layer number
-    std::complex<double> ml;
+    // Calculate Ricatti-Bessel functions and their logarithmic derivatives
+    calcRiccatiBessel(ctx, Rho*ml, ws.D1Rho.data(), ws.D3Rho.data(), ws.PsiRho.data(), ws.ZetaRho.data());
 
-    // Initialize E and H
-    for (int i = 0; i < 3; i++) {
-      E[i] = c_zero;
-      H[i] = c_zero;
-    }
-    
+    // Calculate angular functions Pi and Tau
+    calcPiTau(ctx.nmax_, cos_theta, ws.Pi, ws.Tau);
+
+    calcFieldSum(ctx, Rho, l, ml, sin_theta, cos_phi, sin_phi, ws.PsiRho.data(), ws.D1Rho.data(),
+                 ws.ZetaRho.data(), ws.D3Rho.data(), ws.Pi.data(), ws.Tau.data(), E, H);
+  }  // end of MultiLayerMie::calcField(...)
+
+
+  //**********************************************************************************//
+  // Layer that contains the radial distance Rho (the number of layers outside the    //
+  // particle) and its refractive index ml.                                           //
+  //**********************************************************************************//
+  template <typename FloatType>
+  int BasicMultiLayerMie<FloatType>::calcFieldLayer(const FloatType Rho, std::complex<FloatType>& ml) const {
+    int l = 0;  // Layer number
     if (Rho > size_param_.back()) {
       l = size_param_.size();
-      ml = c_one;
+      ml = std::complex<FloatType>(1.0, 0.0);
     } else {
       for (int i = size_param_.size() - 1; i >= 0 ; i--) {
         if (Rho <= size_param_[i]) {
@@ -1191,25 +1781,57 @@ namespace nmie {
       }
       ml = refractive_index_[l];
     }
+    return l;
+  }
 
-    // Calculate logarithmic derivative of the Ricatti-Bessel functions
-    calcD1D3(Rho*ml, D1n, D3n);
-    // Calculate Ricatti-Bessel functions
-    calcPsiZeta(Rho*ml, Psi, Zeta);
 
-    // Calculate angular functions Pi and Tau
-    calcPiTau(std::cos(Theta), Pi, Tau);
+  //**********************************************************************************//
+  // Sum of the multipole expansion of the fields at a point in layer l, from the     //
+  // Riccati-Bessel functions of Rho*ml and the angular functions of Theta.           //
+  //                                                                                  //
+  // Input parameters:                                                                //
+  //   Rho: Radial distance                                                           //
+  //   l, ml: Layer of the point and its refractive index (see calcFieldLayer)        //
+  //   sin_theta, cos_phi, sin_phi: see calcSpherHarm                                 //
+  //   Psi, D1n, Zeta, D3n: Riccati-Bessel functions of Rho*ml, [0..nmax_full_]       //
+  //   Pi, Tau: Angular functions, [0..nmax_ - 1]                                     //
+  //                                                                                  //
+  // Output parameters:                                                               //
+  //   E, H: Complex electric and magnetic fields in spherical coordinates            //
+  //**********************************************************************************//
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcFieldSum(BasicMieContext<FloatType>& ctx, const FloatType Rho, const int l,
+                                                   const std::complex<FloatType> ml, const FloatType sin_theta,
+                                                   const FloatType cos_phi, const FloatType sin_phi,
+                                                   const std::complex<FloatType>* Psi, const std::complex<FloatType>* D1n,
+                                                   const std::complex<FloatType>* Zeta, const std::complex<FloatType>* D3n,
+                                                   const FloatType* Pi, const FloatType* Tau,
+                                                   FieldVector& E, FieldVector& H) const {
+    const int nmax_ = ctx.nmax_;
+    const std::vector< std::vector<std::complex<FloatType> > > &aln_ = ctx.aln_, &bln_ = ctx.bln_,
+                                                            &cln_ = ctx.cln_, &dln_ = ctx.dln_;
+
+    std::complex<FloatType> c_zero(0.0, 0.0), c_i(0.0, 1.0), c_one(1.0, 0.0);
+    const std::complex<FloatType> ipow[4] = {c_one, c_i, -c_one, -c_i}; // Precomputed integer powers of i to avoid computation
+    FieldVector M3o1n, M3e1n, N3o1n, N3e1n;
+    FieldVector M1o1n, M1e1n, N1o1n, N1e1n;
+
+    // Initialize E and H
+    for (int i = 0; i < 3; i++) {
+      E[i] = c_zero;
+      H[i] = c_zero;
+    }
 
     for (int n = nmax_ - 2; n >= 0; n--) {
       int n1 = n + 1;
-      double rn = static_cast<double>(n1);
+      FloatType rn = static_cast<FloatType>(n1);
 
       // using BH 4.12 and 4.50
-      calcSpherHarm(Rho*ml, Theta, Phi, Psi[n1], D1n[n1], Pi[n], Tau[n], rn, M1o1n, M1e1n, N1o1n, N1e1n);
-      calcSpherHarm(Rho*ml, Theta, Phi, Zeta[n1], D3n[n1], Pi[n], Tau[n], rn, M3o1n, M3e1n, N3o1n, N3e1n);
+      calcSpherHarm(Rho*ml, sin_theta, cos_phi, sin_phi, Psi[n1], D1n[n1], Pi[n], Tau[n], rn, M1o1n, M1e1n, N1o1n, N1e1n);
+      calcSpherHarm(Rho*ml, sin_theta, cos_phi, sin_phi, Zeta[n1], D3n[n1], Pi[n], Tau[n], rn, M3o1n, M3e1n, N3o1n, N3e1n);
 
       // Total field in the lth layer: eqs. (1) and (2) in Yang, Appl. Opt., 42 (2003) 1710-1720
-      std::complex<double> En = ipow[n1 % 4]*(rn + rn + 1.0)/(rn*rn + rn);
+      std::complex<FloatType> En = ipow[n1 % 4]*(rn + rn + FloatType(1.0))/(rn*rn + rn);
       for (int i = 0; i < 3; i++) {
         // electric field E [V m - 1] = EF*E0
         E[i] += En*(cln_[l][n]*M1o1n[i] - c_i*dln_[l][n]*N1e1n[i]
@@ -1221,11 +1843,58 @@ namespace nmie {
     }  // end of for all n
 
     // magnetic field
-    std::complex<double> hffact = ml/(cc_*mu_);
+    std::complex<FloatType> hffact = ml/FloatType(cc_*mu_);
     for (int i = 0; i < 3; i++) {
       H[i] = hffact*H[i];
     }
-   }  // end of MultiLayerMie::calcField(...)
+  }  // end of MultiLayerMie::calcFieldSum(...)
+
+
+  //**********************************************************************************//
+  // Spherical coordinates of the point (Xp, Yp, Zp). Rho is limited to 1e-5 to       //
+  // avoid convergence problems.                                                      //
+  //**********************************************************************************//
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcSphericalCoords(const FloatType Xp, const FloatType Yp, const FloatType Zp,
+                                                          FloatType& Rho, FloatType& Theta, FloatType& Phi) {
+    // Convert to spherical coordinates
+    Rho = std::sqrt(pow2(Xp) + pow2(Yp) + pow2(Zp));
+
+    // If Rho=0 then Theta is undefined. Just set it to zero to avoid problems
+    Theta = (Rho > 0.0) ? std::acos(Zp/Rho) : 0.0;
+
+    // If Xp=Yp=0 then Phi is undefined. Just set it to zero to avoid problems
+    if (Xp == 0.0)
+      Phi = (Yp != 0.0) ? std::asin(Yp/std::sqrt(pow2(Xp) + pow2(Yp))) : 0.0;
+    else
+      Phi = (Yp < 0.0 ? -1.0 : 1.0)*std::acos(Xp/std::sqrt(pow2(Xp) + pow2(Yp)));
+
+    // Avoid convergence problems due to Rho too small
+    if (Rho < 1e-5) Rho = 1e-5;
+  }
+
+
+  //**********************************************************************************//
+  // Cartesian components of the fields at a point with polar angle Theta and         //
+  // azimuthal angle Phi, from the amplitudes Es and Hs of their dependences on Phi   //
+  // (see calcField with cos_phi = sin_phi = 1).                                      //
+  //**********************************************************************************//
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcFieldCartesian(const FloatType sin_theta, const FloatType cos_theta,
+                                                         const FloatType cos_phi, const FloatType sin_phi,
+                                                         const FieldVector& Es, const FieldVector& Hs,
+                                                         std::complex<FloatType>* E, std::complex<FloatType>* H) {
+    const FloatType c = cos_phi, s = sin_phi;
+    const std::complex<FloatType> Er = c*Es[0], Et = c*Es[1], Ep = s*Es[2];
+    const std::complex<FloatType> Hr = s*Hs[0], Ht = s*Hs[1], Hp = c*Hs[2];
+    E[0] = sin_theta*c*Er + cos_theta*c*Et - s*Ep;
+    E[1] = sin_theta*s*Er + cos_theta*s*Et + c*Ep;
+    E[2] = cos_theta*Er - sin_theta*Et;
+
+    H[0] = sin_theta*c*Hr + cos_theta*c*Ht - s*Hp;
+    H[1] = sin_theta*s*Hr + cos_theta*s*Ht + c*Hp;
+    H[2] = cos_theta*Hr - sin_theta*Ht;
+  }
 
 
   //**********************************************************************************//
@@ -1250,64 +1919,631 @@ namespace nmie {
   // Return value:                                                                    //
   //   Number of multipolar expansion terms used for the calculations                 //
   //**********************************************************************************//
-  void MultiLayerMie::RunFieldCalculation() {
-    double Rho, Theta, Phi;
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunFieldCalculation(BasicMieContext<FloatType>& ctx, const unsigned long first_point,
+                                                          const unsigned long point_count) const {
+    if (coords_.size() != 3 || first_point + point_count > coords_[0].size())
+      throw std::invalid_argument("Requested field points are out of range!");
+
+    // Calculate scattering coefficients an_ and bn_ and expansion coefficients
+    // aln_, bln_, cln_, and dln_, unless this context already has them for the
+    // current model
+    if (!ctx.isExpCoeffsCalc_ || ctx.model_ != this || ctx.revision_ != revision_) {
+      calcScattCoeffs(ctx);
+      calcExpanCoeffs(ctx);
+    }
+
+    ctx.E_.resize(point_count);
+    ctx.H_.resize(point_count);
+    for (auto& f : ctx.E_) f.resize(3);
+    for (auto& f : ctx.H_) f.resize(3);
+
+    calcFieldPoints(ctx, first_point, point_count, ctx.E_.data(), ctx.H_.data());
+  }  //  end of MultiLayerMie::RunFieldCalculation(...)
+
+
+  //**********************************************************************************//
+  // Fields of simd::GetFieldKernel<FloatType>().lanes points of layer l (refractive  //
+  // index ml), one point per lane. It follows calcRiccatiBessel, calcPiTau and       //
+  // calcFieldSum with the same instructions for all the lanes. The lane arrays rho,  //
+  // sin_theta and cos_theta hold the coordinates of the points. EH receives the      //
+  // amplitudes of the cos(Phi) and sin(Phi) dependences (see calcField) of Er,       //
+  // Etheta, Ephi, Hr, Htheta and Hphi, as a lane array of 6 elements (see            //
+  // simd::CPack). The vector parts run in the kernel selected for the CPU.           //
+  //**********************************************************************************//
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcFieldLanes(BasicMieContext<FloatType>& ctx, const int l,
+                                                     const std::complex<FloatType> ml, const FloatType* rho,
+                                                     const FloatType* sin_theta, const FloatType* cos_theta,
+                                                     FloatType* EH) const {
+    const simd::FieldKernel<FloatType>& kernel = simd::GetFieldKernel<FloatType>();
+    const int K = kernel.lanes;
+    const int nmax_ = ctx.nmax_, nfull = ctx.nmax_full_;
+    const std::complex<FloatType> I(0.0, 1.0);
+
+    // Lane arrays of the workspace (allocated only for a new maximum of nmax)
+    const unsigned long stride = 2*K*(nfull + 1), size = 5*stride + 2*K*nmax_ + 8*nmax_ + 10*K;
+    std::vector<FloatType>& lanes = ctx.ws_.FieldLanes;
+    if (lanes.size() < size) lanes.resize(size);
+    simd::FieldLanes<FloatType> f;
+    f.nmax = nmax_;
+    f.nfull = nfull;
+    f.sin_theta = sin_theta;
+    f.cos_theta = cos_theta;
+    f.D1 = lanes.data();
+    f.D3 = f.D1 + stride;
+    f.Psi = f.D3 + stride;
+    f.Zeta = f.Psi + stride;
+    f.PsiZeta = f.Zeta + stride;
+    f.Pi = f.PsiZeta + stride;
+    f.Tau = f.Pi + K*nmax_;
+    FloatType *coeffs = f.Tau + K*nmax_, *zinv = coeffs + 8*nmax_, *fix = zinv + 2*K;
+    f.coeffs = coeffs;
+    f.zinv = zinv;
+    f.fix = fix;
+    f.EH = EH;
+
+    //*************************************************//
+    // Riccati-Bessel functions of z = Rho*ml          //
+    //*************************************************//
+    std::complex<FloatType> z[simd::kMaxFieldLanes];
+    for (int k = 0; k < K; k++) {
+      z[k] = rho[k]*ml;
+      simd::SetLane(zinv, K, 0, k, std::complex<FloatType>(1.0, 0.0)/z[k]);
+      simd::SetLane(f.D1, K, nfull, k, calcD1Start(nfull, z[k]));
+    }
+    kernel.Downward(f);
+
+    // Lanes close to the pole of D1[0] use the explicit expressions for n = 1
+    int pole[simd::kMaxFieldLanes];
+    f.pole = nullptr;
+    for (int k = 0; k < K; k++) {
+      simd::SetLane(f.PsiZeta, K, 0, k, FloatType(0.5)*(FloatType(1.0) - std::complex<FloatType>(std::cos(FloatType(2.0)*z[k].real()),
+                                                                                                 std::sin(FloatType(2.0)*z[k].real()))
+                                                       *std::exp(FloatType(-2.0)*z[k].imag())));
+      simd::SetLane(f.D3, K, 0, k, I);
+      simd::SetLane(f.Psi, K, 0, k, std::sin(z[k]));
+      simd::SetLane(f.Zeta, K, 0, k, std::sin(z[k]) - I*std::cos(z[k]));
+      pole[k] = std::abs(simd::GetLane(f.D1, K, 0, k)) > 1.0e4;
+      if (!pole[k]) continue;
+      f.pole = pole;
+      const std::complex<FloatType> zi = simd::GetLane(zinv, K, 0, k);
+      const std::complex<FloatType> Psi1 = std::sin(z[k])*zi - std::cos(z[k]);
+      const std::complex<FloatType> Zeta1 = (std::sin(z[k]) - I*std::cos(z[k]))*(zi - I);
+      simd::SetLane(fix, K, 0, k, Psi1*Zeta1);
+      simd::SetLane(fix, K, 1, k, simd::GetLane(f.D1, K, 1, k) + I/(Psi1*Zeta1));
+      simd::SetLane(fix, K, 2, k, Psi1);
+      simd::SetLane(fix, K, 3, k, Zeta1);
+    }
+
+    //*************************************************//
+    // Coefficients of the multipole sums              //
+    //*************************************************//
+    const std::complex<FloatType> c_one(1.0, 0.0);
+    const std::complex<FloatType> ipow[4] = {c_one, I, -c_one, -I};
+    for (int n = 0; n < nmax_ - 1; n++) {
+      const int n1 = n + 1;
+      const FloatType rn = static_cast<FloatType>(n1);
+      const std::complex<FloatType> En = ipow[n1 % 4]*(rn + rn + FloatType(1.0))/(rn*rn + rn);
+      const std::complex<FloatType> c[4] = {En*ctx.aln_[l][n], En*ctx.bln_[l][n], En*ctx.cln_[l][n], En*ctx.dln_[l][n]};
+      for (int j = 0; j < 4; j++) {
+        coeffs[8*n + 2*j] = c[j].real();
+        coeffs[8*n + 2*j + 1] = c[j].imag();
+      }
+    }
+    const std::complex<FloatType> hffact = ml/FloatType(cc_*mu_);
+    f.hffact[0] = hffact.real();
+    f.hffact[1] = hffact.imag();
+
+    kernel.Sums(f);
+  }  // end of MultiLayerMie::calcFieldLanes(...)
+
+
+  // ********************************************************************** //
+  // Amplitudes Es and Hs (see calcField) of count points of coordinates    //
+  // rho, sin_theta and cos_theta and layer given by layer. The points are  //
+  // sorted by layer in order and calculated in groups of points of the     //
+  // same layer, one per lane of the field kernel, with calcFieldLanes. The //
+  // unused lanes of a group repeat its last point, so the result of each   //
+  // point does not depend on the points calculated with it.                //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcFieldAmplitudes(BasicMieContext<FloatType>& ctx, const unsigned long count,
+                                                          const int* layer, unsigned long* order, const FloatType* rho,
+                                                          const FloatType* sin_theta, const FloatType* cos_theta,
+                                                          FieldVector* Es, FieldVector* Hs) const {
+    const unsigned long K = simd::GetFieldKernel<FloatType>().lanes;
+    const int L = size_param_.size();
+
+    // Sort the points by layer
+    unsigned long sorted = 0;
+    for (int l = 0; l <= L; l++) {
+      for (unsigned long p = 0; p < count; p++)
+        if (layer[p] == l) order[sorted++] = p;
+    }
+
+    FloatType lane_rho[simd::kMaxFieldLanes], lane_sin_theta[simd::kMaxFieldLanes];
+    FloatType lane_cos_theta[simd::kMaxFieldLanes], EH[12*simd::kMaxFieldLanes];
+    for (unsigned long first = 0, lanes; first < count; first += lanes) {
+      const int l = layer[order[first]];
+      for (lanes = 1; lanes < K && first + lanes < count && layer[order[first + lanes]] == l; lanes++) {}
+      for (unsigned long k = 0; k < K; k++) {
+        const unsigned long p = order[first + std::min(k, lanes - 1)];
+        lane_rho[k] = rho[p];
+        lane_sin_theta[k] = sin_theta[p];
+        lane_cos_theta[k] = cos_theta[p];
+      }
+      calcFieldLanes(ctx, l, l < L ? refractive_index_[l] : std::complex<FloatType>(1.0, 0.0),
+                     lane_rho, lane_sin_theta, lane_cos_theta, EH);
+
+      for (unsigned long k = 0; k < lanes; k++) {
+        const unsigned long p = order[first + k];
+        for (int c = 0; c < 3; c++) {
+          Es[p][c] = simd::GetLane(EH, K, c, k);
+          Hs[p][c] = simd::GetLane(EH, K, c + 3, k);
+        }
+      }
+    }
+  }
+
+
+  // ********************************************************************** //
+  // Calculate the fields at the coordinates [first_point, first_point +    //
+  // point_count) and store them in E_[0..point_count - 1] and H_. The      //
+  // context must already have the expansion coefficients of the model.     //
+  // Points are taken in blocks, whose amplitudes are calculated by         //
+  // calcFieldAmplitudes.                                                   //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcFieldPoints(BasicMieContext<FloatType>& ctx, const unsigned long first_point,
+                                                      const unsigned long point_count,
+                                                      std::vector<std::complex<FloatType> >* E_,
+                                                      std::vector<std::complex<FloatType> >* H_) const {
+    const int kBlock = 256;
+
+    BasicMieWorkspace<FloatType>& ws = ctx.ws_;
+    if (ws.FieldPoints.size() < 5*kBlock) ws.FieldPoints.resize(5*kBlock);
+    if (ws.FieldLayer.size() < kBlock) ws.FieldLayer.resize(kBlock);
+    if (ws.FieldOrder.size() < kBlock) ws.FieldOrder.resize(kBlock);
+    if (ws.FieldAmplitudes.size() < 2*kBlock) ws.FieldAmplitudes.resize(2*kBlock);
+    FloatType *rho = ws.FieldPoints.data(), *sin_theta = rho + kBlock, *cos_theta = sin_theta + kBlock;
+    FloatType *cos_phi = cos_theta + kBlock, *sin_phi = cos_phi + kBlock;
+    int *layer = ws.FieldLayer.data();
+    FieldVector *Es = ws.FieldAmplitudes.data(), *Hs = Es + kBlock;
+
+    for (unsigned long block = 0; block < point_count; block += kBlock) {
+      const int count = std::min<unsigned long>(kBlock, point_count - block);
+      for (int p = 0; p < count; p++) {
+        const unsigned long point = first_point + block + p;
+        FloatType Rho, Theta, Phi;
+        calcSphericalCoords(coords_[0][point], coords_[1][point], coords_[2][point], Rho, Theta, Phi);
+        rho[p] = Rho;
+        sin_theta[p] = std::sin(Theta);
+        cos_theta[p] = std::cos(Theta);
+        cos_phi[p] = std::cos(Phi);
+        sin_phi[p] = std::sin(Phi);
+        std::complex<FloatType> ml;
+        layer[p] = calcFieldLayer(Rho, ml);
+      }
+
+      calcFieldAmplitudes(ctx, count, layer, ws.FieldOrder.data(), rho, sin_theta, cos_theta, Es, Hs);
+      for (int p = 0; p < count; p++)
+        calcFieldCartesian(sin_theta[p], cos_theta[p], cos_phi[p], sin_phi[p], Es[p], Hs[p],
+                           E_[block + p].data(), H_[block + p].data());
+    }
+  }
+
+
+  // ********************************************************************** //
+  // Calculate the fields at all the coordinates                            //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunFieldCalculation(BasicMieContext<FloatType>& ctx) const {
+    if (coords_.size() != 3)
+      throw std::invalid_argument("Error! Wrong dimension of field monitor points!");
+    RunFieldCalculation(ctx, 0, coords_[0].size());
+  }
+
+
+  // ********************************************************************** //
+  // Calculate the fields using the internal context. The scattering and    //
+  // expansion coefficients are always recalculated. The points are split   //
+  // in chunks run by the threads of the pool, each one with its own        //
+  // context (the internal one for thread 0), and the fields are written    //
+  // directly at their place in the internal context.                       //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunFieldCalculation(ThreadPool& pool) {
+    if (coords_.size() != 3)
+      throw std::invalid_argument("Error! Wrong dimension of field monitor points!");
+    ctx_.isScaCoeffsCalc_ = false;
+    ctx_.isExpCoeffsCalc_ = false;
+    calcScattCoeffs(ctx_);
+    calcExpanCoeffs(ctx_);
+
+    const unsigned long points = coords_[0].size();
+    ctx_.E_.resize(points);
+    ctx_.H_.resize(points);
+    for (auto& f : ctx_.E_) f.resize(3);
+    for (auto& f : ctx_.H_) f.resize(3);
+
+    if (thread_ctx_.size() + 1 < pool.GetThreadCount())
+      thread_ctx_.resize(pool.GetThreadCount() - 1);
+    for (auto& ctx : thread_ctx_) ctx.isExpCoeffsCalc_ = false;
+
+    // Small chunks balance the cost of the points inside and outside the
+    // particle
+    const unsigned long chunk = std::max(1ul, std::min(1024ul, points/(8*pool.GetThreadCount())));
+    pool.ParallelFor(points, chunk, [&](unsigned long first, unsigned long count, unsigned int thread) {
+        BasicMieContext<FloatType>& ctx = thread == 0 ? ctx_ : thread_ctx_[thread - 1];
+        if (!ctx.isExpCoeffsCalc_ || ctx.model_ != this || ctx.revision_ != revision_) {
+          calcScattCoeffs(ctx);
+          calcExpanCoeffs(ctx);
+        }
+        calcFieldPoints(ctx, first, count, ctx_.E_.data() + first, ctx_.H_.data() + first);
+      });
+  }
+
+  // ********************************************************************** //
+  // Calculate the fields on the points (Rho[i], Theta[i], Phi[j]) using    //
+  // the azimuthal dependence of the plane-wave expansion                   //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunFieldCalculationPolar(BasicMieContext<FloatType>& ctx,
+                                                               const std::vector<FloatType>& Rho,
+                                                               const std::vector<FloatType>& Theta,
+                                                               const std::vector<FloatType>& Phi) const {
+    if (Rho.size() != Theta.size())
+      throw std::invalid_argument("Rho and Theta must have the same size!");
+
+    if (!ctx.isExpCoeffsCalc_ || ctx.model_ != this || ctx.revision_ != revision_) {
+      calcScattCoeffs(ctx);
+      calcExpanCoeffs(ctx);
+    }
+
+    const unsigned long nphi = Phi.size();
+    std::vector<std::vector< std::complex<FloatType> > > &E_ = ctx.E_, &H_ = ctx.H_;
+    E_.resize(Rho.size()*nphi);
+    H_.resize(Rho.size()*nphi);
+    for (auto& f : E_) f.resize(3);
+    for (auto& f : H_) f.resize(3);
+
+    std::vector<FloatType> cos_phi(nphi), sin_phi(nphi);
+    for (unsigned long j = 0; j < nphi; j++) {
+      cos_phi[j] = std::cos(Phi[j]);
+      sin_phi[j] = std::sin(Phi[j]);
+    }
+
+    // Amplitudes of the cos(Phi) (Er, Etheta, Hphi) and sin(Phi) (Ephi, Hr,
+    // Htheta) dependences
+    FieldVector Es, Hs;
+    for (unsigned long i = 0; i < Rho.size(); i++) {
+      // Avoid convergence problems due to Rho too small
+      const FloatType rho = Rho[i] < 1e-5 ? FloatType(1e-5) : Rho[i];
+      const FloatType sin_theta = std::sin(Theta[i]), cos_theta = std::cos(Theta[i]);
+      calcField(ctx, rho, sin_theta, cos_theta, FloatType(1.0), FloatType(1.0), Es, Hs);
+
+      for (unsigned long j = 0; j < nphi; j++)
+        calcFieldCartesian(sin_theta, cos_theta, cos_phi[j], sin_phi[j], Es, Hs,
+                           E_[i*nphi + j].data(), H_[i*nphi + j].data());
+    }
+  }
+
+
+  // ********************************************************************** //
+  // Same as above, using the internal context                              //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunFieldCalculationPolar(const std::vector<FloatType>& Rho,
+                                                               const std::vector<FloatType>& Theta,
+                                                               const std::vector<FloatType>& Phi) {
+    ctx_.isScaCoeffsCalc_ = false;
+    ctx_.isExpCoeffsCalc_ = false;
+    RunFieldCalculationPolar(ctx_, Rho, Theta, Phi);
+  }
+
+
+  //**********************************************************************************//
+  // Radial terms of the multipole sums of the fields at the distance Rho of layer l  //
+  // (refractive index ml), for the kernel Angular (see nmie-field-lanes.h). They     //
+  // include the expansion coefficients and the radial parts of the vector spherical  //
+  // harmonics, so the fields of any point at this distance only need its angular     //
+  // functions. The terms of order n + 1 are stored in terms[12*n..12*n + 11] (see    //
+  // calcFieldLanes for the expressions).                                             //
+  //**********************************************************************************//
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcFieldRadial(BasicMieContext<FloatType>& ctx, const FloatType Rho, const int l,
+                                                      const std::complex<FloatType> ml, FloatType* terms) const {
+    BasicMieWorkspace<FloatType>& ws = ctx.ws_;
+    ws.Reserve(ctx.nmax_full_, size_param_.size());
+    const std::complex<FloatType> z = Rho*ml;
+    calcRiccatiBessel(ctx, z, ws.D1Rho.data(), ws.D3Rho.data(), ws.PsiRho.data(), ws.ZetaRho.data());
+
+    const std::complex<FloatType> c_one(1.0, 0.0), I(0.0, 1.0);
+    const std::complex<FloatType> ipow[4] = {c_one, I, -c_one, -I};
+    const std::complex<FloatType> zinv = c_one/z, hffact = ml/FloatType(cc_*mu_);
+    for (int n = 0; n < ctx.nmax_ - 1; n++) {
+      const int n1 = n + 1;
+      const FloatType rn = static_cast<FloatType>(n1);
+      const std::complex<FloatType> En = ipow[n1 % 4]*(rn + rn + FloatType(1.0))/(rn*rn + rn);
+      const std::complex<FloatType> ea = En*ctx.aln_[l][n], eb = En*ctx.bln_[l][n];
+      const std::complex<FloatType> ec = En*ctx.cln_[l][n], ed = En*ctx.dln_[l][n];
+      const std::complex<FloatType> A1 = ws.PsiRho[n1]*zinv, A3 = ws.ZetaRho[n1]*zinv;
+      const std::complex<FloatType> B1 = ws.D1Rho[n1]*A1, B3 = ws.D3Rho[n1]*A3;
+      const std::complex<FloatType> C1 = (rn*rn + rn)*(A1*zinv), C3 = (rn*rn + rn)*(A3*zinv);
+      const std::complex<FloatType> t[6] = {I*(ea*C3 - ed*C1), ec*A1 - eb*A3, I*(ea*B3 - ed*B1),
+                                            hffact*(I*(eb*C3 - ec*C1)), hffact*(ed*A1 - ea*A3),
+                                            hffact*(I*(eb*B3 - ec*B1))};
+      for (int j = 0; j < 6; j++) {
+        terms[12*n + 2*j] = t[j].real();
+        terms[12*n + 2*j + 1] = t[j].imag();
+      }
+    }
+  }
 
-    // Calculate scattering coefficients an_ and bn_
-    calcScattCoeffs();
 
-    // Calculate expansion coefficients aln_,  bln_, cln_, and dln_
-    calcExpanCoeffs();
+  //**********************************************************************************//
+  // Fields at the points with spherical coordinates (Rho[p], Theta[p], Phi[p]), Rho  //
+  // being already limited as in calcSphericalCoords. Points are sorted by Rho and    //
+  // Theta, so the multipole sums are calculated once per (Rho, Theta) pair. The      //
+  // values of Rho with at least one pair per lane calculate their radial terms once  //
+  // (calcFieldRadial) and sum them in lanes over their values of Theta, whose        //
+  // angular functions come from a table (if it is not too big). The rest of pairs    //
+  // go through calcFieldAmplitudes. Then each point only needs the azimuthal         //
+  // factors and the change to Cartesian components.                                 //
+  //**********************************************************************************//
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::calcFieldGrid(BasicMieContext<FloatType>& ctx, const std::vector<FloatType>& Rho,
+                                                    const std::vector<FloatType>& Theta,
+                                                    const std::vector<FloatType>& Phi) const {
+    if (!ctx.isExpCoeffsCalc_ || ctx.model_ != this || ctx.revision_ != revision_) {
+      calcScattCoeffs(ctx);
+      calcExpanCoeffs(ctx);
+    }
 
-    long total_points = coords_[0].size();
-    E_.resize(total_points);
-    H_.resize(total_points);
+    const unsigned long points = Rho.size();
+    std::vector<std::vector< std::complex<FloatType> > > &E_ = ctx.E_, &H_ = ctx.H_;
+    E_.resize(points);
+    H_.resize(points);
     for (auto& f : E_) f.resize(3);
     for (auto& f : H_) f.resize(3);
 
-    for (int point = 0; point < total_points; point++) {
-      const double& Xp = coords_[0][point];
-      const double& Yp = coords_[1][point];
-      const double& Zp = coords_[2][point];
+    std::vector<unsigned long> order(points);
+    for (unsigned long p = 0; p < points; p++) order[p] = p;
+    std::sort(order.begin(), order.end(), [&](unsigned long a, unsigned long b) {
+        return Rho[a] < Rho[b] || (Rho[a] == Rho[b] && Theta[a] < Theta[b]);
+      });
+
+    // Different (Rho, Theta) pairs
+    std::vector<FloatType> rho, theta;
+    for (unsigned long i = 0; i < points; i++) {
+      const unsigned long p = order[i];
+      if (i > 0 && Rho[p] == Rho[order[i - 1]] && Theta[p] == Theta[order[i - 1]]) continue;
+      rho.push_back(Rho[p]);
+      theta.push_back(Theta[p]);
+    }
+    const unsigned long pairs = rho.size();
+    std::vector<FloatType> sin_theta(pairs), cos_theta(pairs);
+    for (unsigned long t = 0; t < pairs; t++) {
+      sin_theta[t] = std::sin(theta[t]);
+      cos_theta[t] = std::cos(theta[t]);
+    }
 
-      // Convert to spherical coordinates
-      Rho = std::sqrt(pow2(Xp) + pow2(Yp) + pow2(Zp));
+    // Ranges of pairs with the same Rho: the ones with at least one pair per
+    // lane are summed over Theta, the others are calculated by calcFieldAmplitudes
+    const simd::FieldKernel<FloatType>& kernel = simd::GetFieldKernel<FloatType>();
+    const unsigned long K = kernel.lanes;
+    std::vector<unsigned long> shared;  // first and last pair of each range
+    std::vector<unsigned long> single;
+    for (unsigned long first = 0, last; first < pairs; first = last) {
+      for (last = first + 1; last < pairs && rho[last] == rho[first]; last++) {}
+      if (last - first >= K) {
+        shared.push_back(first);
+        shared.push_back(last);
+      } else {
+        for (unsigned long t = first; t < last; t++) single.push_back(t);
+      }
+    }
 
-      // If Rho=0 then Theta is undefined. Just set it to zero to avoid problems
-      Theta = (Rho > 0.0) ? std::acos(Zp/Rho) : 0.0;
+    std::vector<FieldVector> Es(pairs), Hs(pairs);
+    std::complex<FloatType> ml;
+    if (!single.empty()) {
+      const unsigned long count = single.size();
+      std::vector<FloatType> single_rho(count), single_sin(count), single_cos(count);
+      std::vector<int> single_layer(count);
+      std::vector<unsigned long> single_order(count);
+      std::vector<FieldVector> single_Es(count), single_Hs(count);
+      for (unsigned long i = 0; i < count; i++) {
+        const unsigned long t = single[i];
+        single_rho[i] = rho[t];
+        single_sin[i] = sin_theta[t];
+        single_cos[i] = cos_theta[t];
+        single_layer[i] = calcFieldLayer(rho[t], ml);
+      }
+      calcFieldAmplitudes(ctx, count, single_layer.data(), single_order.data(), single_rho.data(),
+                          single_sin.data(), single_cos.data(), single_Es.data(), single_Hs.data());
+      for (unsigned long i = 0; i < count; i++) {
+        Es[single[i]] = single_Es[i];
+        Hs[single[i]] = single_Hs[i];
+      }
+    }
 
-      // If Xp=Yp=0 then Phi is undefined. Just set it to zero to avoid problems
-      if (Xp == 0.0)
-        Phi = (Yp != 0.0) ? std::asin(Yp/std::sqrt(pow2(Xp) + pow2(Yp))) : 0.0;
-      else
-        Phi = std::acos(Xp/std::sqrt(pow2(Xp) + pow2(Yp)));
+    if (!shared.empty()) {
+      // Table of the angular functions of the different values of Theta
+      const int nmax_ = ctx.nmax_;
+      std::vector<FloatType> thetas(theta);
+      std::sort(thetas.begin(), thetas.end());
+      thetas.erase(std::unique(thetas.begin(), thetas.end()), thetas.end());
+      const bool use_table = thetas.size()*nmax_ <= (1ul << 22);
+      std::vector<FloatType> Pi_table, Tau_table, Pi(nmax_), Tau(nmax_);
+      if (use_table) {
+        Pi_table.resize(thetas.size()*nmax_);
+        Tau_table.resize(thetas.size()*nmax_);
+        for (unsigned long t = 0; t < thetas.size(); t++) {
+          calcPiTau(nmax_, std::cos(thetas[t]), Pi, Tau);
+          std::copy(Pi.begin(), Pi.end(), Pi_table.begin() + t*nmax_);
+          std::copy(Tau.begin(), Tau.end(), Tau_table.begin() + t*nmax_);
+        }
+      }
 
-      // Avoid convergence problems due to Rho too small
-      if (Rho < 1e-5) Rho = 1e-5;
-
-      //*******************************************************//
-      // external scattering field = incident + scattered      //
-      // BH p.92 (4.37), 94 (4.45), 95 (4.50)                  //
-      // assume: medium is non-absorbing; refim = 0; Uabs = 0  //
-      //*******************************************************//
-
-      // This array contains the fields in spherical coordinates
-      std::vector<std::complex<double> > Es(3), Hs(3);
-
-      // Do the actual calculation of electric and magnetic field
-      calcField(Rho, Theta, Phi, Es, Hs);
-
-      { //Now, convert the fields back to cartesian coordinates
-        using std::sin;
-        using std::cos;
-        E_[point][0] = sin(Theta)*cos(Phi)*Es[0] + cos(Theta)*cos(Phi)*Es[1] - sin(Phi)*Es[2];
-        E_[point][1] = sin(Theta)*sin(Phi)*Es[0] + cos(Theta)*sin(Phi)*Es[1] + cos(Phi)*Es[2];
-        E_[point][2] = cos(Theta)*Es[0] - sin(Theta)*Es[1];
-
-        H_[point][0] = sin(Theta)*cos(Phi)*Hs[0] + cos(Theta)*cos(Phi)*Hs[1] - sin(Phi)*Hs[2];
-        H_[point][1] = sin(Theta)*sin(Phi)*Hs[0] + cos(Theta)*sin(Phi)*Hs[1] + cos(Phi)*Hs[2];
-        H_[point][2] = cos(Theta)*Hs[0] - sin(Theta)*Hs[1];
+      std::vector<FloatType> terms(12*nmax_), lane_Pi(K*nmax_), lane_Tau(K*nmax_);
+      FloatType lane_sin_theta[simd::kMaxFieldLanes], EH[12*simd::kMaxFieldLanes];
+      simd::FieldLanes<FloatType> f;
+      f.nmax = nmax_;
+      f.coeffs = terms.data();
+      f.sin_theta = lane_sin_theta;
+      f.Pi = lane_Pi.data();
+      f.Tau = lane_Tau.data();
+      f.EH = EH;
+      for (unsigned long r = 0; r < shared.size(); r += 2) {
+        const unsigned long first_pair = shared[r], last_pair = shared[r + 1];
+        const int l = calcFieldLayer(rho[first_pair], ml);
+        calcFieldRadial(ctx, rho[first_pair], l, ml, terms.data());
+
+        // Groups of K values of Theta, the unused lanes repeat the last one
+        for (unsigned long first = first_pair; first < last_pair; first += K) {
+          for (unsigned long k = 0; k < K; k++) {
+            const unsigned long t = std::min(first + k, last_pair - 1);
+            const FloatType *Pi_theta = Pi.data(), *Tau_theta = Tau.data();
+            if (use_table) {
+              const unsigned long i = std::lower_bound(thetas.begin(), thetas.end(), theta[t]) - thetas.begin();
+              Pi_theta = Pi_table.data() + i*nmax_;
+              Tau_theta = Tau_table.data() + i*nmax_;
+            } else {
+              calcPiTau(nmax_, cos_theta[t], Pi, Tau);
+            }
+            for (int n = 0; n < nmax_; n++) {
+              lane_Pi[n*K + k] = Pi_theta[n];
+              lane_Tau[n*K + k] = Tau_theta[n];
+            }
+            lane_sin_theta[k] = sin_theta[t];
+          }
+          kernel.Angular(f);
+
+          for (unsigned long k = 0; k < K && first + k < last_pair; k++) {
+            for (int c = 0; c < 3; c++) {
+              Es[first + k][c] = simd::GetLane(EH, K, c, k);
+              Hs[first + k][c] = simd::GetLane(EH, K, c + 3, k);
+            }
+          }
+        }
       }
-    }  // end of for all field coordinates
-  }  //  end of MultiLayerMie::RunFieldCalculation()
+    }
+
+    for (unsigned long i = 0, t = 0; i < points; i++) {
+      const unsigned long p = order[i];
+      if (i > 0 && (Rho[p] != Rho[order[i - 1]] || Theta[p] != Theta[order[i - 1]])) t++;
+      calcFieldCartesian(sin_theta[t], cos_theta[t], std::cos(Phi[p]), std::sin(Phi[p]), Es[t], Hs[t],
+                         E_[p].data(), H_[p].data());
+    }
+  }  // end of MultiLayerMie::calcFieldGrid(...)
+
+
+  // ********************************************************************** //
+  // Calculate the fields on the spherical grid Rho x Theta x Phi           //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunFieldCalculationSpherical(BasicMieContext<FloatType>& ctx,
+                                                                   const std::vector<FloatType>& Rho,
+                                                                   const std::vector<FloatType>& Theta,
+                                                                   const std::vector<FloatType>& Phi) const {
+    std::vector<FloatType> rho, theta, phi;
+    for (const FloatType r : Rho) {
+      for (const FloatType t : Theta) {
+        for (const FloatType p : Phi) {
+          rho.push_back(r < 1e-5 ? FloatType(1e-5) : r);
+          theta.push_back(t);
+          phi.push_back(p);
+        }
+      }
+    }
+    calcFieldGrid(ctx, rho, theta, phi);
+  }
+
+
+  // ********************************************************************** //
+  // Calculate the fields on the cylindrical grid R x Phi x Z               //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunFieldCalculationCylindrical(BasicMieContext<FloatType>& ctx,
+                                                                     const std::vector<FloatType>& R,
+                                                                     const std::vector<FloatType>& Phi,
+                                                                     const std::vector<FloatType>& Z) const {
+    std::vector<FloatType> rho, theta, phi;
+    for (const FloatType r : R) {
+      for (const FloatType p : Phi) {
+        for (const FloatType z : Z) {
+          const FloatType Rho = std::sqrt(pow2(r) + pow2(z));
+          rho.push_back(Rho < 1e-5 ? FloatType(1e-5) : Rho);
+          theta.push_back((Rho > 0.0) ? std::acos(z/Rho) : 0.0);
+          phi.push_back(p);
+        }
+      }
+    }
+    calcFieldGrid(ctx, rho, theta, phi);
+  }
+
+
+  // ********************************************************************** //
+  // Calculate the fields on the Cartesian grid X x Y x Z                   //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunFieldCalculationCartesian(BasicMieContext<FloatType>& ctx,
+                                                                   const std::vector<FloatType>& X,
+                                                                   const std::vector<FloatType>& Y,
+                                                                   const std::vector<FloatType>& Z) const {
+    const unsigned long points = X.size()*Y.size()*Z.size();
+    std::vector<FloatType> rho(points), theta(points), phi(points);
+    unsigned long p = 0;
+    for (const FloatType x : X) {
+      for (const FloatType y : Y) {
+        for (const FloatType z : Z) {
+          calcSphericalCoords(x, y, z, rho[p], theta[p], phi[p]);
+          p++;
+        }
+      }
+    }
+    calcFieldGrid(ctx, rho, theta, phi);
+  }
+
+
+  // ********************************************************************** //
+  // Same as above, using the internal context                              //
+  // ********************************************************************** //
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunFieldCalculationSpherical(const std::vector<FloatType>& Rho,
+                                                                   const std::vector<FloatType>& Theta,
+                                                                   const std::vector<FloatType>& Phi) {
+    ctx_.isScaCoeffsCalc_ = false;
+    ctx_.isExpCoeffsCalc_ = false;
+    RunFieldCalculationSpherical(ctx_, Rho, Theta, Phi);
+  }
+
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunFieldCalculationCylindrical(const std::vector<FloatType>& R,
+                                                                     const std::vector<FloatType>& Phi,
+                                                                     const std::vector<FloatType>& Z) {
+    ctx_.isScaCoeffsCalc_ = false;
+    ctx_.isExpCoeffsCalc_ = false;
+    RunFieldCalculationCylindrical(ctx_, R, Phi, Z);
+  }
+
+  template <typename FloatType>
+  void BasicMultiLayerMie<FloatType>::RunFieldCalculationCartesian(const std::vector<FloatType>& X,
+                                                                   const std::vector<FloatType>& Y,
+                                                                   const std::vector<FloatType>& Z) {
+    ctx_.isScaCoeffsCalc_ = false;
+    ctx_.isExpCoeffsCalc_ = false;
+    RunFieldCalculationCartesian(ctx_, X, Y, Z);
+  }
+
+  template class BasicMieWorkspace<float>;
+  template class BasicMieWorkspace<double>;
+  template class BasicMieWorkspace<long double>;
+  template class BasicMieContext<float>;
+  template class BasicMieContext<double>;
+  template class BasicMieContext<long double>;
+  template class BasicMultiLayerMie<float>;
+  template class BasicMultiLayerMie<double>;
+  template class BasicMultiLayerMie<long double>;
 }  // end of namespace nmie
@@ -33,6 +33,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <vector>
+#include "nmie-threads.h"
 
 namespace nmie {
   //Used constants
@@ -48,131 +49,351 @@ namespace nmie {
   int nMie(const unsigned int L, std::vector<double>& x, std::vector<std::complex<double> >& m, const unsigned int nTheta, std::vector<double>& Theta, const int nmax, double *Qext, double *Qsca, double *Qabs, double *Qbk, double *Qpr, double *g, double *Albedo, std::vector<std::complex<double> >& S1, std::vector<std::complex<double> >& S2);
   int nField(const unsigned int L, const int pl, const std::vector<double>& x, const std::vector<std::complex<double> >& m, const int nmax, const unsigned int ncoord, const std::vector<double>& Xp, const std::vector<double>& Yp, const std::vector<double>& Zp, std::vector<std::vector<std::complex<double> > >& E, std::vector<std::vector<std::complex<double> > >& H);
 
-  class MultiLayerMie {
+  // Results calculated by RunMieCalculation, they can be combined with '|'
+  enum OutputMask {
+    kEfficiencies = 1,       // Qext, Qsca, Qabs and Albedo
+    kRadiationPressure = 2,  // Qpr and asymmetry factor (also calculates kEfficiencies)
+    kBackscattering = 4,     // Qbk and S1, S2 for Theta = 180 deg
+    kAmplitudes = 8,         // S1 and S2 for the scattering angles
+    kAll = 15
+  };
+
+  // Scratch buffers used by the computational core of MultiLayerMie. They are
+  // flat arrays that only grow, so once the largest nmax and number of layers
+  // have been seen, repeated calculations do not allocate any memory.
+  template <typename FloatType>
+  class BasicMieWorkspace {
+   public:
+    // Make sure that all buffers fit nmax terms and L layers
+    void Reserve(int nmax, int L);
+
+    // calcScattCoeffs(): D1, D3, Q, Ha and Hb for all layers, stored as [l*(nmax + 1) + n]
+    std::vector<std::complex<FloatType> > D1_mlxl, D1_mlxlM1, D3_mlxl, D3_mlxlM1;
+    std::vector<std::complex<FloatType> > Q, Ha, Hb;
+    // calcScattCoeffs(): Psi and Zeta of the outer layer
+    std::vector<std::complex<FloatType> > PsiXL, ZetaXL;
+    // calcExpanCoeffs(): Riccati-Bessel functions at both sides of a boundary
+    std::vector<std::complex<FloatType> > D1z, D1z1, D3z, D3z1, Psiz, Psiz1, Zetaz, Zetaz1;
+    // calcRiccatiBessel(): product of Psi and Zeta
+    std::vector<std::complex<FloatType> > PsiZeta;
+    // calcScattCoeffs(): D1 and D3 of the outer layer (used for Psi and Zeta)
+    std::vector<std::complex<FloatType> > D1, D3;
+    // calcField(): Riccati-Bessel functions of Rho*ml and angular functions
+    std::vector<std::complex<FloatType> > D1Rho, D3Rho, PsiRho, ZetaRho;
+    std::vector<FloatType> Pi, Tau;
+    // calcFieldPoints() and calcFieldLanes(), sized by them: coordinates,
+    // layers, order and amplitudes of a block of points, and the same
+    // functions for a group of lanes
+    std::vector<FloatType> FieldPoints, FieldLanes;
+    std::vector<int> FieldLayer;
+    std::vector<unsigned long> FieldOrder;
+    std::vector<std::array<std::complex<FloatType>, 3> > FieldAmplitudes;
+   private:
+    int nmax_ = 0, L_ = 0;
+  };  // end of class BasicMieWorkspace
+
+
+  template <typename FloatType> class BasicMultiLayerMie;
+
+  // Evaluation context: results and scratch memory of a calculation with a
+  // MultiLayerMie model. The model itself only holds the problem definition,
+  // so a single model can be evaluated concurrently from several threads,
+  // each of them using its own context.
+  template <typename FloatType>
+  class BasicMieContext {
+   public:
+    // Return calculation results
+    FloatType GetQext() const;
+    FloatType GetQsca() const;
+    FloatType GetQabs() const;
+    FloatType GetQbk() const;
+    FloatType GetQpr() const;
+    FloatType GetAsymmetryFactor() const;
+    FloatType GetAlbedo() const;
+    const std::vector<std::complex<FloatType> >& GetS1() const;
+    const std::vector<std::complex<FloatType> >& GetS2() const;
+    std::complex<FloatType> GetS1Backward() const;
+    std::complex<FloatType> GetS2Backward() const;
+
+    const std::vector<std::complex<FloatType> >& GetAn() const {return an_;};
+    const std::vector<std::complex<FloatType> >& GetBn() const {return bn_;};
+
+    const std::vector<std::vector< std::complex<FloatType> > >& GetFieldE() const {return E_;};   // {X[], Y[], Z[]}
+    const std::vector<std::vector< std::complex<FloatType> > >& GetFieldH() const {return H_;};
+
+    // Number of terms used in the last calculation (less than the estimated
+    // one if the series was truncated, see MultiLayerMie::SetTolerance)
+    int GetMaxTerms() const {return nmax_;};
+    bool isMieCalculated() const {return isMieCalculated_;};
+    void MarkUncalculated();
+
+   private:
+    friend class BasicMultiLayerMie<FloatType>;
+    void checkRequested(unsigned int output) const;
+
+    bool isExpCoeffsCalc_ = false;
+    bool isScaCoeffsCalc_ = false;
+    bool isMieCalculated_ = false;
+    // Model (and its revision) used to calculate the coefficients
+    const BasicMultiLayerMie<FloatType>* model_ = nullptr;
+    unsigned long revision_ = 0;
+
+    int nmax_ = -1;
+    // Terms of the Riccati-Bessel recurrences, nmax_ is smaller if the
+    // series was truncated
+    int nmax_full_ = -1;
+    // Scattering coefficients
+    std::vector<std::complex<FloatType> > an_, bn_;
+    std::vector< std::vector<std::complex<FloatType> > > aln_, bln_, cln_, dln_;
+    /// Store result
+    FloatType Qsca_ = 0.0, Qext_ = 0.0, Qabs_ = 0.0, Qbk_ = 0.0, Qpr_ = 0.0, asymmetry_factor_ = 0.0, albedo_ = 0.0;
+    std::vector<std::vector< std::complex<FloatType> > > E_, H_;  // {X[], Y[], Z[]}
+    std::vector<std::complex<FloatType> > S1_, S2_;
+    std::complex<FloatType> S1_back_, S2_back_;
+    // Results calculated in the last run (OutputMask)
+    unsigned int output_mask_ = kAll;
+
+    //Temporary variables
+    BasicMieWorkspace<FloatType> ws_;
+    // Layers (and their PEC layer and nmax) of the last calcScattCoeffs. D1,
+    // D3, Q, Ha and Hb of the layers that did not change since then are still
+    // valid in ws_ for orders n <= prefix_orders_, so only the outer layers
+    // are recalculated in coating-design loops.
+    std::vector<FloatType> prefix_x_;
+    std::vector<std::complex<FloatType> > prefix_m_;
+    int prefix_pl_ = -1, prefix_nmax_ = -1, prefix_orders_ = 0;
+    // Angular functions for the angles in table_theta_, stored by order:
+    // Pi_table_[n*table_theta_.size() + t]. Valid for n < table_nmax_.
+    std::vector<FloatType> table_theta_, Pi_table_, Tau_table_;
+    int table_nmax_ = -1;
+    // Real and imaginary parts of S1 and S2 kept in separate arrays (SIMD lanes)
+    std::vector<FloatType> S_lanes_;
+  };  // end of class BasicMieContext
+
+
+  // FloatType is the scalar type of all calculations (float, double or
+  // long double); MultiLayerMie is the double precision instance.
+  template <typename FloatType>
+  class BasicMultiLayerMie {
    public:
     // Run calculation
     void RunMieCalculation();
-    void RunFieldCalculation();
+    // The field points are shared by the threads of the pool (use a pool of
+    // one thread for a serial calculation)
+    void RunFieldCalculation(ThreadPool& pool = ThreadPool::Shared());
     void calcScattCoeffs();
 
+    // Run calculation using an external evaluation context. These functions
+    // do not modify the model and can be called concurrently, as long as
+    // each thread uses its own context. The amplitudes and fields can be
+    // restricted to a block of the angles or field coordinates; then only
+    // 'count' values, starting from 'first', are stored in the context.
+    void RunMieCalculation(BasicMieContext<FloatType>& ctx) const;
+    void RunMieCalculation(BasicMieContext<FloatType>& ctx, unsigned long first_angle, unsigned long angle_count) const;
+    void RunFieldCalculation(BasicMieContext<FloatType>& ctx) const;
+    void RunFieldCalculation(BasicMieContext<FloatType>& ctx, unsigned long first_point, unsigned long point_count) const;
+    void calcScattCoeffs(BasicMieContext<FloatType>& ctx) const;
+
+    // Fields at the points with spherical coordinates (Rho[i], Theta[i], Phi[j])
+    // for all i and j, stored in GetFieldE/H as [i*Phi.size() + j] (Cartesian
+    // components). The fields depend on Phi only through cos(Phi) and
+    // sin(Phi), so the expansion is summed once per (Rho, Theta) and every
+    // Phi is obtained from it: a 3-D volume costs about as much as one plane.
+    void RunFieldCalculationPolar(const std::vector<FloatType>& Rho, const std::vector<FloatType>& Theta,
+                                  const std::vector<FloatType>& Phi);
+    void RunFieldCalculationPolar(BasicMieContext<FloatType>& ctx, const std::vector<FloatType>& Rho,
+                                  const std::vector<FloatType>& Theta, const std::vector<FloatType>& Phi) const;
+    // Fields on structured grids, stored in GetFieldE/H with the last axis
+    // varying fastest, e.g. [(i*Theta.size() + j)*Phi.size() + k]. Radial
+    // distances shared by several polar angles (at least one per SIMD lane)
+    // reuse their Riccati-Bessel functions, polar angles reuse their angular
+    // functions, and points sharing both only add their azimuthal factors.
+    void RunFieldCalculationSpherical(const std::vector<FloatType>& Rho, const std::vector<FloatType>& Theta,
+                                      const std::vector<FloatType>& Phi);
+    void RunFieldCalculationCylindrical(const std::vector<FloatType>& R, const std::vector<FloatType>& Phi,
+                                        const std::vector<FloatType>& Z);
+    void RunFieldCalculationCartesian(const std::vector<FloatType>& X, const std::vector<FloatType>& Y,
+                                      const std::vector<FloatType>& Z);
+    void RunFieldCalculationSpherical(BasicMieContext<FloatType>& ctx, const std::vector<FloatType>& Rho,
+                                      const std::vector<FloatType>& Theta, const std::vector<FloatType>& Phi) const;
+    void RunFieldCalculationCylindrical(BasicMieContext<FloatType>& ctx, const std::vector<FloatType>& R,
+                                        const std::vector<FloatType>& Phi, const std::vector<FloatType>& Z) const;
+    void RunFieldCalculationCartesian(BasicMieContext<FloatType>& ctx, const std::vector<FloatType>& X,
+                                      const std::vector<FloatType>& Y, const std::vector<FloatType>& Z) const;
+
     // Return calculation results
-    double GetQext();
-    double GetQsca();
-    double GetQabs();
-    double GetQbk();
-    double GetQpr();
-    double GetAsymmetryFactor();
-    double GetAlbedo();
-    std::vector<std::complex<double> > GetS1();
-    std::vector<std::complex<double> > GetS2();
-
-    std::vector<std::complex<double> > GetAn(){return an_;};
-    std::vector<std::complex<double> > GetBn(){return bn_;};
+    FloatType GetQext();
+    FloatType GetQsca();
+    FloatType GetQabs();
+    FloatType GetQbk();
+    FloatType GetQpr();
+    FloatType GetAsymmetryFactor();
+    FloatType GetAlbedo();
+    const std::vector<std::complex<FloatType> >& GetS1();
+    const std::vector<std::complex<FloatType> >& GetS2();
+    std::complex<FloatType> GetS1Backward();
+    std::complex<FloatType> GetS2Backward();
+
+    const std::vector<std::complex<FloatType> >& GetAn(){return ctx_.an_;};
+    const std::vector<std::complex<FloatType> >& GetBn(){return ctx_.bn_;};
 
     // Problem definition
     // Modify size of all layers
-    void SetLayersSize(const std::vector<double>& layer_size);
+    void SetLayersSize(const std::vector<FloatType>& layer_size);
     // Modify refractive index of all layers
-    void SetLayersIndex(const std::vector< std::complex<double> >& index);
+    void SetLayersIndex(const std::vector< std::complex<FloatType> >& index);
     // Modify scattering (theta) angles
-    void SetAngles(const std::vector<double>& angles);
+    void SetAngles(const std::vector<FloatType>& angles);
     // Modify coordinates for field calculation
-    void SetFieldCoords(const std::vector< std::vector<double> >& coords);
+    void SetFieldCoords(const std::vector< std::vector<FloatType> >& coords);
     // Modify index of PEC layer
     void SetPECLayer(int layer_position = 0);
+    // Select the results calculated by RunMieCalculation (see OutputMask),
+    // e.g. SetOutputMask(kBackscattering) to get only Qbk and S1, S2 at 180 deg
+    void SetOutputMask(unsigned int mask = kAll);
 
     // Set a fixed value for the maximun number of terms
     void SetMaxTerms(int nmax);
+    // Truncate the multipole series once the contribution of two consecutive
+    // terms drops below tol relative to the partial sum (0 to disable). It is
+    // meant for far-field results, near fields converge slower.
+    void SetTolerance(FloatType tol = 0.0);
+    FloatType GetTolerance() {return tolerance_;};
     // Get maximun number of terms
-    int GetMaxTerms() {return nmax_;};
+    int GetMaxTerms() {return ctx_.nmax_;};
 
-    bool isMieCalculated(){return isMieCalculated_;};
+    bool isMieCalculated(){return ctx_.isMieCalculated_;};
     // Clear layer information
     void ClearLayers();
     void MarkUncalculated();
 
     // Read parameters
     // Get total size parameter of particle
-    double GetSizeParameter();
+    FloatType GetSizeParameter();
     // Returns size of all layers
-    std::vector<double> GetLayersSize(){return size_param_;};
+    std::vector<FloatType> GetLayersSize(){return size_param_;};
     // Returns refractive index of all layers
-    std::vector<std::complex<double> > GetLayersIndex(){return refractive_index_;};
+    std::vector<std::complex<FloatType> > GetLayersIndex(){return refractive_index_;};
     // Returns scattering (theta) angles
-    std::vector<double> GetAngles(){return theta_;};
+    std::vector<FloatType> GetAngles(){return theta_;};
     // Returns coordinates used for field calculation
-    std::vector<std::vector<double> > GetFieldCoords(){return coords_;};
+    std::vector<std::vector<FloatType> > GetFieldCoords(){return coords_;};
     // Returns index of PEC layer
     int GetPECLayer(){return PEC_layer_position_;};
 
-    std::vector<std::vector< std::complex<double> > > GetFieldE(){return E_;};   // {X[], Y[], Z[]}
-    std::vector<std::vector< std::complex<double> > > GetFieldH(){return H_;};
+    const std::vector<std::vector< std::complex<FloatType> > >& GetFieldE(){return ctx_.E_;};   // {X[], Y[], Z[]}
+    const std::vector<std::vector< std::complex<FloatType> > >& GetFieldH(){return ctx_.H_;};
 
   protected:
     // Size parameter for all layers
-    std::vector<double> size_param_;
+    std::vector<FloatType> size_param_;
     // Refractive index for all layers
-    std::vector< std::complex<double> > refractive_index_;
+    std::vector< std::complex<FloatType> > refractive_index_;
     // Scattering angles for scattering pattern in radians
 
+    // Logarithmic derivative D1 of order N from its continued fraction
+    std::complex<FloatType> calcD1confra(int N, const std::complex<FloatType> z) const;
+    // Starting value of the downward recurrence for D1 at order N
+    std::complex<FloatType> calcD1Start(int N, const std::complex<FloatType> z) const;
+
+    // Number of terms required by the current layers - equation (17)
+    int calcNstop() const;
+    int calcNmax(unsigned int first_layer) const;
+
   private:
-    void calcNstop();
-    void calcNmax(unsigned int first_layer);
-
-    std::complex<double> calc_an(int n, double XL, std::complex<double> Ha, std::complex<double> mL,
-                                 std::complex<double> PsiXL, std::complex<double> ZetaXL,
-                                 std::complex<double> PsiXLM1, std::complex<double> ZetaXLM1);
-    std::complex<double> calc_bn(int n, double XL, std::complex<double> Hb, std::complex<double> mL,
-                                 std::complex<double> PsiXL, std::complex<double> ZetaXL,
-                                 std::complex<double> PsiXLM1, std::complex<double> ZetaXLM1);
-    std::complex<double> calc_S1(int n, std::complex<double> an, std::complex<double> bn,
-                                 double Pi, double Tau);
-    std::complex<double> calc_S2(int n, std::complex<double> an, std::complex<double> bn,
-                                 double Pi, double Tau);
-    void calcD1D3(std::complex<double> z,
-                  std::vector<std::complex<double> >& D1,
-                  std::vector<std::complex<double> >& D3);
-    void calcPsiZeta(std::complex<double> x,
-                     std::vector<std::complex<double> >& Psi,
-                     std::vector<std::complex<double> >& Zeta);
-    void calcPiTau(const double& costheta,
-                   std::vector<double>& Pi, std::vector<double>& Tau);
-    void calcSpherHarm(const std::complex<double> Rho, const double Theta, const double Phi,
-                       const std::complex<double>& rn, const std::complex<double>& Dn,
-                       const double& Pi, const double& Tau, const double& n,
-                       std::vector<std::complex<double> >& Mo1n, std::vector<std::complex<double> >& Me1n, 
-                       std::vector<std::complex<double> >& No1n, std::vector<std::complex<double> >& Ne1n);
-    void calcExpanCoeffs();
-
-    void calcField(const double Rho, const double Theta, const double Phi,
-                   std::vector<std::complex<double> >& E, std::vector<std::complex<double> >& H);
+    // Spherical or Cartesian components of a field at a point
+    typedef std::array<std::complex<FloatType>, 3> FieldVector;
 
-    bool isExpCoeffsCalc_ = false;
-    bool isScaCoeffsCalc_ = false;
-    bool isMieCalculated_ = false;
+    void checkModel() const;
+
+    std::complex<FloatType> calc_an(int n, FloatType XL, std::complex<FloatType> Ha, std::complex<FloatType> mL,
+                                    std::complex<FloatType> PsiXL, std::complex<FloatType> ZetaXL,
+                                    std::complex<FloatType> PsiXLM1, std::complex<FloatType> ZetaXLM1) const;
+    std::complex<FloatType> calc_bn(int n, FloatType XL, std::complex<FloatType> Hb, std::complex<FloatType> mL,
+                                    std::complex<FloatType> PsiXL, std::complex<FloatType> ZetaXL,
+                                    std::complex<FloatType> PsiXLM1, std::complex<FloatType> ZetaXLM1) const;
+    std::complex<FloatType> calc_S1(int n, std::complex<FloatType> an, std::complex<FloatType> bn,
+                                    FloatType Pi, FloatType Tau) const;
+    std::complex<FloatType> calc_S2(int n, std::complex<FloatType> an, std::complex<FloatType> bn,
+                                    FloatType Pi, FloatType Tau) const;
+    void calcD1D3(BasicMieContext<FloatType>& ctx, std::complex<FloatType> z,
+                  std::complex<FloatType>* D1, std::complex<FloatType>* D3) const;
+    void calcRiccatiBessel(BasicMieContext<FloatType>& ctx, std::complex<FloatType> z,
+                           std::complex<FloatType>* D1, std::complex<FloatType>* D3,
+                           std::complex<FloatType>* Psi, std::complex<FloatType>* Zeta) const;
+    void calcPiTau(int nmax, const FloatType& costheta,
+                   std::vector<FloatType>& Pi, std::vector<FloatType>& Tau) const;
+    void calcPiTauTable(BasicMieContext<FloatType>& ctx, unsigned long first_angle, unsigned long angle_count) const;
+    void calcS1S2(BasicMieContext<FloatType>& ctx) const;
+    void calcSpherHarm(const std::complex<FloatType> Rho, const FloatType sin_theta,
+                       const FloatType cos_phi, const FloatType sin_phi,
+                       const std::complex<FloatType>& rn, const std::complex<FloatType>& Dn,
+                       const FloatType& Pi, const FloatType& Tau, const FloatType& n,
+                       FieldVector& Mo1n, FieldVector& Me1n, FieldVector& No1n, FieldVector& Ne1n) const;
+    void calcExpanCoeffs(BasicMieContext<FloatType>& ctx) const;
+
+    void calcField(BasicMieContext<FloatType>& ctx, const FloatType Rho, const FloatType sin_theta,
+                   const FloatType cos_theta, const FloatType cos_phi, const FloatType sin_phi,
+                   FieldVector& E, FieldVector& H) const;
+    int calcFieldLayer(const FloatType Rho, std::complex<FloatType>& ml) const;
+    void calcFieldSum(BasicMieContext<FloatType>& ctx, const FloatType Rho, const int l,
+                      const std::complex<FloatType> ml, const FloatType sin_theta,
+                      const FloatType cos_phi, const FloatType sin_phi,
+                      const std::complex<FloatType>* Psi, const std::complex<FloatType>* D1n,
+                      const std::complex<FloatType>* Zeta, const std::complex<FloatType>* D3n,
+                      const FloatType* Pi, const FloatType* Tau, FieldVector& E, FieldVector& H) const;
+    void calcFieldLanes(BasicMieContext<FloatType>& ctx, const int l, const std::complex<FloatType> ml,
+                        const FloatType* rho, const FloatType* sin_theta, const FloatType* cos_theta,
+                        FloatType* EH) const;
+    void calcFieldAmplitudes(BasicMieContext<FloatType>& ctx, const unsigned long count, const int* layer,
+                             unsigned long* order, const FloatType* rho, const FloatType* sin_theta,
+                             const FloatType* cos_theta, FieldVector* Es, FieldVector* Hs) const;
+    void calcFieldRadial(BasicMieContext<FloatType>& ctx, const FloatType Rho, const int l,
+                         const std::complex<FloatType> ml, FloatType* terms) const;
+    void calcFieldGrid(BasicMieContext<FloatType>& ctx, const std::vector<FloatType>& Rho,
+                       const std::vector<FloatType>& Theta, const std::vector<FloatType>& Phi) const;
+    void calcFieldPoints(BasicMieContext<FloatType>& ctx, unsigned long first_point, unsigned long point_count,
+                         std::vector<std::complex<FloatType> >* E, std::vector<std::complex<FloatType> >* H) const;
+    static void calcSphericalCoords(const FloatType Xp, const FloatType Yp, const FloatType Zp,
+                                    FloatType& Rho, FloatType& Theta, FloatType& Phi);
+    static void calcFieldCartesian(const FloatType sin_theta, const FloatType cos_theta,
+                                   const FloatType cos_phi, const FloatType sin_phi,
+                                   const FieldVector& Es, const FieldVector& Hs,
+                                   std::complex<FloatType>* E, std::complex<FloatType>* H);
 
-    std::vector<double> theta_;
+    std::vector<FloatType> theta_;
     // Should be -1 if there is no PEC.
     int PEC_layer_position_ = -1;
 
-    // with calcNmax(int first_layer);
-    int nmax_ = -1;
     int nmax_preset_ = -1;
-    // Scattering coefficients
-    std::vector<std::complex<double> > an_, bn_;
-    std::vector< std::vector<double> > coords_;
-    std::vector< std::vector<std::complex<double> > > aln_, bln_, cln_, dln_;
-    /// Store result
-    double Qsca_ = 0.0, Qext_ = 0.0, Qabs_ = 0.0, Qbk_ = 0.0, Qpr_ = 0.0, asymmetry_factor_ = 0.0, albedo_ = 0.0;
-    std::vector<std::vector< std::complex<double> > > E_, H_;  // {X[], Y[], Z[]}
-    std::vector<std::complex<double> > S1_, S2_;
+    FloatType tolerance_ = 0.0;
+    unsigned int output_mask_ = kAll;
+    std::vector< std::vector<FloatType> > coords_;
+    // Incremented each time the problem definition changes
+    unsigned long revision_ = 1;
 
+    // Context used by the functions without an explicit one
+    BasicMieContext<FloatType> ctx_;
+    // Contexts of the threads 1, 2, ... of RunFieldCalculation(pool)
+    std::vector<BasicMieContext<FloatType> > thread_ctx_;
+  };  // end of class BasicMultiLayerMie
 
-    //Temporary variables
-    std::vector<std::complex<double> > PsiZeta_;
 
+  // The computational core is instantiated (in nmie.cc) for float, double and
+  // long double. The functions above (nMie, nField, ...) use double.
+  extern template class BasicMieWorkspace<float>;
+  extern template class BasicMieWorkspace<double>;
+  extern template class BasicMieWorkspace<long double>;
+  extern template class BasicMieContext<float>;
+  extern template class BasicMieContext<double>;
+  extern template class BasicMieContext<long double>;
+  extern template class BasicMultiLayerMie<float>;
+  extern template class BasicMultiLayerMie<double>;
+  extern template class BasicMultiLayerMie<long double>;
 
-  };  // end of class MultiLayerMie
+  typedef BasicMieWorkspace<double> MieWorkspace;
+  typedef BasicMieContext<double> MieContext;
+  typedef BasicMultiLayerMie<double> MultiLayerMie;
 
 }  // end of namespace nmie
 #endif  // SRC_NMIE_H_
@@ -0,0 +1,128 @@
+//**********************************************************************************//
+//    Copyright (C) 2009-2015  Ovidio Pena <ovidio@bytesfall.com>                   //
+//    Copyright (C) 2013-2015  Konstantin Ladutenko <kostyfisik@gmail.com>          //
+//                                                                                  //
+//    This file is part of scattnlay                                                //
+//                                                                                  //
+//    This program is free software: you can redistribute it and/or modify          //
+//    it under the terms of the GNU General Public License as published by          //
+//    the Free Software Foundation, either version 3 of the License, or             //
+//    (at your option) any later version.                                           //
+//                                                                                  //
+//    This program is distributed in the hope that it will be useful,               //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                 //
+//    GNU General Public License for more details.                                  //
+//                                                                                  //
+//    The only additional remark is that we expect that all publications            //
+//    describing work using this software, or all commercial products               //
+//    using it, cite the following reference:                                       //
+//    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by           //
+//        a multilayered sphere," Computer Physics Communications,                  //
+//        vol. 180, Nov. 2009, pp. 2348-2354.                                       //
+//                                                                                  //
+//    You should have received a copy of the GNU General Public License             //
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.         //
+//**********************************************************************************//
+
+//***********************************************************************************//
+// Counts the memory allocations of the near-field calculation. It replaces the      //
+// global operator new and delete, so it is built as its own program to keep the    //
+// counter out of the timings of speed-test.cc:                                      //
+//                                                                                   //
+//   g++ -O2 -std=c++11 -pthread allocation-test.cc ../../src/nmie.cc               //
+//       ../../src/nmie-field-avx2.cc ../../src/nmie-field-avx512.cc                 //
+//       ../../src/nmie-threads.cc -o allocation-test.bin                            //
+//***********************************************************************************//
+#include <atomic>
+#include <complex>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <stdio.h>
+#include <time.h>
+#include "../../src/nmie.h"
+
+// Number of calls to operator new. The replacements are not inlined, so
+// that the compiler does not pair malloc and free with new and delete.
+std::atomic<unsigned long> allocation_count(0);
+
+__attribute__((noinline)) void* operator new(std::size_t size) {
+  allocation_count++;
+  if (void* memory = malloc(size == 0 ? 1 : size)) return memory;
+  throw std::bad_alloc();
+}
+__attribute__((noinline)) void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+__attribute__((noinline)) void operator delete(void* memory) noexcept {free(memory);}
+__attribute__((noinline)) void operator delete[](void* memory) noexcept {free(memory);}
+__attribute__((noinline)) void operator delete(void* memory, std::size_t) noexcept {free(memory);}
+__attribute__((noinline)) void operator delete[](void* memory, std::size_t) noexcept {free(memory);}
+
+timespec diff(timespec start, timespec end);
+void RunFieldAllocations();
+
+int main() {
+  RunFieldAllocations();
+  return 0;
+}
+
+
+//***********************************************************************************//
+// Field map of a coated sphere (x = 2.5, 3.5) on a 201 x 201 plane. After a first   //
+// run, which allocates the results and the scratch memory, prints the number of     //
+// memory allocations and the time per point of a second run with an external       //
+// context, with the internal one in 1 thread and in 4 threads.                      //
+//***********************************************************************************//
+void RunFieldAllocations() {
+  nmie::MultiLayerMie multi_layer_mie;
+  multi_layer_mie.SetLayersSize({2.5, 3.5});
+  multi_layer_mie.SetLayersIndex({std::complex<double>(1.5, 0.01), std::complex<double>(2.0, 0.1)});
+
+  const int samples = 201;
+  std::vector<std::vector<double> > coords(3);
+  for (int i = 0; i < samples; i++) {
+    for (int j = 0; j < samples; j++) {
+      coords[0].push_back(-7.0 + 14.0*i/(samples - 1.0));
+      coords[1].push_back(0.0);
+      coords[2].push_back(-7.0 + 14.0*j/(samples - 1.0));
+    }
+  }
+  multi_layer_mie.SetFieldCoords(coords);
+  const unsigned long points = coords[0].size();
+
+  nmie::MieContext context;
+  nmie::ThreadPool serial(1), threads(4);
+  for (int mode = 0; mode < 3; mode++) {
+    unsigned long allocations = 0;
+    timespec time1, time2;
+    for (int run = 0; run < 2; run++) {
+      allocations = allocation_count;
+      clock_gettime(CLOCK_MONOTONIC, &time1);
+      if (mode == 0) multi_layer_mie.RunFieldCalculation(context);
+      if (mode == 1) multi_layer_mie.RunFieldCalculation(serial);
+      if (mode == 2) multi_layer_mie.RunFieldCalculation(threads);
+      clock_gettime(CLOCK_MONOTONIC, &time2);
+      allocations = allocation_count - allocations;
+    }
+    printf("%-17s %lu points: %5lu allocations (%.4f per point), %6.0f ns per point\n",
+           mode == 0 ? "External context" : mode == 1 ? "1 thread" : "4 threads", points,
+           allocations, static_cast<double>(allocations)/points,
+           1e9*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9)/points);
+  }
+}
+
+
+timespec diff(timespec start, timespec end)
+{
+	timespec temp;
+	if ((end.tv_nsec-start.tv_nsec)<0) {
+		temp.tv_sec = end.tv_sec-start.tv_sec-1;
+		temp.tv_nsec = 1000000000+end.tv_nsec-start.tv_nsec;
+	} else {
+		temp.tv_sec = end.tv_sec-start.tv_sec;
+		temp.tv_nsec = end.tv_nsec-start.tv_nsec;
+	}
+	return temp;
+}
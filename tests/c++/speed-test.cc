@@ -27,6 +27,7 @@
 
 #include <algorithm>
 #include <complex>
+#include <sstream>
 #include <functional>
 #include <iostream>
 #include <stdexcept>
@@ -39,8 +40,29 @@
 //sudo aptitude install libgoogle-perftools-dev
 //#include <google/heap-profiler.h>
 #include "../../src/nmie.h"
+#include "../../src/nmie-batch.h"
+#include "../../src/nmie-applied.h"
+#include "../../src/nmie-ensemble.h"
+#include "../../src/nmie-lut.h"
+#include "../../src/nmie-field-lanes.h"
 
 timespec diff(timespec start, timespec end);
+void RunAngularScaling();
+void RunPrecisionComparison();
+void RunBatchComparison();
+void RunSpectrumThreads();
+void RunAdaptiveSpectrum();
+void RunSpectrumSurrogate();
+void RunMaterialSpectrum();
+void RunParameterSweep();
+void RunEnsemble();
+void RunResonanceFinder();
+void RunIndexMap();
+void RunLookupTable();
+void RunFieldVolume();
+void RunFieldGrids();
+void RunFieldThreads();
+void RunFieldLanes();
 const double PI=3.14159265358979323846;
 template<class T> inline T pow2(const T value) {return value*value;}
 
@@ -62,11 +84,96 @@ template<class T> inline T pow2(const T value) {return value*value;}
 //                                                                                   //
 //    * If a comment was passed:                                                     //
 //        'comment, Qext, Qsca, Qabs, Qbk, Qpr, g, Albedo'                           //
+//                                                                                   //
+// Run it as './scattnlay.bin -s' to print how the time per call scales with the     //
+// number of scattering angles and with the size parameter (i.e. with nmax), as      //
+// './scattnlay.bin -p' to compare the throughput and error of each precision, as    //
+// './scattnlay.bin -b' to compare a spectrum calculated point by point and batched, //
+// as './scattnlay.bin -t' to time a spectrum with an increasing number of threads,  //
+// as './scattnlay.bin -a' to compare adaptive and uniform spectra, as               //
+// './scattnlay.bin -r' to check the accuracy and speed of spectrum surrogates, as   //
+// './scattnlay.bin -m' to time spectra of particles of dispersive materials, as     //
+// './scattnlay.bin -w' to time a sweep of wavelength and coating width, as          //
+// './scattnlay.bin -e' to check the accuracy and cost of ensemble averages, as      //
+// './scattnlay.bin -f' to find the resonances of a sphere and a nanoshell, as       //
+// './scattnlay.bin -k' to time maps of the refractive index, as                     //
+// './scattnlay.bin -l' to check the accuracy and speed of a lookup table, as        //
+// './scattnlay.bin -v' to time the near field of a 3-D volume, as                   //
+// './scattnlay.bin -g' to time the near field on structured grids, as               //
+// './scattnlay.bin -n' to time a field map with an increasing number of threads, or //
+// as './scattnlay.bin -q' to compare the field of points in SIMD lanes and one by   //
+// one (SCATTNLAY_SIMD=avx2 or default selects a narrower kernel, see                //
+// nmie-field-lanes.h). The memory allocations of a field map are counted by         //
+// allocation-test.cc.                                                               //
 //***********************************************************************************//
 int main(int argc, char *argv[]) {
   try {
     std::vector<std::string> args;
     args.assign(argv, argv + argc);
+    if (argc == 2 && args[1] == "-s") {
+      RunAngularScaling();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-p") {
+      RunPrecisionComparison();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-b") {
+      RunBatchComparison();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-t") {
+      RunSpectrumThreads();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-a") {
+      RunAdaptiveSpectrum();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-r") {
+      RunSpectrumSurrogate();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-m") {
+      RunMaterialSpectrum();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-w") {
+      RunParameterSweep();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-e") {
+      RunEnsemble();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-f") {
+      RunResonanceFinder();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-k") {
+      RunIndexMap();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-l") {
+      RunLookupTable();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-v") {
+      RunFieldVolume();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-g") {
+      RunFieldGrids();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-n") {
+      RunFieldThreads();
+      return 0;
+    }
+    if (argc == 2 && args[1] == "-q") {
+      RunFieldLanes();
+      return 0;
+    }
     std::string error_msg(std::string("Insufficient parameters.\nUsage: ") + args[0]
 			  + " -l Layers x1 m1.r m1.i [x2 m2.r m2.i ...] "
 			  + "[-t ti tf nt] [-c comment]\n");
@@ -223,6 +330,930 @@ int main(int argc, char *argv[]) {
 
 
 
+//***********************************************************************************//
+// Time per nMie call for a homogeneous sphere (m = 1.5 + 0.001i) as a function of   //
+// the number of scattering angles nTheta and the size parameter x. With the Pi/Tau  //
+// table the cost of S1/S2 should grow as nmax*nTheta, so the time should be about   //
+// linear along each row and each column.                                            //
+//***********************************************************************************//
+void RunAngularScaling() {
+  std::vector<double> sizes = {10.0, 50.0, 100.0, 500.0};
+  std::vector<int> angles = {0, 180, 720, 1800};
+  std::vector<std::complex<double> > m = {std::complex<double>(1.5, 0.001)}, S1, S2;
+  double Qext, Qabs, Qsca, Qbk, Qpr, g, Albedo;
+  timespec time1, time2;
+
+  printf("Time per call (ms)\n%8s, %6s", "x", "nmax");
+  for (auto nt : angles) printf(", %9s%-5d", "nTheta=", nt);
+  printf("\n");
+  for (auto xL : sizes) {
+    std::vector<double> x = {xL};
+    int nmax = 0;
+    printf("%8.1f", xL);
+    for (auto nt : angles) {
+      std::vector<double> Theta(nt);
+      for (int i = 0; i < nt; i++) Theta[i] = PI*i/(nt - 1);
+      S1.resize(nt);
+      S2.resize(nt);
+      long repeats = 1;
+      double elapsed = 0.0;
+      do {
+        repeats *= 2;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time1);
+        for (int i = 0; i < repeats; ++i) {
+          nmax = nmie::nMie(1, x, m, nt, Theta, &Qext, &Qsca, &Qabs, &Qbk, &Qpr, &g, &Albedo, S1, S2);
+        }
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time2);
+        elapsed = diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9;
+      } while (elapsed < 0.2);
+      if (nt == angles.front()) printf(", %6d", nmax);
+      printf(", %14.5f", 1e3*elapsed/repeats);
+    }
+    printf("\n");
+  }
+}
+
+
+//***********************************************************************************//
+// Time per RunMieCalculation (nTheta = 720) and relative error of Qext and S1 for a //
+// two-layer sphere, calculated with FloatType. The reference is long double. Float  //
+// uses SetTolerance(1e-6), otherwise it overflows for large size parameters.        //
+//***********************************************************************************//
+template <typename FloatType>
+double TimeMieCalculation(double xL, double tol, int nt, long double *Qext, long double *S1) {
+  nmie::BasicMultiLayerMie<FloatType> ml_mie;
+  ml_mie.SetLayersSize({static_cast<FloatType>(0.8*xL), static_cast<FloatType>(xL)});
+  ml_mie.SetLayersIndex({std::complex<FloatType>(1.5, 0.01), std::complex<FloatType>(2.0, 0.1)});
+  std::vector<FloatType> Theta(nt);
+  for (int i = 0; i < nt; i++) Theta[i] = PI*i/(nt - 1);
+  ml_mie.SetAngles(Theta);
+  ml_mie.SetTolerance(tol);
+  timespec time1, time2;
+  long repeats = 1;
+  double elapsed = 0.0;
+  do {
+    repeats *= 2;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time1);
+    for (int i = 0; i < repeats; ++i) {
+      ml_mie.MarkUncalculated();
+      ml_mie.RunMieCalculation();
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time2);
+    elapsed = diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9;
+  } while (elapsed < 0.2);
+  *Qext = ml_mie.GetQext();
+  *S1 = std::abs(ml_mie.GetS1()[nt/4]);
+  return 1e3*elapsed/repeats;
+}
+
+
+void RunPrecisionComparison() {
+  std::vector<double> sizes = {1.0, 10.0, 100.0};
+  std::vector<std::string> names = {"float", "double", "long double"};
+  const int nt = 720;
+  printf("%8s, %12s, %12s, %12s, %12s\n", "x", "type", "ms/call", "err(Qext)", "err(S1)");
+  for (auto xL : sizes) {
+    long double Qext_ref, S1_ref, Qext, S1;
+    TimeMieCalculation<long double>(xL, 0.0, nt, &Qext_ref, &S1_ref);
+    for (int type = 0; type < 3; type++) {
+      double time = 0.0;
+      if (type == 0) time = TimeMieCalculation<float>(xL, 1e-6, nt, &Qext, &S1);
+      if (type == 1) time = TimeMieCalculation<double>(xL, 0.0, nt, &Qext, &S1);
+      if (type == 2) time = TimeMieCalculation<long double>(xL, 0.0, nt, &Qext, &S1);
+      printf("%8.1f, %12s, %12.5f, %12.3e, %12.3e\n", xL, names[type].c_str(), time,
+             static_cast<double>(std::abs(Qext/Qext_ref - 1)), static_cast<double>(std::abs(S1/S1_ref - 1)));
+    }
+  }
+}
+
+
+//***********************************************************************************//
+// Time per spectrum of a core-shell sphere (m = 1.5 + 0.01i, 2.0 + 0.1i), with the  //
+// total size parameter from 0.5 to xmax, calculated point by point with            //
+// MultiLayerMie (without amplitudes) and with MieBatch, and the largest relative    //
+// difference of Qext between them.                                                  //
+//***********************************************************************************//
+void RunBatchComparison() {
+  std::vector<double> xmaxs = {5.0, 20.0, 100.0};
+  const int samples = 10000;
+  const std::complex<double> m1(1.5, 0.01), m2(2.0, 0.1);
+  timespec time1, time2;
+  printf("%8s, %8s, %14s, %14s, %8s, %12s\n", "xmax", "points", "scalar (ms)", "batch (ms)", "speedup", "max diff");
+  for (auto xmax : xmaxs) {
+    std::vector<double> x, Qext(samples);
+    std::vector<std::complex<double> > m;
+    for (int i = 0; i < samples; i++) {
+      const double xL = 0.5 + (xmax - 0.5)*i/(samples - 1);
+      x.insert(x.end(), {0.8*xL, xL});
+      m.insert(m.end(), {m1, m2});
+    }
+
+    nmie::MultiLayerMie ml_mie;
+    ml_mie.SetOutputMask(nmie::kEfficiencies | nmie::kRadiationPressure | nmie::kBackscattering);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time1);
+    for (int i = 0; i < samples; i++) {
+      ml_mie.SetLayersSize({x[2*i], x[2*i + 1]});
+      ml_mie.SetLayersIndex({m1, m2});
+      ml_mie.RunMieCalculation();
+      Qext[i] = ml_mie.GetQext();
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time2);
+    const double scalar = 1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9);
+
+    nmie::MieBatch batch;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time1);
+    batch.SetParticles(2, x, m);
+    batch.RunMieCalculation();
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time2);
+    const double batched = 1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9);
+
+    double max_diff = 0.0;
+    for (int i = 0; i < samples; i++)
+      max_diff = std::max(max_diff, std::abs(batch.GetQext()[i]/Qext[i] - 1));
+    printf("%8.1f, %8d, %14.3f, %14.3f, %8.2f, %12.3e\n", xmax, samples, scalar, batched, scalar/batched, max_diff);
+  }
+}
+
+
+//***********************************************************************************//
+// Wall time of a 1501-point spectrum (400-1000 nm) of a silver-like nanoshell with  //
+// a 50 nm core and a 10 nm shell, for pools of 1, 2, 4, ... threads up to the       //
+// number of hardware threads, and from the threads of another pool. All pools must //
+// give exactly the same spectrum.                                                   //
+//***********************************************************************************//
+void RunSpectrumThreads() {
+  nmie::MultiLayerMieApplied ml_mie;
+  ml_mie.AddTargetLayer(50.0, std::complex<double>(1.5, 0.0));
+  ml_mie.SetCoatingWidth({10.0});
+  ml_mie.SetCoatingIndex({std::complex<double>(0.1, 3.5)});
+  ml_mie.SetWidthSP({1.0});
+  ml_mie.SetIndexSP({std::complex<double>(1.5, 0.0)});
+  ml_mie.RunMieCalculation();
+
+  const int samples = 1501;
+  const unsigned int max_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<double> reference;
+  printf("%8s, %12s\n", "threads", "time (ms)");
+  for (unsigned int threads = 1; ; threads = std::min(2*threads, max_threads)) {
+    nmie::ThreadPool pool(threads);
+    std::vector<double> spectra;
+    timespec time1, time2;
+    long repeats = 1;
+    double elapsed = 0.0;
+    do {
+      repeats *= 2;
+      clock_gettime(CLOCK_MONOTONIC, &time1);
+      for (int i = 0; i < repeats; ++i) ml_mie.GetSpectra(400.0, 1000.0, samples, spectra, pool);
+      clock_gettime(CLOCK_MONOTONIC, &time2);
+      elapsed = diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9;
+    } while (elapsed < 0.2);
+    if (reference.empty()) reference = spectra;
+    printf("%8u, %12.3f%s\n", threads, 1e3*elapsed/repeats,
+           spectra == reference ? "" : "  (differs from 1 thread!)");
+    if (threads == max_threads) break;
+  }
+
+  // Spectra calculated from the threads of another pool, whose indexes go
+  // beyond the size of the pool of the spectra
+  const unsigned int outer_threads = 4;
+  nmie::ThreadPool outer(outer_threads), inner(1);
+  std::vector<nmie::MultiLayerMieApplied> models(outer_threads, ml_mie);
+  std::vector<std::vector<double> > nested(outer_threads);
+  outer.ParallelFor(outer_threads, 1, [&](unsigned long first, unsigned long, unsigned int) {
+      models[first].GetSpectra(400.0, 1000.0, samples, nested[first], inner);
+    });
+  bool same = true;
+  for (const auto& spectra : nested) same = same && spectra == reference;
+  printf("%8s  %s\n", "nested", same ? "same as 1 thread" : "differs from 1 thread!");
+}
+
+
+// Largest error of the linear interpolation of 'spectra' at the rows of
+// 'reference', relative to the largest efficiency
+double SpectrumError(const std::vector<double>& spectra, const std::vector<double>& reference) {
+  double error = 0.0, scale = 0.0;
+  for (unsigned long i = 0; i < reference.size()/5; i++)
+    for (int j = 1; j < 4; j++)
+      scale = std::max(scale, std::abs(reference[5*i + j]));
+  for (int j = 1; j < 4; j++) {
+    unsigned long k = 0;
+    for (unsigned long i = 0; i < reference.size()/5; i++) {
+      const double WL = reference[5*i];
+      while (5*(k + 2) < spectra.size() && spectra[5*(k + 1)] < WL) k++;
+      const double t = (WL - spectra[5*k])/(spectra[5*(k + 1)] - spectra[5*k]);
+      const double value = (1.0 - t)*spectra[5*k + j] + t*spectra[5*(k + 1) + j];
+      error = std::max(error, std::abs(value - reference[5*i + j])/scale);
+    }
+  }
+  return error;
+}
+
+
+//***********************************************************************************//
+// Number of samples of adaptive spectra (32 initial intervals) for several          //
+// tolerances, and the largest error of their linear interpolation against a         //
+// 40000-point spectrum, compared with a uniform spectrum of as many samples.        //
+//***********************************************************************************//
+void RunAdaptiveSpectrum() {
+  struct Case {
+    const char* name;
+    double core, shell;
+    std::complex<double> core_index, shell_index;
+    double from_WL, to_WL;
+  };
+  // Nanoshells have a broad plasmon, the large sphere has narrow
+  // whispering-gallery resonances
+  const std::vector<Case> cases = {
+    {"Au nanoshell", 24.5, 5.7, {1.46, 0.0}, {0.5, 2.5}, 400.0, 1000.0},
+    {"Ag nanoshell", 60.0, 10.0, {1.46, 0.0}, {0.1, 4.0}, 300.0, 1200.0},
+    {"dielectric sphere", 400.0, 0.0, {1.9, 0.0}, {1.0, 0.0}, 500.0, 1000.0}
+  };
+  const int reference_samples = 40000;
+  printf("%18s, %9s, %8s, %12s, %12s\n", "case", "tolerance", "samples", "adaptive err", "uniform err");
+  for (const auto& c : cases) {
+    nmie::MultiLayerMieApplied ml_mie;
+    ml_mie.AddTargetLayer(c.core, c.core_index);
+    if (c.shell > 0.0) {
+      ml_mie.SetCoatingWidth({c.shell});
+      ml_mie.SetCoatingIndex({c.shell_index});
+    }
+    ml_mie.SetWidthSP({1.0});
+    ml_mie.SetIndexSP({std::complex<double>(1.5, 0.0)});
+    ml_mie.RunMieCalculation();
+
+    std::vector<double> reference;
+    ml_mie.GetSpectra(c.from_WL, c.to_WL, reference_samples, reference);
+    for (double tolerance : {1e-2, 1e-3, 1e-4}) {
+      std::vector<double> adaptive, uniform;
+      ml_mie.GetSpectraAdaptive(c.from_WL, c.to_WL, 32, tolerance, reference_samples, adaptive);
+      const int samples = adaptive.size()/5;
+      ml_mie.GetSpectra(c.from_WL, c.to_WL + (c.to_WL - c.from_WL)/(samples - 1), samples, uniform);
+      printf("%18s, %9.0e, %8i, %12.2e, %12.2e\n", c.name, tolerance, samples,
+             SpectrumError(adaptive, reference), SpectrumError(uniform, reference));
+    }
+  }
+}
+
+
+//***********************************************************************************//
+// Number of terms, error estimate and true error (against a 20000-point spectrum)   //
+// of spectrum surrogates for several tolerances, the error after saving and         //
+// loading them, and the time per wavelength of a Mie calculation and of the         //
+// surrogate.                                                                        //
+//***********************************************************************************//
+void RunSpectrumSurrogate() {
+  struct Case {
+    const char* name;
+    double core, shell;
+    std::complex<double> core_index, shell_index;
+    double from_WL, to_WL;
+    int samples;
+  };
+  const std::vector<Case> cases = {
+    {"Au nanoshell", 24.5, 5.7, {1.46, 0.0}, {0.5, 2.5}, 400.0, 1000.0, 100},
+    {"Ag nanoshell", 60.0, 10.0, {1.46, 0.0}, {0.1, 4.0}, 300.0, 1200.0, 200},
+    {"dielectric sphere", 400.0, 0.0, {1.9, 0.0}, {1.0, 0.0}, 500.0, 1000.0, 400}
+  };
+  const int reference_samples = 20000;
+  printf("%18s, %9s, %6s, %10s, %10s, %10s, %12s, %12s\n", "case", "tolerance", "terms",
+         "estimate", "true err", "reload err", "Mie (ns)", "surr. (ns)");
+  for (const auto& c : cases) {
+    nmie::MultiLayerMieApplied ml_mie;
+    ml_mie.AddTargetLayer(c.core, c.core_index);
+    if (c.shell > 0.0) {
+      ml_mie.SetCoatingWidth({c.shell});
+      ml_mie.SetCoatingIndex({c.shell_index});
+    }
+    ml_mie.SetWidthSP({1.0});
+    ml_mie.SetIndexSP({std::complex<double>(1.5, 0.0)});
+    ml_mie.RunMieCalculation();
+
+    nmie::ThreadPool pool(1);
+    timespec time1, time2;
+    std::vector<double> reference;
+    clock_gettime(CLOCK_MONOTONIC, &time1);
+    ml_mie.GetSpectra(c.from_WL, c.to_WL, reference_samples, reference, pool);
+    clock_gettime(CLOCK_MONOTONIC, &time2);
+    const double mie_time = diff(time1,time2).tv_sec*1e9 + diff(time1,time2).tv_nsec;
+    std::vector<double> WLs(reference_samples);
+    for (int i = 0; i < reference_samples; i++) WLs[i] = reference[5*i];
+
+    for (double tolerance : {1e-4, 1e-6, 1e-8}) {
+      nmie::SpectrumSurrogate surrogate, reloaded;
+      ml_mie.GetSpectrumSurrogate(c.from_WL, c.to_WL, c.samples, tolerance, surrogate, pool);
+      std::stringstream stream;
+      surrogate.Save(stream);
+      reloaded.Load(stream);
+      std::vector<double> spectra;
+      long repeats = 1;
+      double elapsed = 0.0;
+      do {
+        repeats *= 2;
+        clock_gettime(CLOCK_MONOTONIC, &time1);
+        for (int i = 0; i < repeats; ++i) surrogate.Evaluate(WLs, spectra);
+        clock_gettime(CLOCK_MONOTONIC, &time2);
+        elapsed = diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9;
+      } while (elapsed < 0.2);
+      double error = 0.0, reload_error = 0.0;
+      std::vector<double> reloaded_spectra;
+      reloaded.Evaluate(WLs, reloaded_spectra);
+      for (unsigned long i = 0; i < spectra.size(); i++) {
+        error = std::max(error, std::abs(spectra[i] - reference[i]));
+        reload_error = std::max(reload_error, std::abs(spectra[i] - reloaded_spectra[i]));
+      }
+      printf("%18s, %9.0e, %6u, %10.2e, %10.2e, %10.2e, %12.1f, %12.1f\n", c.name, tolerance,
+             surrogate.GetTerms(), surrogate.GetErrorEstimate(), error, reload_error,
+             mie_time/reference_samples, 1e9*elapsed/repeats/reference_samples);
+    }
+  }
+}
+
+
+
+//***********************************************************************************//
+// Spectra (300-1200 nm) of a silica-silver nanoshell, with Sellmeier silica and     //
+// silver interpolated from a 10 nm table of a Drude model, while sweeping the shell //
+// width. Prints the error of the interpolated silver, the time to evaluate the      //
+// indexes of a grid, and the time per spectrum when the layers are rebuilt at each  //
+// wavelength (as a script calling the core once per wavelength would do) and when   //
+// it is calculated natively (which evaluates the indexes once for all the widths).  //
+//***********************************************************************************//
+void RunMaterialSpectrum() {
+  const nmie::Material silica = nmie::Material::Sellmeier({0.6961663, 0.4079426, 0.8974794},
+                                                          {0.0684043*0.0684043, 0.1162414*0.1162414,
+                                                           9.896161*9.896161});
+  const nmie::Material drude = nmie::Material::Drude(3.7, 9.1, 0.018);
+  std::vector<double> table_WL;
+  std::vector<std::complex<double> > table_index;
+  for (double WL = 300.0; WL <= 1200.0; WL += 10.0) {
+    table_WL.push_back(WL);
+    table_index.push_back(drude.GetIndex(WL));
+  }
+  const nmie::Material silver = nmie::Material::Tabulated(table_WL, table_index);
+  double table_error = 0.0;
+  for (double WL = 300.0; WL <= 1200.0; WL += 0.1)
+    table_error = std::max(table_error, std::abs(silver.GetIndex(WL)/drude.GetIndex(WL) - 1.0));
+  printf("Largest relative error of the interpolated silver: %.2e\n", table_error);
+
+  const int samples = 2000, widths = 10;
+  const double from_WL = 300.0, to_WL = 1200.0, core = 60.0;
+  std::vector<double> WLs(samples);
+  for (int j = 0; j < samples; j++) WLs[j] = from_WL + j*(to_WL - from_WL)/samples;
+  timespec time1, time2;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time1);
+  silica.GetIndex(WLs);
+  silver.GetIndex(WLs);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time2);
+  printf("Indexes for %i wavelengths: %.1f us\n", samples,
+         1e6*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9));
+
+  nmie::MultiLayerMieApplied applied;
+  applied.AddTargetLayer(core, silica);
+  applied.SetCoatingMaterial({silver});
+  applied.SetWidthSP({1.0});
+  applied.SetIndexSP({std::complex<double>(1.5, 0.0)});
+  nmie::ThreadPool pool(1);
+  printf("%12s, %14s, %14s\n", "shell (nm)", "per WL (ms)", "native (ms)");
+  for (int i = 0; i < widths; i++) {
+    const double shell = 5.0 + 2.0*i;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time1);
+    for (int j = 0; j < samples; j++) {
+      nmie::MultiLayerMie ml_mie;
+      ml_mie.SetLayersSize({2*PI*core/WLs[j], 2*PI*(core + shell)/WLs[j]});
+      ml_mie.SetLayersIndex({silica.GetIndex(WLs[j]), silver.GetIndex(WLs[j])});
+      ml_mie.RunMieCalculation();
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time2);
+    const double per_WL = 1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9);
+
+    applied.SetCoatingWidth({shell});
+    applied.RunMieCalculation();
+    std::vector<double> spectra;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time1);
+    applied.GetSpectra(from_WL, to_WL, samples, spectra, pool);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time2);
+    const double native = 1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9);
+    printf("%12.1f, %14.3f, %14.3f\n", shell, per_WL, native);
+  }
+}
+
+
+//***********************************************************************************//
+// Sweep of the wavelength (300-1200 nm) and the width of the silver coating of a    //
+// three-layer dielectric core. Compares one spectrum per width with the native      //
+// sweep, which calculates the core once per wavelength, with one thread and with    //
+// all of them. Prints the time per sweep and the largest relative difference.       //
+//***********************************************************************************//
+void RunParameterSweep() {
+  const nmie::Material silver = nmie::Material::Drude(3.7, 9.1, 0.018);
+  const int samples = 1000, widths = 64;
+  const double from_WL = 300.0, to_WL = 1200.0;
+  std::vector<double> WLs(samples), shells(widths);
+  for (int j = 0; j < samples; j++) WLs[j] = from_WL + j*(to_WL - from_WL)/samples;
+  for (int i = 0; i < widths; i++) shells[i] = 5.0 + 0.5*i;
+
+  nmie::MultiLayerMieApplied applied;
+  applied.AddTargetLayer(30.0, std::complex<double>(2.0, 0.0));
+  applied.AddTargetLayer(10.0, std::complex<double>(1.45, 0.0));
+  applied.AddTargetLayer(20.0, std::complex<double>(1.7, 0.01));
+  applied.SetCoatingMaterial({silver});
+  applied.SetCoatingWidth({shells[0]});
+  applied.SetWidthSP({1.0});
+  applied.SetIndexSP({std::complex<double>(1.5, 0.0)});
+  applied.RunMieCalculation();
+
+  nmie::ThreadPool pool(1);
+  timespec time1, time2;
+  std::vector<double> reference(4*widths*samples), spectra;
+  clock_gettime(CLOCK_MONOTONIC, &time1);
+  for (int i = 0; i < widths; i++) {
+    applied.SetCoatingWidth({shells[i]});
+    applied.RunMieCalculation();
+    applied.GetSpectra(from_WL, to_WL, samples, spectra, pool);
+    for (int j = 0; j < samples; j++)
+      for (int q = 0; q < 4; q++) reference[4*(i*samples + j) + q] = spectra[5*j + 1 + q];
+  }
+  clock_gettime(CLOCK_MONOTONIC, &time2);
+  printf("%24s: %10.2f ms\n", "Spectrum per width", 1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9));
+
+  const std::vector<nmie::SweepAxis> axes = {nmie::SweepAxis::Width(3, shells),
+                                             nmie::SweepAxis::Wavelength(WLs)};
+  for (int k = 0; k < 2; k++) {
+    std::vector<double> Q;
+    clock_gettime(CLOCK_MONOTONIC, &time1);
+    applied.GetSweep(axes, Q, k == 0 ? pool : nmie::ThreadPool::Shared());
+    clock_gettime(CLOCK_MONOTONIC, &time2);
+    double worst = 0.0;
+    for (unsigned long i = 0; i < Q.size(); i++)
+      worst = std::max(worst, std::abs(Q[i] - reference[i])/std::abs(reference[i]));
+    printf("%24s: %10.2f ms, difference %.2e\n",
+           k == 0 ? "Sweep, one thread" : "Sweep, all threads",
+           1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9), worst);
+  }
+}
+
+
+//***********************************************************************************//
+// Averages over a lognormal distribution (median x = 10, sigma = 0.3) of slightly   //
+// absorbing water droplets. A very tight adaptive quadrature is the reference;      //
+// prints the number of particles, the time and the errors of Qext, g and the        //
+// intensities for several tolerances and for a fixed trapezoidal rule in ln(s).     //
+//***********************************************************************************//
+void RunEnsemble() {
+  const nmie::SizeDistribution distribution = nmie::SizeDistribution::Lognormal(10.0, 0.3);
+  const std::vector<double> x = {1.0};
+  const std::vector<std::complex<double> > m = {std::complex<double>(1.33, 1e-4)};
+  std::vector<double> theta(91);
+  for (unsigned int t = 0; t < theta.size(); t++) theta[t] = PI*t/(theta.size() - 1);
+
+  nmie::ThreadPool pool(1);
+  nmie::MieEnsemble reference;
+  reference.SetParticle(x, m);
+  reference.SetDistribution(distribution);
+  reference.SetAngles(theta);
+  reference.SetTolerance(1e-10, 1000000);
+  reference.RunMieCalculation(pool);
+  double max_I = 0.0;
+  for (unsigned int t = 0; t < theta.size(); t++)
+    max_I = std::max(max_I, std::max(reference.GetI1()[t], reference.GetI2()[t]));
+  printf("Reference: Qext = %.10f, g = %.10f, %lu particles, estimate %.1e\n",
+         reference.GetQext(), reference.GetAsymmetryFactor(), reference.GetNodes(),
+         reference.GetErrorEstimate());
+
+  timespec time1, time2;
+  printf("%10s, %10s, %10s, %10s, %10s, %10s, %10s\n", "tolerance", "particles", "time (ms)",
+         "estimate", "Qext err", "g err", "I err");
+  for (double tolerance : {1e-2, 1e-3, 1e-4, 1e-5, 1e-6}) {
+    nmie::MieEnsemble ensemble;
+    ensemble.SetParticle(x, m);
+    ensemble.SetDistribution(distribution);
+    ensemble.SetAngles(theta);
+    ensemble.SetTolerance(tolerance);
+    clock_gettime(CLOCK_MONOTONIC, &time1);
+    ensemble.RunMieCalculation(pool);
+    clock_gettime(CLOCK_MONOTONIC, &time2);
+    double I_error = 0.0;
+    for (unsigned int t = 0; t < theta.size(); t++) {
+      I_error = std::max(I_error, std::abs(ensemble.GetI1()[t] - reference.GetI1()[t])/max_I);
+      I_error = std::max(I_error, std::abs(ensemble.GetI2()[t] - reference.GetI2()[t])/max_I);
+    }
+    printf("%10.0e, %10lu, %10.2f, %10.2e, %10.2e, %10.2e, %10.2e\n", tolerance, ensemble.GetNodes(),
+           1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9), ensemble.GetErrorEstimate(),
+           std::abs(ensemble.GetQext()/reference.GetQext() - 1.0),
+           std::abs(ensemble.GetAsymmetryFactor() - reference.GetAsymmetryFactor()), I_error);
+  }
+
+  // Fixed rule, one particle at a time
+  for (int samples : {200, 1000}) {
+    const double u_min = std::log(distribution.GetMinSize()), u_max = std::log(distribution.GetMaxSize());
+    double N = 0.0, G = 0.0, Cext = 0.0, Csca = 0.0, gCsca = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &time1);
+    for (int i = 0; i <= samples; i++) {
+      const double s = std::exp(u_min + i*(u_max - u_min)/samples);
+      const double weight = ((i == 0 || i == samples) ? 0.5 : 1.0)*distribution.GetDensity(s)*s;
+      nmie::MultiLayerMie ml_mie;
+      ml_mie.SetLayersSize({s});
+      ml_mie.SetLayersIndex(m);
+      ml_mie.SetAngles(theta);
+      ml_mie.RunMieCalculation();
+      N += weight;
+      G += weight*s*s;
+      Cext += weight*s*s*ml_mie.GetQext();
+      Csca += weight*s*s*ml_mie.GetQsca();
+      gCsca += weight*s*s*ml_mie.GetQsca()*ml_mie.GetAsymmetryFactor();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &time2);
+    printf("%10s, %10i, %10.2f, %10s, %10.2e, %10.2e\n", "trapezoid", samples + 1,
+           1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9), "-",
+           std::abs(Cext/G/reference.GetQext() - 1.0),
+           std::abs(gCsca/Csca - reference.GetAsymmetryFactor()));
+  }
+}
+
+
+//***********************************************************************************//
+// Resonances of a dielectric sphere (radius 400 nm, n = 1.9, 500-1000 nm) and of a  //
+// silica-silver nanoshell (60 + 10 nm, 300-1200 nm) found from a 100-sample scan.   //
+// Prints the time to find them and to calculate a 10^4-point spectrum, and the      //
+// multipole, wavelength, width and extinction of each resonance.                    //
+//***********************************************************************************//
+void RunResonanceFinder() {
+  nmie::ThreadPool pool(1);
+  for (int c = 0; c < 2; c++) {
+    nmie::MultiLayerMieApplied applied;
+    double from_WL = 500.0, to_WL = 1000.0;
+    if (c == 0) {
+      applied.AddTargetLayer(400.0, std::complex<double>(1.9, 0.0));
+    } else {
+      from_WL = 300.0;
+      to_WL = 1200.0;
+      applied.AddTargetLayer(60.0, std::complex<double>(1.45, 0.0));
+      applied.SetCoatingMaterial({nmie::Material::Drude(3.7, 9.1, 0.018)});
+      applied.SetCoatingWidth({10.0});
+    }
+    applied.SetWidthSP({1.0});
+    applied.SetIndexSP({std::complex<double>(1.5, 0.0)});
+    applied.RunMieCalculation();
+
+    timespec time1, time2;
+    std::vector<nmie::Resonance> resonances;
+    clock_gettime(CLOCK_MONOTONIC, &time1);
+    applied.GetResonances(from_WL, to_WL, 100, resonances, pool);
+    clock_gettime(CLOCK_MONOTONIC, &time2);
+    const double finder = 1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9);
+    std::vector<double> spectra;
+    clock_gettime(CLOCK_MONOTONIC, &time1);
+    applied.GetSpectra(from_WL, to_WL, 10000, spectra, pool);
+    clock_gettime(CLOCK_MONOTONIC, &time2);
+    const double scan = 1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9);
+    printf("%s: finder %.2f ms, 10^4-point spectrum %.2f ms\n", c == 0 ? "Sphere" : "Nanoshell",
+           finder, scan);
+    printf("%10s, %12s, %12s, %10s, %10s\n", "multipole", "WL (nm)", "width (nm)", "Qext", "fraction");
+    for (const auto& resonance : resonances)
+      printf("%9s%i, %12.4f, %12.4f, %10.4f, %10.3f\n", resonance.electric ? "a" : "b", resonance.order,
+             resonance.WL, resonance.width, resonance.Qext, resonance.fraction);
+  }
+}
+
+
+//***********************************************************************************//
+// Maps of Qext over 200 x 200 indexes (n = 1-4, k = 0-2) of spheres of radius 50,   //
+// 200 and 800 nm at 500 nm. Compares the time of one calculation per index with     //
+// the native map, with one thread and with all of them, and prints the largest      //
+// difference relative to the largest Qext of the map.                               //
+//***********************************************************************************//
+void RunIndexMap() {
+  const int samples = 200;
+  const double WL = 500.0;
+  std::vector<double> n(samples), k(samples);
+  for (int i = 0; i < samples; i++) {
+    n[i] = 1.0 + 3.0*i/(samples - 1);
+    k[i] = 2.0*i/(samples - 1);
+  }
+  nmie::ThreadPool pool(1);
+  printf("%12s, %14s, %14s, %14s, %12s\n", "radius (nm)", "per index (ms)", "map (ms)",
+         "threads (ms)", "difference");
+  for (double radius : {50.0, 200.0, 800.0}) {
+    timespec time1, time2;
+    std::vector<double> reference(samples*samples);
+    clock_gettime(CLOCK_MONOTONIC, &time1);
+    for (int i = 0; i < samples; i++) {
+      for (int j = 0; j < samples; j++) {
+        nmie::MultiLayerMie ml_mie;
+        ml_mie.SetLayersSize({2*PI*radius/WL});
+        ml_mie.SetLayersIndex({std::complex<double>(n[i], k[j])});
+        ml_mie.RunMieCalculation();
+        reference[i*samples + j] = ml_mie.GetQext();
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &time2);
+    const double per_index = 1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9);
+
+    nmie::MultiLayerMieApplied applied;
+    applied.SetWavelength(WL);
+    applied.AddTargetLayer(radius, std::complex<double>(1.5, 0.0));
+    applied.SetWidthSP({1.0});
+    applied.SetIndexSP({std::complex<double>(1.5, 0.0)});
+    applied.RunMieCalculation();
+    const double largest = *std::max_element(reference.begin(), reference.end());
+    double map_time[2], worst = 0.0;
+    for (int t = 0; t < 2; t++) {
+      std::vector<double> Q;
+      clock_gettime(CLOCK_MONOTONIC, &time1);
+      applied.GetIndexMap(0, n, k, Q, t == 0 ? pool : nmie::ThreadPool::Shared());
+      clock_gettime(CLOCK_MONOTONIC, &time2);
+      map_time[t] = 1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9);
+      for (int i = 0; i < samples*samples; i++)
+        worst = std::max(worst, std::abs(Q[4*i] - reference[i])/largest);
+    }
+    printf("%12.0f, %14.2f, %14.2f, %14.2f, %12.2e\n", radius, per_index, map_time[0], map_time[1], worst);
+  }
+}
+
+
+//***********************************************************************************//
+// Lookup table of x = 0.1-5 (400 log-spaced values), n = 1.30-1.60 (31 values) and  //
+// k = 0-0.05 (6 values) with 8 moments, written to speed-test.lut and removed at    //
+// the end. Prints the time to generate it and to resume the finished table, the     //
+// error of chi_0 - 1 and chi_1 - g of the nodes, and for 2000 random points the     //
+// time per point and the largest errors of Qext (relative) and g for Interpolate()  //
+// and for Evaluate() with tolerance 1e-3, and how many points Evaluate() had to     //
+// calculate.                                                                        //
+//***********************************************************************************//
+void RunLookupTable() {
+  const char* file_name = "speed-test.lut";
+  std::vector<double> x(400), n(31), k(6);
+  for (unsigned int i = 0; i < x.size(); i++) x[i] = 0.1*std::pow(50.0, i/(x.size() - 1.0));
+  for (unsigned int i = 0; i < n.size(); i++) n[i] = 1.3 + 0.01*i;
+  for (unsigned int i = 0; i < k.size(); i++) k[i] = 0.01*i;
+  remove(file_name);
+  timespec time1, time2;
+  for (int run = 0; run < 2; run++) {
+    clock_gettime(CLOCK_MONOTONIC, &time1);
+    nmie::MieTable::Generate(file_name, x, n, k, 8);
+    clock_gettime(CLOCK_MONOTONIC, &time2);
+    printf("%s: %.2f ms\n", run == 0 ? "Generate" : "Resume", 1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9));
+  }
+
+  nmie::MieTable table(file_name);
+  std::vector<double> values(table.GetNames().size()), exact(values.size());
+  double moment_error = 0.0;
+  for (double xi : x) {
+    nmie::MieTable::CalcNode(xi, n[3], k[2], 8, values.data());
+    moment_error = std::max(moment_error, std::max(std::abs(values[6] - 1.0), std::abs(values[7] - values[5])));
+  }
+  printf("Largest error of chi_0 and chi_1 of the nodes: %.2e\n", moment_error);
+
+  const int points = 2000;
+  std::vector<std::array<double, 3> > coords(points);
+  std::vector<std::vector<double> > reference(points, std::vector<double>(values.size()));
+  srand(1);
+  for (int i = 0; i < points; i++) {
+    coords[i] = {0.1*std::pow(50.0, rand()/(RAND_MAX + 1.0)), 1.3 + 0.3*rand()/(RAND_MAX + 1.0),
+                 0.05*rand()/(RAND_MAX + 1.0)};
+    nmie::MieTable::CalcNode(coords[i][0], coords[i][1], coords[i][2], 8, reference[i].data());
+  }
+  int calculated = 0;
+  for (int mode = 0; mode < 2; mode++) {
+    double worst_Q = 0.0, worst_g = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &time1);
+    for (int i = 0; i < points; i++) {
+      if (mode == 0) {
+        calculated += table.Interpolate(coords[i][0], coords[i][1], coords[i][2], values) > 1e-3;
+      } else {
+        table.Evaluate(coords[i][0], coords[i][1], coords[i][2], 1e-3, values);
+      }
+      worst_Q = std::max(worst_Q, std::abs(values[0] - reference[i][0])/reference[i][0]);
+      worst_g = std::max(worst_g, std::abs(values[5] - reference[i][5]));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &time2);
+    printf("%s: %.0f ns per point, Qext error %.2e, g error %.2e\n", mode == 0 ? "Interpolate" : "Evaluate",
+           1e9*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9)/points, worst_Q, worst_g);
+  }
+  printf("Evaluate calculated %i of %i points\n", calculated, points);
+  remove(file_name);
+}
+
+//***********************************************************************************//
+// Near field of a coated sphere (x = 2.5, 3.5) on a spherical volume of 40 radii,   //
+// 60 polar and 72 azimuthal angles, calculated point by point and with the         //
+// azimuthal separation. Prints both times and the largest difference of E,         //
+// relative to the largest |E|.                                                      //
+//***********************************************************************************//
+void RunFieldVolume() {
+  nmie::MultiLayerMie multi_layer_mie;
+  multi_layer_mie.SetLayersSize({2.5, 3.5});
+  multi_layer_mie.SetLayersIndex({std::complex<double>(1.5, 0.01), std::complex<double>(2.0, 0.1)});
+
+  std::vector<double> rho(40), theta(60), phi(72);
+  for (unsigned int i = 0; i < rho.size(); i++) rho[i] = 0.2 + 6.8*i/(rho.size() - 1.0);
+  for (unsigned int i = 0; i < theta.size(); i++) theta[i] = PI*(i + 0.5)/theta.size();
+  for (unsigned int i = 0; i < phi.size(); i++) phi[i] = 2.0*PI*i/phi.size();
+  std::vector<double> plane_rho, plane_theta;
+  std::vector<std::vector<double> > coords(3);
+  for (double r : rho) {
+    for (double t : theta) {
+      plane_rho.push_back(r);
+      plane_theta.push_back(t);
+      for (double p : phi) {
+        coords[0].push_back(r*std::sin(t)*std::cos(p));
+        coords[1].push_back(r*std::sin(t)*std::sin(p));
+        coords[2].push_back(r*std::cos(t));
+      }
+    }
+  }
+
+  timespec time1, time2;
+  multi_layer_mie.SetFieldCoords(coords);
+  clock_gettime(CLOCK_MONOTONIC, &time1);
+  multi_layer_mie.RunFieldCalculation();
+  clock_gettime(CLOCK_MONOTONIC, &time2);
+  const double point_time = diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9;
+  const std::vector<std::vector<std::complex<double> > > E = multi_layer_mie.GetFieldE();
+
+  clock_gettime(CLOCK_MONOTONIC, &time1);
+  multi_layer_mie.RunFieldCalculationPolar(plane_rho, plane_theta, phi);
+  clock_gettime(CLOCK_MONOTONIC, &time2);
+  const double polar_time = diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9;
+  const std::vector<std::vector<std::complex<double> > >& E_polar = multi_layer_mie.GetFieldE();
+
+  double largest = 0.0, difference = 0.0;
+  for (unsigned long i = 0; i < E.size(); i++) {
+    for (int c = 0; c < 3; c++) {
+      largest = std::max(largest, std::abs(E[i][c]));
+      difference = std::max(difference, std::abs(E[i][c] - E_polar[i][c]));
+    }
+  }
+  printf("%lu points: %.2f ms point by point, %.2f ms with azimuthal separation, difference %.2e\n",
+         E.size(), 1e3*point_time, 1e3*polar_time, difference/largest);
+}
+
+
+//***********************************************************************************//
+// Near field of a coated sphere (x = 2.5, 3.5) on a Cartesian plane (z = 0, 301 x   //
+// 301 points), a cylindrical grid (40 x 72 x 61 points) and a spherical grid (40 x  //
+// 60 x 72 points), calculated point by point and with the structured grids. Prints  //
+// both times and the largest difference of E, relative to the largest |E|.          //
+//***********************************************************************************//
+void RunFieldGrids() {
+  nmie::MultiLayerMie multi_layer_mie;
+  multi_layer_mie.SetLayersSize({2.5, 3.5});
+  multi_layer_mie.SetLayersIndex({std::complex<double>(1.5, 0.01), std::complex<double>(2.0, 0.1)});
+
+  std::vector<double> axis(301), plane = {0.0}, radius(40), height(61), polar(60), azimuth(72);
+  for (unsigned int i = 0; i < axis.size(); i++) axis[i] = -7.0 + 14.0*i/(axis.size() - 1.0);
+  for (unsigned int i = 0; i < radius.size(); i++) radius[i] = 0.2 + 6.8*i/(radius.size() - 1.0);
+  for (unsigned int i = 0; i < height.size(); i++) height[i] = -7.0 + 14.0*i/(height.size() - 1.0);
+  for (unsigned int i = 0; i < polar.size(); i++) polar[i] = PI*(i + 0.5)/polar.size();
+  for (unsigned int i = 0; i < azimuth.size(); i++) azimuth[i] = 2.0*PI*i/azimuth.size();
+
+  timespec time1, time2;
+  for (int grid = 0; grid < 3; grid++) {
+    std::vector<std::vector<double> > coords(3);
+    const std::vector<double> &u = grid == 0 ? axis : radius, &v = grid == 0 ? axis : grid == 1 ? azimuth : polar,
+        &w = grid == 0 ? plane : grid == 1 ? height : azimuth;
+    for (double a : u) {
+      for (double b : v) {
+        for (double c : w) {
+          if (grid == 0) {
+            coords[0].push_back(a);
+            coords[1].push_back(b);
+            coords[2].push_back(c);
+          } else if (grid == 1) {
+            coords[0].push_back(a*std::cos(b));
+            coords[1].push_back(a*std::sin(b));
+            coords[2].push_back(c);
+          } else {
+            coords[0].push_back(a*std::sin(b)*std::cos(c));
+            coords[1].push_back(a*std::sin(b)*std::sin(c));
+            coords[2].push_back(a*std::cos(b));
+          }
+        }
+      }
+    }
+
+    multi_layer_mie.SetFieldCoords(coords);
+    clock_gettime(CLOCK_MONOTONIC, &time1);
+    multi_layer_mie.RunFieldCalculation();
+    clock_gettime(CLOCK_MONOTONIC, &time2);
+    const double point_time = diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9;
+    const std::vector<std::vector<std::complex<double> > > E = multi_layer_mie.GetFieldE();
+
+    clock_gettime(CLOCK_MONOTONIC, &time1);
+    if (grid == 0) multi_layer_mie.RunFieldCalculationCartesian(u, v, w);
+    if (grid == 1) multi_layer_mie.RunFieldCalculationCylindrical(u, v, w);
+    if (grid == 2) multi_layer_mie.RunFieldCalculationSpherical(u, v, w);
+    clock_gettime(CLOCK_MONOTONIC, &time2);
+    const double grid_time = diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9;
+    const std::vector<std::vector<std::complex<double> > >& E_grid = multi_layer_mie.GetFieldE();
+
+    double largest = 0.0, difference = 0.0;
+    for (unsigned long i = 0; i < E.size(); i++) {
+      for (int c = 0; c < 3; c++) {
+        largest = std::max(largest, std::abs(E[i][c]));
+        difference = std::max(difference, std::abs(E[i][c] - E_grid[i][c]));
+      }
+    }
+    printf("%-11s %6lu points: %8.2f ms point by point, %7.2f ms on the grid, difference %.2e\n",
+           grid == 0 ? "Cartesian" : grid == 1 ? "Cylindrical" : "Spherical", E.size(),
+           1e3*point_time, 1e3*grid_time, difference/largest);
+  }
+}
+
+
+//***********************************************************************************//
+// Field map of a coated sphere (x = 2.5, 3.5) on a 501 x 501 plane, calculated with //
+// 1, 2, 4, ... threads (at least up to 4, to check that the results do not depend   //
+// on the number of threads).                                                        //
+//***********************************************************************************//
+void RunFieldThreads() {
+  nmie::MultiLayerMie multi_layer_mie;
+  multi_layer_mie.SetLayersSize({2.5, 3.5});
+  multi_layer_mie.SetLayersIndex({std::complex<double>(1.5, 0.01), std::complex<double>(2.0, 0.1)});
+
+  const int samples = 501;
+  std::vector<std::vector<double> > coords(3);
+  for (int i = 0; i < samples; i++) {
+    for (int j = 0; j < samples; j++) {
+      coords[0].push_back(-7.0 + 14.0*i/(samples - 1.0));
+      coords[1].push_back(0.0);
+      coords[2].push_back(-7.0 + 14.0*j/(samples - 1.0));
+    }
+  }
+  multi_layer_mie.SetFieldCoords(coords);
+
+  // Serial reference, which also allocates the fields
+  nmie::ThreadPool serial(1);
+  multi_layer_mie.RunFieldCalculation(serial);
+  const std::vector<std::vector<std::complex<double> > > reference = multi_layer_mie.GetFieldE();
+
+  const unsigned int max_threads = std::max(4u, std::thread::hardware_concurrency());
+  printf("%8s, %12s\n", "threads", "time (ms)");
+  for (unsigned int threads = 1; ; threads = std::min(2*threads, max_threads)) {
+    nmie::ThreadPool pool(threads);
+    timespec time1, time2;
+    clock_gettime(CLOCK_MONOTONIC, &time1);
+    multi_layer_mie.RunFieldCalculation(pool);
+    clock_gettime(CLOCK_MONOTONIC, &time2);
+    printf("%8u, %12.3f%s\n", threads, 1e3*(diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9),
+           multi_layer_mie.GetFieldE() == reference ? "" : "  (differs from 1 thread!)");
+    if (threads == max_threads) break;
+  }
+}
+
+
+//***********************************************************************************//
+// Near field of a coated sphere (x = 2.5, 3.5) on a 301 x 181 polar grid of the     //
+// plane y = 0, calculated one point at a time (RunFieldCalculationPolar with a      //
+// single Phi) and several points at a time in SIMD lanes (RunFieldCalculation).     //
+//***********************************************************************************//
+void RunFieldLanes() {
+  nmie::MultiLayerMie multi_layer_mie;
+  multi_layer_mie.SetLayersSize({2.5, 3.5});
+  multi_layer_mie.SetLayersIndex({std::complex<double>(1.5, 0.01), std::complex<double>(2.0, 0.1)});
+
+  std::vector<double> radius, polar, azimuth = {0.0};
+  std::vector<std::vector<double> > coords(3);
+  for (int i = 0; i < 301; i++) {
+    for (int j = 0; j < 181; j++) {
+      radius.push_back(0.05 + 6.95*i/300.0);
+      polar.push_back(PI*j/180.0);
+      coords[0].push_back(radius.back()*std::sin(polar.back()));
+      coords[1].push_back(0.0);
+      coords[2].push_back(radius.back()*std::cos(polar.back()));
+    }
+  }
+  multi_layer_mie.SetFieldCoords(coords);
+
+  // First runs, which allocate the results
+  multi_layer_mie.RunFieldCalculationPolar(radius, polar, azimuth);
+  multi_layer_mie.RunFieldCalculation();
+
+  timespec time1, time2;
+  clock_gettime(CLOCK_MONOTONIC, &time1);
+  multi_layer_mie.RunFieldCalculationPolar(radius, polar, azimuth);
+  clock_gettime(CLOCK_MONOTONIC, &time2);
+  const double point_time = diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9;
+  const std::vector<std::vector<std::complex<double> > > E = multi_layer_mie.GetFieldE();
+
+  clock_gettime(CLOCK_MONOTONIC, &time1);
+  multi_layer_mie.RunFieldCalculation();
+  clock_gettime(CLOCK_MONOTONIC, &time2);
+  const double lane_time = diff(time1,time2).tv_sec + diff(time1,time2).tv_nsec/1e9;
+  const std::vector<std::vector<std::complex<double> > >& E_lanes = multi_layer_mie.GetFieldE();
+
+  double largest = 0.0, difference = 0.0;
+  for (unsigned long i = 0; i < E.size(); i++) {
+    for (int c = 0; c < 3; c++) {
+      largest = std::max(largest, std::abs(E[i][c]));
+      difference = std::max(difference, std::abs(E[i][c] - E_lanes[i][c]));
+    }
+  }
+  printf("%lu points: %8.2f ms one by one, %8.2f ms in %d lanes, difference %.2e\n", E.size(),
+         1e3*point_time, 1e3*lane_time, nmie::simd::GetFieldKernel<double>().lanes, difference/largest);
+}
+
+
 timespec diff(timespec start, timespec end)
 {
 	timespec temp;
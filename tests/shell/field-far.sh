@@ -0,0 +1,43 @@
+#! /bin/sh
+#
+#    Copyright (C) 2009-2015 Ovidio Peña Rodríguez <ovidio@bytesfall.com>
+#    Copyright (C) 2013-2015 Konstantin Ladutenko <kostyfisik@gmail.com>
+#
+#    This file is part of scattnlay
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    The only additional remark is that we expect that all publications
+#    describing work using this software, or all commercial products
+#    using it, cite the following reference:
+#    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by
+#        a multilayered sphere," Computer Physics Communications,
+#        vol. 180, Nov. 2009, pp. 2348-2354.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# This test checks the fields of a small sphere (x = 1, m = 1.5 + 0.01i) at
+# points very far from it (Rho*|m| > 1e4), where the continued fraction for
+# D1 does not converge, against the reference values in field-far.txt.
+
+PROGRAM=${PROGRAM:-'../../../fieldnlay'}
+
+$PROGRAM -l 1 1.0 1.5 0.01 -p 2e4 1e5 2 0 0 1 1e3 1e3 1 | paste -d, - "$(dirname "$0")/field-far.txt" | awk -F, '
+  /X/ { next }
+  {
+    for (i = 1; i <= 15; i++) {
+      a = $i + 0; b = $(i + 15) + 0; d = a - b; if (d < 0) d = -d
+      m = (a < 0 ? -a : a); if (m < 1e-3) m = 1e-3
+      if (d > 1e-4*m) { printf("Line %d, column %d: %s instead of %s\n", NR, i, $i, $(i + 15)); failed = 1 }
+    }
+  }
+  END { if (failed || NR == 0) { print "FAILED"; exit 1 } else print "OK" }'
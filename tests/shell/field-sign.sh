@@ -0,0 +1,49 @@
+#! /bin/sh
+#
+#    Copyright (C) 2009-2015 Ovidio Peña Rodríguez <ovidio@bytesfall.com>
+#    Copyright (C) 2013-2015 Konstantin Ladutenko <kostyfisik@gmail.com>
+#
+#    This file is part of scattnlay
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    The only additional remark is that we expect that all publications
+#    describing work using this software, or all commercial products
+#    using it, cite the following reference:
+#    [1] O. Pena and U. Pal, "Scattering of electromagnetic radiation by
+#        a multilayered sphere," Computer Physics Communications,
+#        vol. 180, Nov. 2009, pp. 2348-2354.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# This test checks the fields of the nanoshell of field-nanoshell.sh at
+# points with y < 0 and y > 0, outside the particle and in the core,
+# against the reference values in field-sign.txt. For an incident wave
+# polarized along x, Ey, Hx and Hz change sign with y and the rest of
+# the components do not.
+
+PROGRAM=${PROGRAM:-'../../../fieldnlay'}
+ARGS='-l 2 0.38989409 1.16177963 0.00000000 0.46787291 0.42850284 5.47718289'
+
+{
+  $PROGRAM $ARGS -p 0.3 0.3 1 -0.6 0.6 3 0.2 0.2 1
+  $PROGRAM $ARGS -p 0.1 0.1 1 -0.2 0.2 2 0.1 0.1 1
+} | paste -d, - "$(dirname "$0")/field-sign.txt" | awk -F, '
+  /X/ { next }
+  {
+    for (i = 1; i <= 15; i++) {
+      a = $i + 0; b = $(i + 15) + 0; d = a - b; if (d < 0) d = -d
+      m = (a < 0 ? -a : a); if (m < 1e-3) m = 1e-3
+      if (d > 1e-4*m) { printf("Line %d, column %d: %s instead of %s\n", NR, i, $i, $(i + 15)); failed = 1 }
+    }
+  }
+  END { if (failed) { print "FAILED"; exit 1 } else print "OK" }'